@@ -31,6 +31,24 @@
 
 #include "json.h"
 
+//  Compressed input, when built with -DJSON_ZLIB -lz and/or -DJSON_ZSTD -lzstd:
+#ifdef JSON_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JSON_ZSTD
+#include <zstd.h>
+#endif
+
+//  For the pipe in 'JSON_zipBench':
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+//  String escaping on output, with SSE2 where there is:
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 
 
@@ -43,591 +61,2332 @@
 
 
 //
-//  The example callback, plus printing method.
-//
-//  'cmd':   one of JSON_CMD
-//  'r':     the rank of the item in a list or object (ie. r>0 means a comma is printed first)
-//  'd':     the nesting depth, for pretty-print indentation
-//  's':     a string (might be an object label, or a string value)
-//  'n':     double number OR one of JSON_SYM_* (when cmd==JSON_CMD_VAL_SYM)
-//  'user':  the user pointer given in JSON_parse, set to the stream or file to be printed to.
+//  Numbers:  the shortest digits that read back to the same double, by
+//  Grisu2 (Loitsch, "Printing floating-point numbers quickly and
+//  accurately with integers", 2010).  A 64-bit significand with a binary
+//  exponent is scaled by a cached power of ten into a window where the
+//  digits come out of integer arithmetic, and digits are generated until
+//  the value is pinned between the neighbours of the double.  Integral
+//  values take a plain integer path first.
 //
-//  Return code:  0 contines parsing <>0 stops parsing
-int JSON_print(int cmd, int r, int d, char *s, double n, void *user)
+typedef struct
 {
-    FILE *str=(FILE*)user;
+    u_int64_t f;
+    int e;
+}
+JSON_DIYFP;
 
-    //fprintf(stderr, "cmd=%x, r=%i, d=%i, s=\"%s\", n=%f\n", cmd, r, d, s, n);
+typedef struct
+{
+    u_int64_t f;
+    int e;
+    int k;
+}
+JSON_POW10;
 
-    //  In these cases, a comma-separator is needed before the next value:
-    //  Except if the previous call was an object label.  In this case the rank
-    //  is r=0 as values following an OLBL are always ranked '0'.
-    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
-        fprintf(str, ",");
+//  10^k, normalized, for k=-300 to 324 in steps of 8:
+JSON_POW10 JSON_pow10[]=
+{
+    {0xAB70FE17C79AC6CAULL, -1060, -300},
+    {0xFF77B1FCBEBCDC4FULL, -1034, -292},
+    {0xBE5691EF416BD60CULL, -1007, -284},
+    {0x8DD01FAD907FFC3CULL,  -980, -276},
+    {0xD3515C2831559A83ULL,  -954, -268},
+    {0x9D71AC8FADA6C9B5ULL,  -927, -260},
+    {0xEA9C227723EE8BCBULL,  -901, -252},
+    {0xAECC49914078536DULL,  -874, -244},
+    {0x823C12795DB6CE57ULL,  -847, -236},
+    {0xC21094364DFB5637ULL,  -821, -228},
+    {0x9096EA6F3848984FULL,  -794, -220},
+    {0xD77485CB25823AC7ULL,  -768, -212},
+    {0xA086CFCD97BF97F4ULL,  -741, -204},
+    {0xEF340A98172AACE5ULL,  -715, -196},
+    {0xB23867FB2A35B28EULL,  -688, -188},
+    {0x84C8D4DFD2C63F3BULL,  -661, -180},
+    {0xC5DD44271AD3CDBAULL,  -635, -172},
+    {0x936B9FCEBB25C996ULL,  -608, -164},
+    {0xDBAC6C247D62A584ULL,  -582, -156},
+    {0xA3AB66580D5FDAF6ULL,  -555, -148},
+    {0xF3E2F893DEC3F126ULL,  -529, -140},
+    {0xB5B5ADA8AAFF80B8ULL,  -502, -132},
+    {0x87625F056C7C4A8BULL,  -475, -124},
+    {0xC9BCFF6034C13053ULL,  -449, -116},
+    {0x964E858C91BA2655ULL,  -422, -108},
+    {0xDFF9772470297EBDULL,  -396, -100},
+    {0xA6DFBD9FB8E5B88FULL,  -369,  -92},
+    {0xF8A95FCF88747D94ULL,  -343,  -84},
+    {0xB94470938FA89BCFULL,  -316,  -76},
+    {0x8A08F0F8BF0F156BULL,  -289,  -68},
+    {0xCDB02555653131B6ULL,  -263,  -60},
+    {0x993FE2C6D07B7FACULL,  -236,  -52},
+    {0xE45C10C42A2B3B06ULL,  -210,  -44},
+    {0xAA242499697392D3ULL,  -183,  -36},
+    {0xFD87B5F28300CA0EULL,  -157,  -28},
+    {0xBCE5086492111AEBULL,  -130,  -20},
+    {0x8CBCCC096F5088CCULL,  -103,  -12},
+    {0xD1B71758E219652CULL,   -77,   -4},
+    {0x9C40000000000000ULL,   -50,    4},
+    {0xE8D4A51000000000ULL,   -24,   12},
+    {0xAD78EBC5AC620000ULL,     3,   20},
+    {0x813F3978F8940984ULL,    30,   28},
+    {0xC097CE7BC90715B3ULL,    56,   36},
+    {0x8F7E32CE7BEA5C70ULL,    83,   44},
+    {0xD5D238A4ABE98068ULL,   109,   52},
+    {0x9F4F2726179A2245ULL,   136,   60},
+    {0xED63A231D4C4FB27ULL,   162,   68},
+    {0xB0DE65388CC8ADA8ULL,   189,   76},
+    {0x83C7088E1AAB65DBULL,   216,   84},
+    {0xC45D1DF942711D9AULL,   242,   92},
+    {0x924D692CA61BE758ULL,   269,  100},
+    {0xDA01EE641A708DEAULL,   295,  108},
+    {0xA26DA3999AEF774AULL,   322,  116},
+    {0xF209787BB47D6B85ULL,   348,  124},
+    {0xB454E4A179DD1877ULL,   375,  132},
+    {0x865B86925B9BC5C2ULL,   402,  140},
+    {0xC83553C5C8965D3DULL,   428,  148},
+    {0x952AB45CFA97A0B3ULL,   455,  156},
+    {0xDE469FBD99A05FE3ULL,   481,  164},
+    {0xA59BC234DB398C25ULL,   508,  172},
+    {0xF6C69A72A3989F5CULL,   534,  180},
+    {0xB7DCBF5354E9BECEULL,   561,  188},
+    {0x88FCF317F22241E2ULL,   588,  196},
+    {0xCC20CE9BD35C78A5ULL,   614,  204},
+    {0x98165AF37B2153DFULL,   641,  212},
+    {0xE2A0B5DC971F303AULL,   667,  220},
+    {0xA8D9D1535CE3B396ULL,   694,  228},
+    {0xFB9B7CD9A4A7443CULL,   720,  236},
+    {0xBB764C4CA7A44410ULL,   747,  244},
+    {0x8BAB8EEFB6409C1AULL,   774,  252},
+    {0xD01FEF10A657842CULL,   800,  260},
+    {0x9B10A4E5E9913129ULL,   827,  268},
+    {0xE7109BFBA19C0C9DULL,   853,  276},
+    {0xAC2820D9623BF429ULL,   880,  284},
+    {0x80444B5E7AA7CF85ULL,   907,  292},
+    {0xBF21E44003ACDD2DULL,   933,  300},
+    {0x8E679C2F5E44FF8FULL,   960,  308},
+    {0xD433179D9C8CB841ULL,   986,  316},
+    {0x9E19DB92B4E31BA9ULL,  1013,  324}
+};
 
-    //  All possible commands:
-    if (cmd&JSON_CMD_NEW_ARRAY)
-    {
-        fprintf(str, "[");
-    }
-    if (cmd&JSON_CMD_NEW_OBJ)
-    {
-        fprintf(str, "{");
-    }
-    if (cmd&JSON_CMD_VAL_OLBL)
-    {
-        fprintf(str, "\"%s\":", s);
-    }
-    if (cmd&JSON_CMD_VAL_NUM)
+
+JSON_DIYFP JSON_diyMul(JSON_DIYFP x, JSON_DIYFP y)
+{
+    //  The upper 64 bits of the 128 bit product, rounded:
+    u_int64_t a=x.f>>32, b=x.f&0xFFFFFFFF;
+    u_int64_t c=y.f>>32, d=y.f&0xFFFFFFFF;
+    u_int64_t ac=a*c, bc=b*c, ad=a*d, bd=b*d;
+    u_int64_t t=(bd>>32)+(ad&0xFFFFFFFF)+(bc&0xFFFFFFFF)+(1U<<31);
+    JSON_DIYFP r;
+    r.f=ac+(ad>>32)+(bc>>32)+(t>>32);
+    r.e=x.e+y.e+64;
+    return(r);
+}
+
+
+JSON_DIYFP JSON_diyNorm(JSON_DIYFP x)
+{
+    while (!(x.f>>63))
     {
-        //  Rudimentary 'floor' method to see if the value is true 'int'
-        if ((double)((long long int)n)==n)
-            fprintf(str, "%lli", (long long int) n);
-        else
-            fprintf(str, "%f", n);
+        x.f<<=1;
+        x.e-=1;
     }
-    if (cmd&JSON_CMD_VAL_STR)
+    return(x);
+}
+
+
+//
+//  Steps the last digit down while that brings it closer to the value,
+//  and it stays within the boundaries:
+//
+void JSON_grisuRound(char *b, int len, u_int64_t dist, u_int64_t delta, u_int64_t rest, u_int64_t ten)
+{
+    while (rest<dist && delta-rest>=ten && (rest+ten<dist || dist-rest>rest+ten-dist))
     {
-        fprintf(str, "\"%s\"", s);
+        b[len-1]-=1;
+        rest+=ten;
     }
-    if (cmd&JSON_CMD_VAL_SYM)
+    return;
+}
+
+
+//
+//  The digits of 'w', as few as will stay between 'lo' and 'hi'.  Returns
+//  the number of digits; the value is digits*10^(*k).
+//
+int JSON_grisuDigits(char *b, int *k, JSON_DIYFP lo, JSON_DIYFP w, JSON_DIYFP hi)
+{
+    u_int64_t delta=hi.f-lo.f;
+    u_int64_t dist=hi.f-w.f;
+    u_int64_t one=((u_int64_t)1)<<-hi.e;
+    u_int32_t p1=(u_int32_t)(hi.f>>-hi.e);
+    u_int64_t p2=hi.f&(one-1);
+    u_int32_t pow10;
+    int len=0, n, m;
+
+    //  The digits of the integral part:
+    if (p1>=1000000000) {pow10=1000000000; n=10;}
+    else if (p1>=100000000) {pow10=100000000; n=9;}
+    else if (p1>=10000000) {pow10=10000000; n=8;}
+    else if (p1>=1000000) {pow10=1000000; n=7;}
+    else if (p1>=100000) {pow10=100000; n=6;}
+    else if (p1>=10000) {pow10=10000; n=5;}
+    else if (p1>=1000) {pow10=1000; n=4;}
+    else if (p1>=100) {pow10=100; n=3;}
+    else if (p1>=10) {pow10=10; n=2;}
+    else {pow10=1; n=1;}
+    while (n>0)
     {
-        if ((int)n==JSON_SYM_TRUE)
-            fprintf(str, "true");
-        else if ((int)n==JSON_SYM_FALSE)
-            fprintf(str, "false");
-        else
-            fprintf(str, "null");
-    }
-    if (cmd&JSON_CMD_END_OBJ)
-    {    
-        fprintf(str, "}");
+        u_int64_t rest;
+        b[len++]='0'+(char)(p1/pow10);
+        p1%=pow10;
+        n-=1;
+        rest=(((u_int64_t)p1)<<-hi.e)+p2;
+        if (rest<=delta)
+        {
+            (*k)+=n;
+            JSON_grisuRound(b, len, dist, delta, rest, ((u_int64_t)pow10)<<-hi.e);
+            return(len);
+        }
+        pow10/=10;
     }
-    if (cmd&JSON_CMD_END_ARRAY)
+
+    //  And of the fraction:
+    m=0;
+    for (;;)
     {
-        fprintf(str, "]");
+        p2*=10;
+        b[len++]='0'+(char)(p2>>-hi.e);
+        p2&=one-1;
+        m+=1;
+        delta*=10;
+        dist*=10;
+        if (p2<=delta)
+            break;
     }
-
-    return(0);
+    (*k)-=m;
+    JSON_grisuRound(b, len, dist, delta, p2, one);
+    return(len);
 }
 
 
+//  Integers, digits by hand from the back:
+int JSON_utoa(char *buf, u_int64_t u)
+{
+    char d[24];
+    int i=24;
+    do
+    {
+        i-=1;
+        d[i]='0'+(char)(u%10);
+        u/=10;
+    }
+    while (u);
+    memcpy(buf, d+i, 24-i);
+    buf[24-i]=0;
+    return(24-i);
+}
 
-//
-//  Method for printing compactly to a memory buffer 'snprintf' style:
-//  This is identical to FILE stream printing above.
-//
 
-void JSON_snprintInit(JSON_SNPRINT_CONF *c, char *buf, int len)
+int JSON_itoa(char *buf, int64_t i)
 {
-    if (c==NULL) return;
-    (*c).buf=buf;
-    (*c).len=len;
-    (*c).pos=0;
-    return;
+    if (i<0)
+    {
+        buf[0]='-';
+        return(1+JSON_utoa(buf+1, -(u_int64_t)i));
+    }
+    return(JSON_utoa(buf, (u_int64_t)i));
 }
 
-int JSON_snprint(int cmd, int r, int d, char *s, double n, void *user)
+
+int JSON_dtoa(char *buf, double n)
 {
-    JSON_SNPRINT_CONF *c=(JSON_SNPRINT_CONF*)user;
-    int rc=0;
-    
-    //  In these cases, a comma-separator is needed before the next value:
-    //  Except if the previous call was an object label.  In this case the rank
-    //  is r=0 as values following an OLBL are always ranked '0'.
-    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
+    JSON_DIYFP v, lo, hi, ten;
+    JSON_POW10 c;
+    u_int64_t bits, frac;
+    int e, k, len, p, t;
+    char *b=buf;
+    char w[24];
+
+    //  Rudimentary 'floor' method to see if the value is true 'int'
+    if (n>-9.2e18 && n<9.2e18 && (double)((int64_t)n)==n)
+        return(JSON_itoa(buf, (int64_t)n));
+
+    memcpy(&bits, &n, sizeof(bits));
+    e=(int)((bits>>52)&0x7FF);
+    frac=bits&((((u_int64_t)1)<<52)-1);
+    if (e==0x7FF)
     {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ",");
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
-    }   
+        //  Infinity and NaN have no JSON form:
+        memcpy(buf, "null", 5);
+        return(4);
+    }
+    if (bits>>63)
+        *b++='-';
 
-    //  All possible commands:
-    if (cmd&JSON_CMD_NEW_ARRAY)
+    //  The value and the boundaries halfway to its neighbours, the lower
+    //  one closer at a power of two:
+    if (e==0)
     {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "[");
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
+        v.f=frac;
+        v.e=1-1075;
     }
-    if (cmd&JSON_CMD_NEW_OBJ)
+    else
     {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "{");
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
+        v.f=frac|(((u_int64_t)1)<<52);
+        v.e=e-1075;
     }
-    if (cmd&JSON_CMD_VAL_OLBL)
+    hi.f=2*v.f+1;
+    hi.e=v.e-1;
+    if (frac==0 && e>1)
     {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "\"%s\":", s);
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
+        lo.f=4*v.f-1;
+        lo.e=v.e-2;
     }
-    if (cmd&JSON_CMD_VAL_NUM)
+    else
     {
-        //  Rudimentary 'floor' method to see if the value is true 'int'
-        if ((double)((long long int)n)==n)
-        {
-            rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "%lli", (long long int) n);
-            if (rc<0)
-                return(-1);
-            (*c).pos+=rc;
-        }
-        else
-        {
-            rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "%f", n);
-            if (rc<0)
-                return(-1);
-            (*c).pos+=rc;
-        }
+        lo.f=2*v.f-1;
+        lo.e=v.e-1;
     }
-    if (cmd&JSON_CMD_VAL_STR)
+    hi=JSON_diyNorm(hi);
+    lo.f<<=lo.e-hi.e;
+    lo.e=hi.e;
+    v=JSON_diyNorm(v);
+
+    //  The cached power that brings the exponent of 'hi' in [-60, -32]:
+    t=-61-hi.e;
+    k=(t*78913)/(1<<18)+(t>0);
+    c=JSON_pow10[(300+k+7)/8];
+    ten.f=c.f;
+    ten.e=c.e;
+    v=JSON_diyMul(v, ten);
+    lo=JSON_diyMul(lo, ten);
+    hi=JSON_diyMul(hi, ten);
+    lo.f+=1;
+    hi.f-=1;
+    k=-c.k;
+    len=JSON_grisuDigits(b, &k, lo, v, hi);
+
+        //
+        //  The boundaries are only known to within a unit either way, so
+        //  the digits above were made safely inside them, and may be more
+        //  than needed (1e23 comes out as 9.999999999999999e+22).  If the
+        //  boundaries just as far outside them take fewer digits, the
+        //  shortest form is the first of those lengths that reads back.
+        //
+    lo.f-=2;
+    if (hi.f+2>hi.f)
+        hi.f+=2;
+    t=-c.k;
+    p=JSON_grisuDigits(w, &t, lo, v, hi);
+    for (; p<len; p+=1)
     {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "\"%s\"", s);
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
+        double a=(n<0)?-n:n;
+        char x[40];
+        int i, m=0;
+        snprintf(x, sizeof(x), "%.*e", p-1, a);
+        if (strtod(x, NULL)!=a)
+            continue;
+        for (i=0; x[i]!='e'; i+=1)
+            if (x[i]>='0' && x[i]<='9')
+                b[m++]=x[i];
+        k=atoi(x+i+1)-(p-1);
+        len=p;
+        break;
     }
-    if (cmd&JSON_CMD_VAL_SYM)
+
+    //  The value is digits*10^k, the point goes after 'p' digits:
+    p=len+k;
+    if (k>=0 && p<=21)
     {
-        if ((int)n==JSON_SYM_TRUE)
+        //  Integral, but beyond 'long long':
+        memset(b+len, '0', k);
+        len=p;
+    }
+    else if (p>0 && p<=21)
+    {
+        memmove(b+p+1, b+p, len-p);
+        b[p]='.';
+        len+=1;
+    }
+    else if (p>-6 && p<=0)
+    {
+        memmove(b+2-p, b, len);
+        b[0]='0';
+        b[1]='.';
+        memset(b+2, '0', -p);
+        len+=2-p;
+    }
+    else
+    {
+        if (len>1)
         {
-            rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "true");
-            if (rc<0)
-                return(-1);
-            (*c).pos+=rc;
+            memmove(b+2, b+1, len-1);
+            b[1]='.';
+            len+=1;
         }
-        else if ((int)n==JSON_SYM_FALSE)
+        b[len++]='e';
+        p-=1;
+        if (p<0)
         {
-            rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "false");
-            if (rc<0)
-                return(-1);
-            (*c).pos+=rc;
+            b[len++]='-';
+            p=-p;
         }
         else
-        {
-            rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "null");
-            if (rc<0)
-                return(-1);
-            (*c).pos+=rc;
-        }
-    }
-    if (cmd&JSON_CMD_END_OBJ)
-    {    
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "}");
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
-    }
-    if (cmd&JSON_CMD_END_ARRAY)
-    {
-        rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "]");
-        if (rc<0)
-            return(-1);
-        (*c).pos+=rc;
+            b[len++]='+';
+        if (p>=100)
+            b[len++]='0'+(char)(p/100);
+        if (p>=10)
+            b[len++]='0'+(char)((p/10)%10);
+        b[len++]='0'+(char)(p%10);
     }
+    b[len]=0;
+    return((int)(b-buf)+len);
+}
 
-    return(0);
+
+//  (A raw number can be longer than JSON_NUM_LEN, the printers write the
+//  text themselves, here it is formatted from its value.)
+int JSON_numtoa(char *buf, int cmd, char *s, double n)
+{
+    if (cmd&JSON_CMD_VAL_INT)
+        return(JSON_itoa(buf, *(int64_t*)s));
+    if (cmd&JSON_CMD_VAL_UINT)
+        return(JSON_utoa(buf, *(u_int64_t*)s));
+    return(JSON_dtoa(buf, JSON_numValue(cmd, s, n)));
 }
 
 
+int JSON_nodetoa(char *buf, JSON_NODE *n)
+{
+    if ((*n).f&JSON_FLG_INT)
+        return(JSON_itoa(buf, (*n).value.i));
+    if ((*n).f&JSON_FLG_UINT)
+        return(JSON_utoa(buf, (*n).value.u));
+    return(JSON_dtoa(buf, JSON_nodeNum(n)));
+}
 
 
-//  
-//  Once again the same method, but now nicer formatting, with colors.
 //
-//  A note on console colors.  The sequeqnce is '%c[%i;%i;%im', with the
-//  special char being 0x1b.  The first value is the attribute, 2nd is
-//  foreground, 3rd is background.  Not all arguments are required.
-//  Attribs:
-//    0  reset        (call w/ '0x1b[0m' to 'reset')
-//    1  bright
-//    2  dim
-//    3  underline
-//    4  blink
-//  Colors (add 30 for foreground, 40 for background):
-//    0  black
-//    1  red
-//    2  green
-//    3  yellow
-//    4  blue
-//    5  magenta
-//    6  cyan
-//    7  white
+//  Decoding on demand:
 //
-
-//  Init:
-void JSON_prettyPrintInit(JSON_PRETTYPRINT_CONF *c, FILE *str)
+double JSON_numValue(int cmd, char *s, double n)
 {
-    if (c==NULL) return;
-    (*c).str=str;
-    (*c).prev=0;
-    (*c).color=1;
-    return;
+    if (cmd&JSON_CMD_VAL_RAW)
+        return(strtod(s, NULL));
+    return(n);
 }
 
-//  The itself callback:
-int JSON_prettyPrint(int cmd, int r, int d, char *s, double n, void *user)
+
+double JSON_nodeNum(JSON_NODE *n)
 {
-    int i;
-    JSON_PRETTYPRINT_CONF *c=(JSON_PRETTYPRINT_CONF*)user;
+    if ((*n).f&JSON_FLG_INT)
+        return((double)(*n).value.i);
+    if ((*n).f&JSON_FLG_UINT)
+        return((double)(*n).value.u);
+    if ((*n).f&JSON_FLG_RAW)
+        return(strtod((*n).value.string, NULL));
+    return((*n).value.num);
+}
 
-    //  In these cases, a comma-separator is needed before the next value:
-    //  Note that the OLBL exclusion for the comma is unnecessary as r==0 for
-    //  any value directly following an OLBL.
-    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM) && (*c).prev!=JSON_CMD_VAL_OLBL)
-            fprintf((*c).str, ",");
 
-    //  Avoid printing empty arrays and objects on multiple lines:
-    if (!(((*c).prev==JSON_CMD_NEW_ARRAY && cmd==JSON_CMD_END_ARRAY) ||
-        ((*c).prev==JSON_CMD_NEW_OBJ && cmd==JSON_CMD_END_OBJ)))
+int JSON_nodeInt(JSON_NODE *n, u_int64_t *i)
+{
+    if ((*n).f&JSON_FLG_INT)
     {
-        //  Don't do newline after an object lavel, or when this is the first command ever:
-        if ((*c).prev!=JSON_CMD_VAL_OLBL && (*c).prev!=0)
-            fprintf((*c).str, "\n");
-
-        //  Indent only if not directly following a label:
-        if ((*c).prev!=JSON_CMD_VAL_OLBL)
-            for (i=0; i<d; i+=1)
-                fprintf((*c).str, "  ");
+        (*i)=(u_int64_t)(*n).value.i;
+        return(JSON_CMD_VAL_INT);
+    }
+    if ((*n).f&JSON_FLG_UINT)
+    {
+        (*i)=(*n).value.u;
+        return(JSON_CMD_VAL_UINT);
     }
+    if ((*n).f&JSON_FLG_RAW)
+        return(JSON_atoi((*n).value.string, i));
+    return(0);
+}
 
-    //  Debug, depth and rank:
-    //fprintf((*c).str, "%c[1;%im(%i,%i)%c[0m", 0x1b, 31, d, r, 0x1b);
 
-    //  All possible commands:
-    if (cmd&JSON_CMD_NEW_ARRAY)
+
+//
+//  Strings:  plain text is escaped on the way out.  The scan looks for the
+//  characters that need it, '"', '\' and anything below ' ', and the clean
+//  runs between them are copied in bulk.  With SSE2 (every x86-64) this
+//  takes 32 bytes per step: a control character is one that min(x, 0x1f)
+//  leaves as it is.  Elsewhere a word of 8 bytes is tested at a time, with
+//  the usual "has a byte less than, or equal to" bit tricks.  With 'high'
+//  set the bytes from 0x80 up end the run too, for the string decoder.
+//
+#define JSON_ESC_ONES  0x0101010101010101ULL
+#define JSON_ESC_HIGH  0x8080808080808080ULL
+#define JSON_ESC_ZERO(x) (((x)-JSON_ESC_ONES)&~(x)&JSON_ESC_HIGH)
+#define JSON_ESC_WORD(x) (JSON_ESC_ZERO((x)^(JSON_ESC_ONES*'"')) | JSON_ESC_ZERO((x)^(JSON_ESC_ONES*'\\')) | (((x)-JSON_ESC_ONES*0x20)&~(x)&JSON_ESC_HIGH))
+#define JSON_ESC_CHAR(c) ((unsigned char)(c)<0x20 || (c)=='"' || (c)=='\\')
+
+int64_t JSON_span(const char *s, int64_t len, int high)
+{
+    int64_t i=0;
+#ifdef __SSE2__
+    const __m128i q=_mm_set1_epi8('"');
+    const __m128i b=_mm_set1_epi8('\\');
+    const __m128i c=_mm_set1_epi8(0x1f);
+
+    while (i+32<=len)
     {
-        fprintf((*c).str, "[");
+        __m128i x=_mm_loadu_si128((const __m128i*)(s+i));
+        __m128i y=_mm_loadu_si128((const __m128i*)(s+i+16));
+        __m128i ex=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, q), _mm_cmpeq_epi8(x, b)), _mm_cmpeq_epi8(_mm_min_epu8(x, c), x));
+        __m128i ey=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(y, q), _mm_cmpeq_epi8(y, b)), _mm_cmpeq_epi8(_mm_min_epu8(y, c), y));
+        u_int32_t m=(u_int32_t)_mm_movemask_epi8(ex)|((u_int32_t)_mm_movemask_epi8(ey)<<16);
+
+        if (high)
+            m|=(u_int32_t)_mm_movemask_epi8(x)|((u_int32_t)_mm_movemask_epi8(y)<<16);
+        if (m)
+            return(i+__builtin_ctz(m));
+        i+=32;
     }
-    if (cmd&JSON_CMD_NEW_OBJ)
+#else
+    while (i+8<=len)
     {
-        fprintf((*c).str, "{");
+        u_int64_t x;
+        memcpy(&x, s+i, 8);
+        if (JSON_ESC_WORD(x) || (high && (x&JSON_ESC_HIGH)))
+            break;
+        i+=8;
     }
-    if (cmd&JSON_CMD_VAL_OLBL)
+#endif
+    //  The tail, or the word with the hit:
+    while (i<len && !JSON_ESC_CHAR(s[i]) && !(high && (unsigned char)s[i]>=0x80))
+        i+=1;
+    return(i);
+}
+
+
+int64_t JSON_escSpan(const char *s, int64_t len)
+{
+    return(JSON_span(s, len, 0));
+}
+
+
+int JSON_escChar(char *buf, int c)
+{
+    const char *hex="0123456789abcdef";
+
+    buf[0]='\\';
+    switch (c)
     {
-        if ((*c).color)
-            fprintf((*c).str, "\"%c[1;%im%s%c[0m\": ", 0x1b, 36, s, 0x1b);
-        else
-            fprintf((*c).str, "\"%s\": ", s);
+        case '"':  buf[1]='"';  return(2);
+        case '\\': buf[1]='\\'; return(2);
+        case '\b': buf[1]='b';  return(2);
+        case '\f': buf[1]='f';  return(2);
+        case '\n': buf[1]='n';  return(2);
+        case '\r': buf[1]='r';  return(2);
+        case '\t': buf[1]='t';  return(2);
     }
-    if (cmd&JSON_CMD_VAL_NUM)
+    buf[1]='u';
+    buf[2]='0';
+    buf[3]='0';
+    buf[4]=hex[(c>>4)&0xF];
+    buf[5]=hex[c&0xF];
+    return(6);
+}
+
+
+int64_t JSON_escLen(const char *s, int64_t len)
+{
+    int64_t n=len;
+    int64_t k;
+    char b[6];
+
+    while ((k=JSON_escSpan(s, len))<len)
     {
-        if ((double)((long long int)n)==n)
-            fprintf((*c).str, "%lli", (long long int) n);
-        else
-            fprintf((*c).str, "%f", n);
+        n+=JSON_escChar(b, (unsigned char)s[k])-1;
+        s+=k+1;
+        len-=k+1;
     }
-    if (cmd&JSON_CMD_VAL_STR)
+    return(n);
+}
+
+
+int64_t JSON_escCopy(char *buf, const char *s, int64_t len)
+{
+    int64_t n=0;
+    int64_t k;
+
+    while ((k=JSON_escSpan(s, len))<len)
     {
-        if ((*c).color)
-            fprintf((*c).str, "\"%c[1;%im%s%c[0m\"", 0x1b, 32, s, 0x1b);
-        else
-            fprintf((*c).str, "\"%s\"", s);
+        memcpy(buf+n, s, k);
+        n+=k;
+        n+=JSON_escChar(buf+n, (unsigned char)s[k]);
+        s+=k+1;
+        len-=k+1;
     }
-    if (cmd&JSON_CMD_VAL_SYM)
-    {
-        //  Set a color:
-        if ((*c).color)
-            fprintf((*c).str, "%c[1;%im", 0x1b, 33);
-
-        if ((int)n==JSON_SYM_TRUE)
-            fprintf((*c).str, "true");
-        else if ((int)n==JSON_SYM_FALSE)
-            fprintf((*c).str, "false");
-        else
-            fprintf((*c).str, "null");
-
-        //  Reset
-        if ((*c).color)
-            fprintf((*c).str, "%c[0m", 0x1b);
-    }
-    if (cmd&JSON_CMD_END_OBJ)
-    {    
-        fprintf((*c).str, "}");
-    }
-    if (cmd&JSON_CMD_END_ARRAY)
-    {
-        fprintf((*c).str, "]");
-    }
-
-    (*c).prev=cmd;
-    return(0);
+    memcpy(buf+n, s, len);
+    return(n+len);
 }
 
 
 
-
-/************************************************************************
- *                                                                      *
- *    Stateless parsing                                                 *
- *                                                                      *
- ************************************************************************/
-
-
-
 //
-//  Parsing from a memory buffer can be done with 'fmemopen' but this
-//  method is not supported on Windows.  This code works for either:
+//  The output sink.  A sink on a buffer of the caller is flushed by the
+//  caller, and never grows.
 //
-typedef struct
+void JSON_outInit(JSON_OUT *o, FILE *str, int fd, char *buf, int64_t cap)
 {
-    //  If the input is a stream:
-    FILE *str;
-    
-    //  If the input is in memory:
-    char *buf;
-    int len;
-    int pos;
+    memset(o, 0, sizeof(JSON_OUT));
+    (*o).str=str;
+    (*o).fd=fd;
+    (*o).buf=buf;
+    (*o).cap=cap;
+    return;
 }
-JSON_DATA;
 
 
-int JSON_fgetc(JSON_DATA *d)
+int JSON_outAlloc(JSON_OUT *o)
 {
-    int rc=EOF;
-    if ((*d).str) return(fgetc((*d).str));
-    if ((*d).pos<(*d).len) rc=(*d).buf[(*d).pos];
-    (*d).pos+=1;
-    return(rc);
+    (*o).buf=(char*)malloc(JSON_OUT_BUF);
+    if ((*o).buf==NULL)
+    {
+        (*o).err=JSON_ERR_MEM;
+        return(JSON_ERR_MEM);
+    }
+    (*o).cap=JSON_OUT_BUF;
+    (*o).own=1;
+    return(0);
 }
 
-int JSON_ungetc(int c, JSON_DATA *d)
+
+int JSON_outFile(JSON_OUT *o, FILE *str)
 {
-    if ((*d).str) return(ungetc(c, (*d).str));
-    if ((*d).pos>0)
-        (*d).pos-=1;
-    else
-        return(EOF);
-    return(c);
+    JSON_outInit(o, str, -1, NULL, 0);
+    return(JSON_outAlloc(o));
 }
 
 
-
-//  
-//  Method prototypes for parsing:
-//
-int JSON_ws    (JSON_DATA *d);
-int JSON_num   (JSON_DATA *d, double *num);
-int JSON_string(JSON_DATA *d, char *s, int l);
-int JSON_symbol(JSON_DATA *d, int *sym);
-int JSON_value (JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
-int JSON_array (JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
-int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
-
-
-
+int JSON_outFd(JSON_OUT *o, int fd)
+{
+    JSON_outInit(o, NULL, fd, NULL, 0);
+    return(JSON_outAlloc(o));
+}
 
 
-//  Returns number of characters of whitespace consumed:
-int JSON_ws(JSON_DATA *d)
+int JSON_outMem(JSON_OUT *o)
 {
-    int c;
-    int n=0;
-    do
-    {
-        c=JSON_fgetc(d);
-        n+=1;
-    }
-    while (c!=EOF && (c==0x20 || c==0x0a || c==0x0d || c==0x09));
-    if (c!=EOF)
-        JSON_ungetc(c, d);
-    n-=1;
-    return(n);
+    JSON_outInit(o, NULL, -1, NULL, 0);
+    (*o).grow=1;
+    return(JSON_outAlloc(o));
 }
 
-//  Returns number of chars read if a number was found (ie. >0)
-int JSON_num(JSON_DATA *d, double *num)
+
+int JSON_outFlush(JSON_OUT *o)
 {
-    int c;
-    int n=0;
-    char ns[JSON_MAX_LEN];
+    int64_t done=0;
+    if ((*o).grow || (*o).err)
+        return((*o).err);
 
-    //  Leading '-'
-    c=JSON_fgetc(d);
-    if (!(c=='-' || (c>='0' && c<='9')))
+    if ((*o).str)
     {
-        //  It was not a number
-        if (c!=EOF)
-            JSON_ungetc(c, d);
-        return(n);
+        if (fwrite((*o).buf, 1, (*o).len, (*o).str)!=(size_t)(*o).len)
+            (*o).err=-1;
     }
-
-    //  Stuff before the dot:
-    do
+    else if ((*o).fd>=0)
     {
-        ns[n]=(char)c;
-        n+=1;
-        c=JSON_fgetc(d);
+        while (done<(*o).len)
+        {
+            int64_t n=write((*o).fd, (*o).buf+done, (*o).len-done);
+            if (n<0 && errno==EINTR)
+                continue;
+            if (n<=0)
+            {
+                (*o).err=-1;
+                break;
+            }
+            done+=n;
+        }
     }
-    while (c!=EOF && c>='0' && c<='9' && n<JSON_MAX_LEN);
+    (*o).len=0;
+    return((*o).err);
+}
 
-    //  Did we get a dot?
-    if (c=='.')
+
+void JSON_outWrite(JSON_OUT *o, const char *s, int64_t len)
+{
+    if ((*o).err)
+        return;
+    if ((*o).len+len>(*o).cap)
     {
-        //  After the comma:
-        do
+        if ((*o).grow)
         {
-            ns[n]=(char)c;
-            n+=1;
-            c=JSON_fgetc(d);
+            int64_t cap=(*o).cap;
+            char *buf;
+            while (cap<(*o).len+len)
+                cap*=2;
+            buf=(char*)realloc((*o).buf, cap);
+            if (buf==NULL)
+            {
+                (*o).err=JSON_ERR_MEM;
+                return;
+            }
+            (*o).buf=buf;
+            (*o).cap=cap;
         }
-        while (c>='0' && c<='9' && n<JSON_MAX_LEN);
-    }
-    
-    //  Did we get an exponent?
-    if ((c=='e' || c=='E') && n<JSON_MAX_LEN)
-    {
-        //  Store the 'e'
-        ns[n]=(char)c;
-        n+=1;
-
-        //  Leading '+', or '-' is optional:
-        c=JSON_fgetc(d);
-        if ((c=='-' || c=='+' || (c>='0' && c<='9')) && n<JSON_MAX_LEN)
+        else
         {
-            //  After the exponent:
-            do
+            JSON_outFlush(o);
+            if (len>(*o).cap)
             {
-                ns[n]=(char)c;
-                n+=1;
-                c=JSON_fgetc(d);
+                //  Too big for the buffer, it goes straight out:
+                JSON_OUT t=(*o);
+                t.buf=(char*)s;
+                t.len=len;
+                (*o).err=JSON_outFlush(&t);
+                return;
             }
-            while (c>='0' && c<='9' && n<JSON_MAX_LEN);
         }
     }
+    memcpy((*o).buf+(*o).len, s, len);
+    (*o).len+=len;
+    return;
+}
 
-    //  Make sure that we didn't run out of array space:
-    if (n==JSON_MAX_LEN)
-        return(JSON_ERR_LEN);
-
-    //  Store the number
-    ns[n]='\0';
-    (*num)=strtod(ns, NULL);
-
-    //  And done!
-    if (c!=EOF)
-        JSON_ungetc(c, d);
 
-    return(n);
+void JSON_outStr(JSON_OUT *o, const char *s)
+{
+    JSON_outWrite(o, s, strlen(s));
+    return;
 }
 
 
-
-//  String.
-//  Copies the string (minus the '""') preserving the control characters
-//  Returns the number of characters actually copied, null-terminates 's'.
-int JSON_string(JSON_DATA *d, char *s, int l)
+//  Plain text, escaped:
+void JSON_outEsc(JSON_OUT *o, const char *s)
 {
-    int c;
-    int n=0;
-    char p;
+    int64_t len=strlen(s);
+    int64_t k;
+    char b[6];
 
-    //  Strings start and end with '"'
-    c=JSON_fgetc(d);
-    if (!(c=='"' || c==EOF))
+    while ((k=JSON_escSpan(s, len))<len)
     {
-        //  It was not a string
-        JSON_ungetc(c, d);
-        return(n);
+        JSON_outWrite(o, s, k);
+        JSON_outWrite(o, b, JSON_escChar(b, (unsigned char)s[k]));
+        s+=k+1;
+        len-=k+1;
     }
+    JSON_outWrite(o, s, len);
+    return;
+}
 
-    //  The quotes are not stored.  Read the next
-    //  character on the the string.  Note, it is
-    //  fine if this is EOF.
-    do
-    {
-        //  Skips the initial '"'
-        //  Should this store the '\' for escape sequences?
-        if (n>0)
-            s[n-1]=(char)c;
-        n+=1;
-        p=c;
-        c=JSON_fgetc(d);
-    }
-    while ( !(c==EOF || (c=='"' && p!='\\')) && n<l);
 
-    //  Make sure that we didn't run out of array space:
-    if (n==l)
-        return(JSON_ERR_LEN);
+//  A string as the callbacks get it:
+void JSON_outString(JSON_OUT *o, int cmd, const char *s)
+{
+    if (cmd&JSON_CMD_VAL_TXT)
+        JSON_outEsc(o, s);
+    else
+        JSON_outWrite(o, s, strlen(s));
+    return;
+}
 
-    //  Was the string terminated?
-    if (c!='\"')
-        return(JSON_ERR_END_S);
 
-    //  Null terminate (character 'n' was not stored):
-    s[n-1]='\0';
+void JSON_outNum(JSON_OUT *o, double n)
+{
+    if ((*o).cap-(*o).len>=JSON_NUM_LEN)
+        (*o).len+=JSON_dtoa((*o).buf+(*o).len, n);
+    else
+    {
+        char b[JSON_NUM_LEN];
+        JSON_outWrite(o, b, JSON_dtoa(b, n));
+    }
+    return;
+}
 
-    //  Note, since the last character was '"' we do not need to 'ungetc'
-    n+=1;
 
-    return(n);
+//  A number as the callbacks get it:
+void JSON_outNumber(JSON_OUT *o, int cmd, char *s, double n)
+{
+    if (cmd&JSON_CMD_VAL_RAW)
+        JSON_outStr(o, s);
+    else if ((*o).cap-(*o).len>=JSON_NUM_LEN)
+        (*o).len+=JSON_numtoa((*o).buf+(*o).len, cmd, s, n);
+    else
+    {
+        char b[JSON_NUM_LEN];
+        JSON_outWrite(o, b, JSON_numtoa(b, cmd, s, n));
+    }
+    return;
 }
 
 
-//  Returns the number of characters read, 0 if
-//  no symbol was found, or an error code (<0)
-//  If a symbol (rc>0) was found 'sym' is set
-//  NOTE:  technically true/false are lower-case only!
-int JSON_symbol(JSON_DATA *d, int *sym)
+void JSON_outFree(JSON_OUT *o)
 {
-    int c;
-    int n=0;
+    JSON_outFlush(o);
+    if ((*o).own)
+        free((*o).buf);
+    (*o).buf=NULL;
+    (*o).len=0;
+    (*o).cap=0;
+    (*o).own=0;
+    return;
+}
 
-        //  Since 'ungetc' only works on a single
-        //  character, these symbols are read and
-        //  compared 1 by 1.
-    c=JSON_fgetc(d);
-    if (c=='t' || c=='T')
-    {
-        int r=JSON_fgetc(d);
-        int u=JSON_fgetc(d);
-        int e=JSON_fgetc(d);
-        n=4;
 
-        if (!((r=='r' || r=='R') && (u=='u' || u=='U') && (e=='e' || e=='E')))
-            return(JSON_ERR_SYM);
 
-        (*sym)=JSON_SYM_TRUE;
+//
+//  What 'JSON_print' prints, to a sink:
+//
+void JSON_printTo(JSON_OUT *o, int cmd, int r, char *s, double n)
+{
+    //  In these cases, a comma-separator is needed before the next value:
+    //  Except if the previous call was an object label.  In this case the rank
+    //  is r=0 as values following an OLBL are always ranked '0'.
+    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
+        JSON_OUTC(o, ',');
+
+    //  All possible commands:
+    if (cmd&JSON_CMD_NEW_ARRAY)
+        JSON_OUTC(o, '[');
+    if (cmd&JSON_CMD_NEW_OBJ)
+        JSON_OUTC(o, '{');
+    if (cmd&JSON_CMD_VAL_OLBL)
+    {
+        JSON_OUTC(o, '"');
+        JSON_outString(o, cmd, s);
+        JSON_outWrite(o, "\":", 2);
     }
-    else if (c=='f' || c=='F')
+    if (cmd&JSON_CMD_VAL_NUM)
+        JSON_outNumber(o, cmd, s, n);
+    if (cmd&JSON_CMD_VAL_STR)
     {
-        int a=JSON_fgetc(d);
-        int l=JSON_fgetc(d);
-        int s=JSON_fgetc(d);
-        int e=JSON_fgetc(d);
-        n=5;
-
-        if (!((a=='a' || a=='A') && (l=='l' || l=='L') && (s=='s' || s=='S') && (e=='e' || e=='E')))
-            return(JSON_ERR_SYM);
-
-        (*sym)=JSON_SYM_FALSE;
+        JSON_OUTC(o, '"');
+        JSON_outString(o, cmd, s);
+        JSON_OUTC(o, '"');
     }
-    else if (c=='n' || c=='U')
+    if (cmd&JSON_CMD_VAL_SYM)
     {
-        int u=JSON_fgetc(d);
-        int l=JSON_fgetc(d);
-        int L=JSON_fgetc(d);
-        n=4;
-
-        if (!((u=='u' || u=='U') && (l=='l' || l=='L') && (L=='l' || L=='L')))
-            return(JSON_ERR_SYM);
-
-        (*sym)=JSON_SYM_NULL;
+        if ((int)n==JSON_SYM_TRUE)
+            JSON_outWrite(o, "true", 4);
+        else if ((int)n==JSON_SYM_FALSE)
+            JSON_outWrite(o, "false", 5);
+        else
+            JSON_outWrite(o, "null", 4);
     }
-    else if (c!=EOF)
-        JSON_ungetc(c, d);
-
-    return(n);
+    if (cmd&JSON_CMD_END_OBJ)
+        JSON_OUTC(o, '}');
+    if (cmd&JSON_CMD_END_ARRAY)
+        JSON_OUTC(o, ']');
+    return;
+}
+
+
+//
+//  The example callback, plus printing method.
+//
+//  'cmd':   one of JSON_CMD
+//  'r':     the rank of the item in a list or object (ie. r>0 means a comma is printed first)
+//  'd':     the nesting depth, for pretty-print indentation
+//  's':     a string (might be an object label, or a string value)
+//  'n':     double number OR one of JSON_SYM_* (when cmd==JSON_CMD_VAL_SYM)
+//  'user':  the user pointer given in JSON_parse, set to the stream or file to be printed to.
+//
+//  Return code:  0 contines parsing <>0 stops parsing
+int JSON_print(int cmd, int r, int d, char *s, double n, void *user)
+{
+    char buf[512];
+    JSON_OUT o;
+
+    //  One write per call, instead of one per token:
+    JSON_outInit(&o, (FILE*)user, -1, buf, sizeof(buf));
+    JSON_printTo(&o, cmd, r, s, n);
+    JSON_outFlush(&o);
+    return(0);
+}
+
+
+//  The same for a batch of events from a tape:
+int JSON_printBatch(JSON_EVENT *e, int cnt, void *user)
+{
+    char buf[4096];
+    JSON_OUT o;
+
+    JSON_outInit(&o, (FILE*)user, -1, buf, sizeof(buf));
+    JSON_printOutBatch(e, cnt, &o);
+    JSON_outFlush(&o);
+    return(0);
+}
+
+
+int JSON_printOut(int cmd, int r, int d, char *s, double n, void *user)
+{
+    JSON_printTo((JSON_OUT*)user, cmd, r, s, n);
+    return(0);
+}
+
+
+int JSON_printOutBatch(JSON_EVENT *e, int cnt, void *user)
+{
+    int i;
+    for (i=0; i<cnt; i+=1)
+    {
+        JSON_printTo((JSON_OUT*)user, e[i].cmd, e[i].r, JSON_EVENT_S(e[i]), JSON_EVENT_N(e[i]));
+    }
+    return(0);
+}
+
+
+
+//
+//  Method for printing compactly to a memory buffer 'snprintf' style:
+//  This is identical to FILE stream printing above.
+//
+
+void JSON_snprintInit(JSON_SNPRINT_CONF *c, char *buf, int len)
+{
+    if (c==NULL) return;
+    (*c).buf=buf;
+    (*c).len=len;
+    (*c).pos=0;
+    return;
+}
+
+//  Appends as much as fits, but counts it all:
+void JSON_snprintWrite(JSON_SNPRINT_CONF *c, const char *s, int len)
+{
+    if ((*c).pos<(*c).len)
+    {
+        int m=(*c).len-1-(*c).pos;
+        if (m>len)
+            m=len;
+        memcpy((*c).buf+(*c).pos, s, m);
+        (*c).buf[(*c).pos+m]=0;
+    }
+    (*c).pos+=len;
+    return;
+}
+
+
+//  A string, escaped if it is plain text:
+void JSON_snprintString(JSON_SNPRINT_CONF *c, int cmd, const char *s)
+{
+    int len=strlen(s);
+    int k;
+    char b[6];
+
+    if (cmd&JSON_CMD_VAL_TXT)
+        while ((k=JSON_escSpan(s, len))<len)
+        {
+            JSON_snprintWrite(c, s, k);
+            JSON_snprintWrite(c, b, JSON_escChar(b, (unsigned char)s[k]));
+            s+=k+1;
+            len-=k+1;
+        }
+    JSON_snprintWrite(c, s, len);
+    return;
+}
+
+
+int JSON_snprint(int cmd, int r, int d, char *s, double n, void *user)
+{
+    JSON_SNPRINT_CONF *c=(JSON_SNPRINT_CONF*)user;
+
+    //  In these cases, a comma-separator is needed before the next value:
+    //  Except if the previous call was an object label.  In this case the rank
+    //  is r=0 as values following an OLBL are always ranked '0'.
+    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
+        JSON_snprintWrite(c, ",", 1);
+
+    //  All possible commands:
+    if (cmd&JSON_CMD_NEW_ARRAY)
+        JSON_snprintWrite(c, "[", 1);
+    if (cmd&JSON_CMD_NEW_OBJ)
+        JSON_snprintWrite(c, "{", 1);
+    if (cmd&JSON_CMD_VAL_OLBL)
+    {
+        JSON_snprintWrite(c, "\"", 1);
+        JSON_snprintString(c, cmd, s);
+        JSON_snprintWrite(c, "\":", 2);
+    }
+    if (cmd&JSON_CMD_VAL_NUM)
+    {
+        char b[JSON_NUM_LEN];
+        if (cmd&JSON_CMD_VAL_RAW)
+            JSON_snprintWrite(c, s, strlen(s));
+        else
+            JSON_snprintWrite(c, b, JSON_numtoa(b, cmd, s, n));
+    }
+    if (cmd&JSON_CMD_VAL_STR)
+    {
+        JSON_snprintWrite(c, "\"", 1);
+        JSON_snprintString(c, cmd, s);
+        JSON_snprintWrite(c, "\"", 1);
+    }
+    if (cmd&JSON_CMD_VAL_SYM)
+    {
+        if ((int)n==JSON_SYM_TRUE)
+            JSON_snprintWrite(c, "true", 4);
+        else if ((int)n==JSON_SYM_FALSE)
+            JSON_snprintWrite(c, "false", 5);
+        else
+            JSON_snprintWrite(c, "null", 4);
+    }
+    if (cmd&JSON_CMD_END_OBJ)
+        JSON_snprintWrite(c, "}", 1);
+    if (cmd&JSON_CMD_END_ARRAY)
+        JSON_snprintWrite(c, "]", 1);
+    return(0);
+}
+
+
+//
+//  The size of the same, without printing:
+//
+int JSON_printSize(int cmd, int r, int d, char *s, double n, void *user)
+{
+    int64_t *size=(int64_t*)user;
+
+    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
+        (*size)+=1;
+    if (cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_END_OBJ|JSON_CMD_END_ARRAY))
+        (*size)+=1;
+    if (cmd&JSON_CMD_VAL_OLBL)
+        (*size)+=((cmd&JSON_CMD_VAL_TXT)?JSON_escLen(s, strlen(s)):(int64_t)strlen(s))+3;
+    if (cmd&JSON_CMD_VAL_NUM)
+    {
+        char b[JSON_NUM_LEN];
+        if (cmd&JSON_CMD_VAL_RAW)
+            (*size)+=strlen(s);
+        else
+            (*size)+=JSON_numtoa(b, cmd, s, n);
+    }
+    if (cmd&JSON_CMD_VAL_STR)
+        (*size)+=((cmd&JSON_CMD_VAL_TXT)?JSON_escLen(s, strlen(s)):(int64_t)strlen(s))+2;
+    if (cmd&JSON_CMD_VAL_SYM)
+        (*size)+=((int)n==JSON_SYM_FALSE)?5:4;
+    return(0);
+}
+
+
+
+
+//  
+//  Once again the same method, but now nicer formatting, with colors.
+//
+//  A note on console colors.  The sequeqnce is '%c[%i;%i;%im', with the
+//  special char being 0x1b.  The first value is the attribute, 2nd is
+//  foreground, 3rd is background.  Not all arguments are required.
+//  Attribs:
+//    0  reset        (call w/ '0x1b[0m' to 'reset')
+//    1  bright
+//    2  dim
+//    3  underline
+//    4  blink
+//  Colors (add 30 for foreground, 40 for background):
+//    0  black
+//    1  red
+//    2  green
+//    3  yellow
+//    4  blue
+//    5  magenta
+//    6  cyan
+//    7  white
+//
+
+//  Init:
+void JSON_prettyPrintInit(JSON_PRETTYPRINT_CONF *c, FILE *str)
+{
+    if (c==NULL) return;
+    (*c).str=str;
+    (*c).prev=0;
+    (*c).color=1;
+    (*c).out=NULL;
+    return;
+}
+
+void JSON_prettyPrintInitOut(JSON_PRETTYPRINT_CONF *c, JSON_OUT *out)
+{
+    JSON_prettyPrintInit(c, NULL);
+    if (c) (*c).out=out;
+    return;
+}
+
+//  What it prints, to a sink:
+void JSON_prettyPrintTo(JSON_OUT *o, JSON_PRETTYPRINT_CONF *c, int cmd, int r, int d, char *s, double n)
+{
+    int i;
+
+    //  In these cases, a comma-separator is needed before the next value:
+    //  Note that the OLBL exclusion for the comma is unnecessary as r==0 for
+    //  any value directly following an OLBL.
+    if (r>0 && cmd&(JSON_CMD_NEW_ARRAY|JSON_CMD_NEW_OBJ|JSON_CMD_VAL_OLBL|JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM) && (*c).prev!=JSON_CMD_VAL_OLBL)
+            JSON_OUTC(o, ',');
+
+    //  Avoid printing empty arrays and objects on multiple lines:
+    if (!(((*c).prev==JSON_CMD_NEW_ARRAY && cmd==JSON_CMD_END_ARRAY) ||
+        ((*c).prev==JSON_CMD_NEW_OBJ && cmd==JSON_CMD_END_OBJ)))
+    {
+        //  Don't do newline after an object lavel, or when this is the first command ever:
+        if ((*c).prev!=JSON_CMD_VAL_OLBL && (*c).prev!=0)
+            JSON_OUTC(o, '\n');
+
+        //  Indent only if not directly following a label:
+        if ((*c).prev!=JSON_CMD_VAL_OLBL)
+            for (i=0; i<d; i+=1)
+                JSON_outWrite(o, "  ", 2);
+    }
+
+    //  All possible commands:
+    if (cmd&JSON_CMD_NEW_ARRAY)
+        JSON_OUTC(o, '[');
+    if (cmd&JSON_CMD_NEW_OBJ)
+        JSON_OUTC(o, '{');
+    if (cmd&JSON_CMD_VAL_OLBL)
+    {
+        if ((*c).color)
+        {
+            JSON_outStr(o, "\"\x1b[1;36m");
+            JSON_outString(o, cmd, s);
+            JSON_outStr(o, "\x1b[0m\": ");
+        }
+        else
+        {
+            JSON_OUTC(o, '"');
+            JSON_outString(o, cmd, s);
+            JSON_outStr(o, "\": ");
+        }
+    }
+    if (cmd&JSON_CMD_VAL_NUM)
+        JSON_outNumber(o, cmd, s, n);
+    if (cmd&JSON_CMD_VAL_STR)
+    {
+        if ((*c).color)
+        {
+            JSON_outStr(o, "\"\x1b[1;32m");
+            JSON_outString(o, cmd, s);
+            JSON_outStr(o, "\x1b[0m\"");
+        }
+        else
+        {
+            JSON_OUTC(o, '"');
+            JSON_outString(o, cmd, s);
+            JSON_OUTC(o, '"');
+        }
+    }
+    if (cmd&JSON_CMD_VAL_SYM)
+    {
+        //  Set a color:
+        if ((*c).color)
+            JSON_outStr(o, "\x1b[1;33m");
+
+        if ((int)n==JSON_SYM_TRUE)
+            JSON_outWrite(o, "true", 4);
+        else if ((int)n==JSON_SYM_FALSE)
+            JSON_outWrite(o, "false", 5);
+        else
+            JSON_outWrite(o, "null", 4);
+
+        //  Reset
+        if ((*c).color)
+            JSON_outStr(o, "\x1b[0m");
+    }
+    if (cmd&JSON_CMD_END_OBJ)
+        JSON_OUTC(o, '}');
+    if (cmd&JSON_CMD_END_ARRAY)
+        JSON_OUTC(o, ']');
+
+    (*c).prev=cmd&0xFF;
+    return;
+}
+
+//  The itself callback:
+int JSON_prettyPrint(int cmd, int r, int d, char *s, double n, void *user)
+{
+    JSON_PRETTYPRINT_CONF *c=(JSON_PRETTYPRINT_CONF*)user;
+    char buf[512];
+    JSON_OUT o;
+
+    if ((*c).out)
+    {
+        JSON_prettyPrintTo((*c).out, c, cmd, r, d, s, n);
+        return(0);
+    }
+
+    //  One write per call on the stream:
+    JSON_outInit(&o, (*c).str, -1, buf, sizeof(buf));
+    JSON_prettyPrintTo(&o, c, cmd, r, d, s, n);
+    JSON_outFlush(&o);
+    return(0);
+}
+
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Compressed input                                                  *
+ *                                                                      *
+ ************************************************************************/
+
+
+
+#define JSON_ZIP_NONE   0
+#define JSON_ZIP_GZ     1
+#define JSON_ZIP_ZSTD   2
+
+#define JSON_ZIP_IN     (1<<18)     //  Compressed bytes read at a time
+#define JSON_ZIP_OUT    (1<<18)     //  Bytes per block, when threaded
+#define JSON_ZIP_BLOCKS 4
+
+typedef struct
+{
+    char *buf;
+    int len;                //  0 at the end, or JSON_ERR_ZIP
+}
+JSON_ZIP_BLOCK;
+
+typedef struct
+{
+    FILE *str;
+    int kind;
+    char *in;
+    int inLen;
+    int inPos;
+    int eof;                //  Nothing more to read
+    int done;               //  The last member or frame is complete
+    int end;                //  The parser got to the end
+    int err;
+#ifdef JSON_ZLIB
+    z_stream gz;
+#endif
+#ifdef JSON_ZSTD
+    ZSTD_DStream *zs;
+#endif
+
+    //  When threaded, decompressed blocks go round through two rings,
+    //  and whoever finds its ring empty sleeps on 'wake':
+    int threaded;
+    pthread_t th;
+    int64_t stop;
+    BEDROCK_SPSC full;
+    BEDROCK_SPSC empty;
+    pthread_mutex_t m;
+    pthread_cond_t wake;
+    JSON_ZIP_BLOCK block[JSON_ZIP_BLOCKS];
+    JSON_ZIP_BLOCK *cur;    //  The one the parser has
+}
+JSON_ZIP;
+
+
+
+//
+//  Decompresses up to 'cap' bytes into 'out', and returns how many, 0
+//  at the end, or JSON_ERR_ZIP.  Concatenated gzip members and zstd
+//  frames are read one after the other.
+//
+int JSON_zipInflate(JSON_ZIP *z, char *out, int cap)
+{
+    int n=0;
+    while (n<cap)
+    {
+        int before=n;
+        if ((*z).inPos==(*z).inLen && !(*z).eof)
+        {
+            (*z).inLen=fread((*z).in, 1, JSON_ZIP_IN, (*z).str);
+            (*z).inPos=0;
+            if ((*z).inLen<=0)
+            {
+                (*z).inLen=0;
+                (*z).eof=1;
+            }
+        }
+
+        if ((*z).kind==JSON_ZIP_NONE)
+        {
+            int c=(*z).inLen-(*z).inPos;
+            if (c==0)
+                break;
+            if (c>cap-n)
+                c=cap-n;
+            memcpy(out+n, (*z).in+(*z).inPos, c);
+            (*z).inPos+=c;
+            n+=c;
+            continue;
+        }
+#ifdef JSON_ZLIB
+        if ((*z).kind==JSON_ZIP_GZ)
+        {
+            int rc;
+            (*z).gz.next_in=(Bytef*)(*z).in+(*z).inPos;
+            (*z).gz.avail_in=(*z).inLen-(*z).inPos;
+            (*z).gz.next_out=(Bytef*)out+n;
+            (*z).gz.avail_out=cap-n;
+            rc=inflate(&(*z).gz, Z_NO_FLUSH);
+            (*z).inPos=(*z).inLen-(*z).gz.avail_in;
+            n=cap-(*z).gz.avail_out;
+            if (rc==Z_STREAM_END)
+            {
+                //  Another member may follow:
+                (*z).done=1;
+                inflateReset(&(*z).gz);
+            }
+            else if (rc==Z_OK)
+                (*z).done=0;
+            else if (rc!=Z_BUF_ERROR)
+            {
+                //  Trailing junk after a complete member is ignored, like gzip does:
+                if (!(*z).done)
+                    return(JSON_ERR_ZIP);
+                (*z).inPos=(*z).inLen;
+                (*z).eof=1;
+            }
+        }
+#endif
+#ifdef JSON_ZSTD
+        if ((*z).kind==JSON_ZIP_ZSTD)
+        {
+            ZSTD_inBuffer ib;
+            ZSTD_outBuffer ob;
+            size_t rc;
+            ib.src=(*z).in;
+            ib.size=(*z).inLen;
+            ib.pos=(*z).inPos;
+            ob.dst=out;
+            ob.size=cap;
+            ob.pos=n;
+            rc=ZSTD_decompressStream((*z).zs, &ob, &ib);
+            if (ZSTD_isError(rc))
+                return(JSON_ERR_ZIP);
+            (*z).inPos=(int)ib.pos;
+            n=(int)ob.pos;
+            (*z).done=(rc==0);
+        }
+#endif
+
+        //  No progress, and nothing more to go on:
+        if (n==before && (*z).inPos==(*z).inLen && (*z).eof)
+        {
+            if ((*z).done)
+                break;
+            return(JSON_ERR_ZIP);       //  Cut short
+        }
+    }
+    return(n);
+}
+
+
+//
+//  The handoff between the thread and the parser.  A pop that finds the
+//  ring empty waits, rather than spins, as a spinning side takes the
+//  processor from the one it waits for.  The ring is tried again under
+//  the lock, and every push signals under it, so no wakeup is lost.
+//  Pop returns -1 only when 'stop' is set.
+//
+void JSON_zipPush(JSON_ZIP *z, BEDROCK_SPSC *r, JSON_ZIP_BLOCK *b)
+{
+    BEDROCK_spscPush(r, b);     //  Never full, it holds all blocks
+    pthread_mutex_lock(&(*z).m);
+    pthread_cond_broadcast(&(*z).wake);
+    pthread_mutex_unlock(&(*z).m);
+    return;
+}
+
+
+int JSON_zipPop(JSON_ZIP *z, BEDROCK_SPSC *r, JSON_ZIP_BLOCK **b)
+{
+    if (BEDROCK_spscPop(r, (void**)b)==0)
+        return(0);
+    pthread_mutex_lock(&(*z).m);
+    while (BEDROCK_spscPop(r, (void**)b)<0)
+    {
+        if (BEDROCK_atomicLoad(&(*z).stop))
+        {
+            pthread_mutex_unlock(&(*z).m);
+            return(-1);
+        }
+        pthread_cond_wait(&(*z).wake, &(*z).m);
+    }
+    pthread_mutex_unlock(&(*z).m);
+    return(0);
+}
+
+
+void *JSON_zipThread(void *arg)
+{
+    JSON_ZIP *z=(JSON_ZIP*)arg;
+    JSON_ZIP_BLOCK *b;
+
+    while (JSON_zipPop(z, &(*z).empty, &b)==0)
+    {
+        (*b).len=JSON_zipInflate(z, (*b).buf, JSON_ZIP_OUT);
+        JSON_zipPush(z, &(*z).full, b);
+        if ((*b).len<=0)
+            break;
+    }
+    return(NULL);
+}
+
+
+//  The next block for the parser, see 'JSON_fill':
+int JSON_zipFill(JSON_PARSER *d)
+{
+    JSON_ZIP *z=(JSON_ZIP*)(*d).zip;
+    int n;
+
+    if ((*z).end)
+        return(EOF);
+    (*d).off+=(*d).len;
+    if ((*z).threaded)
+    {
+        if ((*z).cur)
+            JSON_zipPush(z, &(*z).empty, (*z).cur);
+        JSON_zipPop(z, &(*z).full, &((*z).cur));
+        (*d).buf=(*(*z).cur).buf;
+        n=(*(*z).cur).len;
+        if (n<=0)
+        {
+            //  The thread is done, and so is the block:
+            JSON_zipPush(z, &(*z).empty, (*z).cur);
+            (*z).cur=NULL;
+        }
+    }
+    else
+    {
+        (*d).buf=(*d).own;
+        n=JSON_zipInflate(z, (*d).own, JSON_PARSER_BUF);
+    }
+
+    if (n<=0)
+    {
+        (*z).end=1;
+        (*z).err=(n<0)?n:0;
+        (*d).len=0;
+        (*d).pos=0;
+        return(EOF);
+    }
+    (*d).len=n;
+    (*d).pos=1;
+    return((u_int8_t)(*d).buf[0]);
+}
+
+
+void JSON_zipFree(JSON_ZIP *z)
+{
+    int i;
+    if ((*z).threaded)
+    {
+        void *v;
+        pthread_mutex_lock(&(*z).m);
+        BEDROCK_atomicStore(&(*z).stop, 1);
+        pthread_cond_broadcast(&(*z).wake);
+        pthread_mutex_unlock(&(*z).m);
+        pthread_join((*z).th, &v);
+        pthread_cond_destroy(&(*z).wake);
+        pthread_mutex_destroy(&(*z).m);
+    }
+    BEDROCK_spscFree(&(*z).full);
+    BEDROCK_spscFree(&(*z).empty);
+    for (i=0; i<JSON_ZIP_BLOCKS; i+=1)
+        free((*z).block[i].buf);
+#ifdef JSON_ZLIB
+    if ((*z).kind==JSON_ZIP_GZ)
+        inflateEnd(&(*z).gz);
+#endif
+#ifdef JSON_ZSTD
+    if ((*z).zs)
+        ZSTD_freeDStream((*z).zs);
+#endif
+    free((*z).in);
+    free(z);
+    return;
+}
+
+
+int JSON_parserZip(JSON_PARSER *p, FILE *str, int threaded)
+{
+    JSON_ZIP *z;
+    u_int8_t *m;
+    int i;
+
+    JSON_parserMem(p, NULL, 0);
+    (*p).own=(char*)malloc(JSON_PARSER_BUF);
+    z=(JSON_ZIP*)calloc(1, sizeof(JSON_ZIP));
+    if (z==NULL || (*p).own==NULL)
+    {
+        free(z);
+        JSON_parserFree(p);
+        return(JSON_ERR_MEM);
+    }
+    (*p).zip=z;
+    (*z).str=str;
+    (*z).in=(char*)malloc(JSON_ZIP_IN);
+    if ((*z).in==NULL)
+    {
+        JSON_parserFree(p);
+        return(JSON_ERR_MEM);
+    }
+
+    //  What it is, by the magic at the start:
+    (*z).inLen=fread((*z).in, 1, JSON_ZIP_IN, str);
+    if ((*z).inLen<=0)
+    {
+        (*z).inLen=0;
+        (*z).eof=1;
+    }
+    m=(u_int8_t*)(*z).in;
+    if ((*z).inLen>=2 && m[0]==0x1f && m[1]==0x8b)
+        (*z).kind=JSON_ZIP_GZ;
+    else if ((*z).inLen>=4 && m[0]==0x28 && m[1]==0xb5 && m[2]==0x2f && m[3]==0xfd)
+        (*z).kind=JSON_ZIP_ZSTD;
+    else
+        (*z).kind=JSON_ZIP_NONE;
+
+    //  And whether it was built in:
+    i=JSON_ERR_ZIP;
+    if ((*z).kind==JSON_ZIP_NONE)
+        i=0;
+#ifdef JSON_ZLIB
+    if ((*z).kind==JSON_ZIP_GZ)
+        i=(inflateInit2(&(*z).gz, 15+32)==Z_OK)?0:JSON_ERR_MEM;
+#endif
+#ifdef JSON_ZSTD
+    if ((*z).kind==JSON_ZIP_ZSTD)
+        i=(((*z).zs=ZSTD_createDStream())!=NULL)?0:JSON_ERR_MEM;
+#endif
+    if (i<0)
+    {
+        (*z).kind=JSON_ZIP_NONE;    //  Nothing to end
+        JSON_parserFree(p);
+        return(i);
+    }
+
+    //  With one processor there is nothing to overlap with:
+    if (threaded && BEDROCK_cpus()>1)
+    {
+        if (BEDROCK_spscInit(&(*z).full, JSON_ZIP_BLOCKS)<0 || BEDROCK_spscInit(&(*z).empty, JSON_ZIP_BLOCKS)<0)
+        {
+            JSON_parserFree(p);
+            return(JSON_ERR_MEM);
+        }
+        for (i=0; i<JSON_ZIP_BLOCKS; i+=1)
+        {
+            (*z).block[i].buf=(char*)malloc(JSON_ZIP_OUT);
+            if ((*z).block[i].buf==NULL)
+            {
+                JSON_parserFree(p);
+                return(JSON_ERR_MEM);
+            }
+            BEDROCK_spscPush(&(*z).empty, &((*z).block[i]));
+        }
+        pthread_mutex_init(&(*z).m, NULL);
+        pthread_cond_init(&(*z).wake, NULL);
+        if (pthread_create(&(*z).th, NULL, JSON_zipThread, z)!=0)
+        {
+            pthread_cond_destroy(&(*z).wake);
+            pthread_mutex_destroy(&(*z).m);
+            JSON_parserFree(p);
+            return(JSON_ERR_MEM);
+        }
+        (*z).threaded=1;
+    }
+    return(0);
+}
+
+
+//  JSON_ERR_ZIP if the input turned out corrupt, or 0:
+int JSON_zipError(JSON_PARSER *p)
+{
+    if ((*p).zip)
+        return((*(JSON_ZIP*)(*p).zip).err);
+    return(0);
+}
+
+
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Stateless parsing                                                 *
+ *                                                                      *
+ ************************************************************************/
+
+
+
+//
+//  All input goes through the context (see JSON_PARSER in json.h).
+//  Buffered input is read straight from memory, and only when it runs
+//  out does 'JSON_fill' go to the stream.
+//
+int JSON_fill(JSON_PARSER *d)
+{
+    int c;
+    if ((*d).zip)
+        return(JSON_zipFill(d));
+    if ((*d).iov)
+    {
+        //  The next buffer of the chain:
+        while ((*d).iovCnt>0)
+        {
+            (*d).off+=(*d).len;
+            (*d).buf=(char*)(*(*d).iov).iov_base;
+            (*d).len=(int)(*(*d).iov).iov_len;
+            (*d).iov+=1;
+            (*d).iovCnt-=1;
+            if ((*d).len>0)
+            {
+                (*d).pos=1;
+                return((u_int8_t)(*d).buf[0]);
+            }
+        }
+        return(EOF);
+    }
+    if ((*d).rd)
+    {
+        //  The next buffer that came in:
+        char *buf;
+        int64_t n=BEDROCK_readerNext((*d).rd, &buf);
+        if (n<=0)
+            return(EOF);
+        (*d).off+=(*d).len;
+        (*d).buf=buf;
+        (*d).len=(int)n;
+        (*d).pos=1;
+        return((u_int8_t)(*d).buf[0]);
+    }
+    if ((*d).str==NULL)
+        return(EOF);
+
+    //  Byte by byte, the stream is already locked:
+    if ((*d).lock)
+    {
+        c=(*d).back;
+        if (c!=EOF)
+            (*d).back=EOF;
+        else
+            c=getc_unlocked((*d).str);
+        if (c!=EOF)
+            (*d).off+=1;
+        return(c);
+    }
+
+    //  The next block:
+    c=fread((*d).own, 1, JSON_PARSER_BUF, (*d).str);
+    if (c<=0)
+        return(EOF);
+    (*d).off+=(*d).len;
+    (*d).buf=(*d).own;
+    (*d).len=c;
+    (*d).pos=1;
+    return((u_int8_t)(*d).buf[0]);
+}
+
+
+int JSON_fgetc(JSON_PARSER *d)
+{
+    int c;
+    if ((*d).pos<(*d).len)
+    {
+        c=(u_int8_t)(*d).buf[(*d).pos];
+        (*d).pos+=1;
+        return(c);
+    }
+    return(JSON_fill(d));
+}
+
+
+//  Only one character is ever pushed back.  The buffer still has it,
+//  even right after a new block was read.
+int JSON_ungetc(int c, JSON_PARSER *d)
+{
+    if ((*d).lock)
+    {
+        (*d).back=c;
+        if (c!=EOF)
+            (*d).off-=1;
+    }
+    else if ((*d).pos>0)
+        (*d).pos-=1;
+    else
+        return(EOF);
+    return(c);
+}
+
+
+
+//
+//  Set up of the context.  Note that the scratch space is not cleared,
+//  it is always written before it is read.
+//
+void JSON_parserMem(JSON_PARSER *p, char *buf, int len)
+{
+    (*p).str=NULL;
+    (*p).lock=0;
+    (*p).back=EOF;
+    (*p).buf=buf;
+    (*p).len=len;
+    (*p).pos=0;
+    (*p).own=NULL;
+    (*p).rd=NULL;
+    (*p).iov=NULL;
+    (*p).iovCnt=0;
+    (*p).zip=NULL;
+    (*p).tape=NULL;
+    (*p).raw=0;
+    (*p).decode=0;
+    (*p).off=0;
+    (*p).err=-1;
+    return;
+}
+
+
+void JSON_parserIov(JSON_PARSER *p, const struct iovec *iov, int cnt)
+{
+    JSON_parserMem(p, NULL, 0);
+    (*p).iov=iov;
+    (*p).iovCnt=cnt;
+    return;
+}
+
+
+int JSON_parserFile(JSON_PARSER *p, FILE *str)
+{
+    JSON_parserMem(p, NULL, 0);
+    (*p).own=(char*)malloc(JSON_PARSER_BUF);
+    if ((*p).own==NULL)
+        return(JSON_ERR_MEM);
+    (*p).str=str;
+    return(0);
+}
+
+
+int JSON_parserFd(JSON_PARSER *p, int fd)
+{
+    JSON_parserMem(p, NULL, 0);
+    (*p).rd=(BEDROCK_READER*)malloc(sizeof(BEDROCK_READER));
+    if ((*p).rd==NULL)
+        return(JSON_ERR_MEM);
+    if (BEDROCK_readerOpen((*p).rd, fd, 0, 0, 0)<0)
+    {
+        free((*p).rd);
+        (*p).rd=NULL;
+        return(JSON_ERR_MEM);
+    }
+    return(0);
+}
+
+
+void JSON_parserFree(JSON_PARSER *p)
+{
+    if ((*p).zip)
+        JSON_zipFree((JSON_ZIP*)(*p).zip);
+    if ((*p).rd)
+    {
+        BEDROCK_readerClose((*p).rd);
+        free((*p).rd);
+    }
+    free((*p).own);
+    JSON_parserMem(p, NULL, 0);
+    return;
+}
+
+
+//  Byte by byte from 'str', holding its lock until 'JSON_parserUnlock'.
+//  This never reads past the end of what is parsed.
+void JSON_parserLock(JSON_PARSER *p, FILE *str)
+{
+    JSON_parserMem(p, NULL, 0);
+    (*p).str=str;
+    (*p).lock=1;
+    flockfile(str);
+    return;
+}
+
+
+void JSON_parserUnlock(JSON_PARSER *p)
+{
+    //  The character that was looked at last goes back into the stream:
+    if ((*p).back!=EOF)
+        ungetc((*p).back, (*p).str);
+    (*p).back=EOF;
+    funlockfile((*p).str);
+    return;
+}
+
+
+
+//  
+//  Method prototypes for parsing:
+//
+int JSON_ws    (JSON_PARSER *d);
+int JSON_num   (JSON_PARSER *d, char *ns, double *num, int *cmd, u_int64_t *i);
+int JSON_string(JSON_PARSER *d, char *s, int l);
+int JSON_symbol(JSON_PARSER *d, int *sym);
+int JSON_value (JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
+int JSON_array (JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
+int JSON_object(JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
+
+
+
+//
+//  Hands the events on the tape to the batch callback:
+//
+void JSON_tapeFlush(JSON_TAPE *t)
+{
+    //  After an error from the batch callback, nothing more is handed over:
+    if ((*t).cnt>0 && (*t).rc==0)
+    {
+        int rc=(*(*t).batch)((*t).e, (*t).cnt, (*t).user);
+        if (rc<0)
+            (*t).rc=rc;
+    }
+    (*t).cnt=0;
+    (*t).len=0;
+    return;
+}
+
+
+//  Where the next string is parsed to.  On a tape it goes straight to the
+//  free space there, which always has room for the longest string, and
+//  its event:
+char *JSON_scratch(JSON_PARSER *d)
+{
+    JSON_TAPE *t=(*d).tape;
+    if (t==NULL)
+        return((*d).s);
+    if ((*t).len+JSON_MAX_LEN>JSON_TAPE_CHARS || (*t).cnt==JSON_TAPE_EVENTS)
+        JSON_tapeFlush(t);
+    return((*t).s+(*t).len);
+}
+
+
+//  Every event of the parser goes through here, and only costs a test
+//  when there is no tape.  On a tape the event is appended in line, as
+//  a call for each would cost as much as the callback it saves.  Strings
+//  were parsed straight onto the tape, see 'JSON_scratch'.  An error from
+//  the callback, or from the batch callback on a flush, returns it from
+//  the calling method, and so ends the parse:
+#define JSON_EMIT(ctx, kind, rank, depth, str, num, callback, user) \
+    do \
+    { \
+        JSON_TAPE *tape=(*(ctx)).tape; \
+        if (tape==NULL) \
+            JSON_CALL(callback((kind), (rank), (depth), (str), (num), (user))); \
+        else \
+        { \
+            JSON_EVENT *ev; \
+            char *es=(str); \
+            if ((*tape).cnt==JSON_TAPE_EVENTS) \
+                JSON_tapeFlush(tape); \
+            if ((*tape).rc<0) \
+                return((*tape).rc); \
+            ev=&((*tape).e[(*tape).cnt]); \
+            (*ev).cmd=(kind); \
+            (*ev).r=(rank); \
+            (*ev).d=(depth); \
+            (*ev).len=0; \
+            if ((kind)&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT)) \
+                (*ev).v.u=*(u_int64_t*)es; \
+            else if (es!=NULL) \
+            { \
+                (*ev).v.s=es; \
+                (*ev).len=strlen(es); \
+                (*tape).len+=(*ev).len+1; \
+            } \
+            else \
+                (*ev).v.n=(num); \
+            (*tape).cnt+=1; \
+        } \
+    } \
+    while (0)
+
+
+
+
+
+//  Returns number of characters of whitespace consumed:
+int JSON_ws(JSON_PARSER *d)
+{
+    int c;
+    int n=0;
+    do
+    {
+        c=JSON_fgetc(d);
+        n+=1;
+    }
+    while (c!=EOF && (c==0x20 || c==0x0a || c==0x0d || c==0x09));
+    if (c!=EOF)
+        JSON_ungetc(c, d);
+    n-=1;
+    return(n);
+}
+
+//  An integer that fits 64 bits, optionally negative, and nothing else:
+//  Returns JSON_CMD_VAL_INT (the bits of an int64_t are in 'i'), or
+//  JSON_CMD_VAL_UINT, or 0 if it is not.
+int JSON_atoi(const char *s, u_int64_t *i)
+{
+    const char *p=s;
+    u_int64_t u=0;
+
+    if (*p=='-')
+        p+=1;
+    if (*p==0)
+        return(0);
+    for (; *p>='0' && *p<='9'; p+=1)
+    {
+        u_int64_t c=(u_int64_t)(*p-'0');
+        if (u>(~(u_int64_t)0-c)/10)
+            return(0);      //  Too big, it stays a double
+        u=u*10+c;
+    }
+    if (*p)
+        return(0);
+    if (*s=='-')
+    {
+        if (u>((u_int64_t)1)<<63)
+            return(0);
+        (*i)=(u_int64_t)0-u;
+        return(JSON_CMD_VAL_INT);
+    }
+    (*i)=u;
+    return((u>>63)?JSON_CMD_VAL_UINT:JSON_CMD_VAL_INT);
+}
+
+
+//  Returns number of chars read if a number was found (ie. >0)
+//  The text goes to 'ns', JSON_MAX_LEN long.  'cmd' is set to
+//  JSON_CMD_VAL_NUM, with JSON_CMD_VAL_INT or JSON_CMD_VAL_UINT if it is
+//  an integer that fits 64 bits, which is then stored in 'i' as well.
+//  Integers do not go through 'strtod'.  In 'raw' mode nothing is
+//  converted, and it is JSON_CMD_VAL_RAW.
+int JSON_num(JSON_PARSER *d, char *ns, double *num, int *cmd, u_int64_t *i)
+{
+    int c;
+    int n=0;
+    int in;
+
+    //  Leading '-'
+    c=JSON_fgetc(d);
+    if (!(c=='-' || (c>='0' && c<='9')))
+    {
+        //  It was not a number
+        if (c!=EOF)
+            JSON_ungetc(c, d);
+        return(n);
+    }
+
+    //  Stuff before the dot:
+    do
+    {
+        ns[n]=(char)c;
+        n+=1;
+        c=JSON_fgetc(d);
+    }
+    while (c!=EOF && c>='0' && c<='9' && n<JSON_MAX_LEN);
+
+    //  Did we get a dot?
+    if (c=='.')
+    {
+        //  After the comma:
+        do
+        {
+            ns[n]=(char)c;
+            n+=1;
+            c=JSON_fgetc(d);
+        }
+        while (c>='0' && c<='9' && n<JSON_MAX_LEN);
+    }
+    
+    //  Did we get an exponent?
+    if ((c=='e' || c=='E') && n<JSON_MAX_LEN)
+    {
+        //  Store the 'e'
+        ns[n]=(char)c;
+        n+=1;
+
+        //  Leading '+', or '-' is optional:
+        c=JSON_fgetc(d);
+        if ((c=='-' || c=='+' || (c>='0' && c<='9')) && n<JSON_MAX_LEN)
+        {
+            //  After the exponent:
+            do
+            {
+                ns[n]=(char)c;
+                n+=1;
+                c=JSON_fgetc(d);
+            }
+            while (c>='0' && c<='9' && n<JSON_MAX_LEN);
+        }
+    }
+
+    //  Make sure that we didn't run out of array space:
+    if (n==JSON_MAX_LEN)
+        return(JSON_ERR_LEN);
+
+    //  Store the number
+    ns[n]='\0';
+    if ((*d).raw)
+    {
+        (*cmd)=JSON_CMD_VAL_NUM|JSON_CMD_VAL_RAW;
+        (*num)=0.0;
+    }
+    else
+    {
+        in=JSON_atoi(ns, i);
+        (*cmd)=JSON_CMD_VAL_NUM|in;
+        if (in==JSON_CMD_VAL_INT)
+            (*num)=(double)(int64_t)(*i);
+        else if (in==JSON_CMD_VAL_UINT)
+            (*num)=(double)(*i);
+        else
+            (*num)=strtod(ns, NULL);
+    }
+
+    //  And done!
+    if (c!=EOF)
+        JSON_ungetc(c, d);
+
+    return(n);
+}
+
+
+
+//  String.
+//  Copies the string (minus the '""') preserving the control characters
+//  Returns the number of characters actually copied, null-terminates 's'.
+int JSON_string(JSON_PARSER *d, char *s, int l)
+{
+    int c;
+    int n=0;
+    char p;
+
+    //  Strings start and end with '"'
+    c=JSON_fgetc(d);
+    if (!(c=='"' || c==EOF))
+    {
+        //  It was not a string
+        JSON_ungetc(c, d);
+        return(n);
+    }
+
+    //  Unescaped and checked:
+    if ((*d).decode && c=='"')
+        return(JSON_stringDecode(d, s, l));
+
+    //  The quotes are not stored.  Read the next
+    //  character on the the string.  Note, it is
+    //  fine if this is EOF.
+    do
+    {
+        //  Skips the initial '"'
+        //  Should this store the '\' for escape sequences?
+        if (n>0)
+            s[n-1]=(char)c;
+        n+=1;
+        p=c;
+        c=JSON_fgetc(d);
+    }
+    while ( !(c==EOF || (c=='"' && p!='\\')) && n<l);
+
+    //  Make sure that we didn't run out of array space:
+    if (n==l)
+        return(JSON_ERR_LEN);
+
+    //  Was the string terminated?
+    if (c!='\"')
+        return(JSON_ERR_END_S);
+
+    //  Null terminate (character 'n' was not stored):
+    s[n-1]='\0';
+
+    //  Note, since the last character was '"' we do not need to 'ungetc'
+    n+=1;
+
+    return(n);
+}
+
+
+//
+//  Decoding strings.  The runs without escapes and below 0x80 are found
+//  32 bytes at a time (see 'JSON_span') and copied straight out of the
+//  input buffer.  A UTF-8 sequence is checked where it is, unless it
+//  straddles two buffers:  then it is gathered byte by byte, the same as
+//  an escape sequence or anything read from a locked stream.
+//
+//  The length of the valid UTF-8 sequence at 'p', 0 if it is not valid
+//  (overlong, a surrogate, above U+10FFFF, or a stray byte), or -1 if
+//  it needs more than the 'n' bytes there are:
+int JSON_utf8(const u_int8_t *p, int n)
+{
+    int c=p[0];
+    int k;
+    int i;
+
+    if (c<0x80)
+        return(1);
+    if (c<0xC2)
+        return(0);
+    else if (c<0xE0)
+        k=2;
+    else if (c<0xF0)
+        k=3;
+    else if (c<0xF5)
+        k=4;
+    else
+        return(0);
+    if (n<k)
+        return(-1);
+    for (i=1; i<k; i+=1)
+        if ((p[i]&0xC0)!=0x80)
+            return(0);
+    if ((c==0xE0 && p[1]<0xA0) || (c==0xED && p[1]>=0xA0) ||
+        (c==0xF0 && p[1]<0x90) || (c==0xF4 && p[1]>=0x90))
+        return(0);
+    return(k);
+}
+
+
+//  Code point 'u' as UTF-8, returns the length:
+int JSON_utf8Put(char *s, int u)
+{
+    if (u<0x80)
+    {
+        s[0]=(char)u;
+        return(1);
+    }
+    if (u<0x800)
+    {
+        s[0]=(char)(0xC0|(u>>6));
+        s[1]=(char)(0x80|(u&0x3F));
+        return(2);
+    }
+    if (u<0x10000)
+    {
+        s[0]=(char)(0xE0|(u>>12));
+        s[1]=(char)(0x80|((u>>6)&0x3F));
+        s[2]=(char)(0x80|(u&0x3F));
+        return(3);
+    }
+    s[0]=(char)(0xF0|(u>>18));
+    s[1]=(char)(0x80|((u>>12)&0x3F));
+    s[2]=(char)(0x80|((u>>6)&0x3F));
+    s[3]=(char)(0x80|(u&0x3F));
+    return(4);
+}
+
+
+//  The four hex digits of a '\u', or -1:
+int JSON_hex4(JSON_PARSER *d)
+{
+    int u=0;
+    int i;
+    for (i=0; i<4; i+=1)
+    {
+        int c=JSON_fgetc(d);
+        if (c>='0' && c<='9')
+            u=(u<<4)|(c-'0');
+        else if (c>='a' && c<='f')
+            u=(u<<4)|(c-'a'+10);
+        else if (c>='A' && c<='F')
+            u=(u<<4)|(c-'A'+10);
+        else
+            return(-1);
+    }
+    return(u);
+}
+
+
+//  The rest of a string after the '"', like 'JSON_string':
+int JSON_stringDecode(JSON_PARSER *d, char *s, int l)
+{
+    int n=1;        //  Bytes of input, the '"' is read already
+    int k=0;        //  Bytes of output
+    int c;
+
+    while (1)
+    {
+        int64_t at;
+
+        //  Straight out of the buffer:
+        if ((*d).pos<(*d).len)
+        {
+            const char *b=(*d).buf+(*d).pos;
+            int m=(int)JSON_span(b, (*d).len-(*d).pos, 1);
+            if (k+m>=l)
+                return(JSON_ERR_LEN);
+            memcpy(s+k, b, m);
+            k+=m;
+            n+=m;
+            (*d).pos+=m;
+            if ((*d).pos<(*d).len && (u_int8_t)b[m]>=0x80)
+            {
+                m=JSON_utf8((const u_int8_t*)b+m, (*d).len-(*d).pos);
+                if (m==0)
+                {
+                    (*d).err=(*d).off+(*d).pos;
+                    return(JSON_ERR_UTF8);
+                }
+                if (m>0)
+                {
+                    if (k+m>=l)
+                        return(JSON_ERR_LEN);
+                    memcpy(s+k, (*d).buf+(*d).pos, m);
+                    k+=m;
+                    n+=m;
+                    (*d).pos+=m;
+                    continue;
+                }
+            }
+        }
+
+        //  One at a time:
+        at=(*d).off+(*d).pos;
+        c=JSON_fgetc(d);
+        if (c==EOF)
+            return(JSON_ERR_END_S);
+        n+=1;
+        if (k+4>=l)
+            return(JSON_ERR_LEN);
+        if (c=='"')
+            break;
+        else if (c=='\\')
+        {
+            int u;
+            c=JSON_fgetc(d);
+            n+=1;
+            switch (c)
+            {
+                case '"':
+                case '\\':
+                case '/':  s[k++]=(char)c; break;
+                case 'b':  s[k++]='\b'; break;
+                case 'f':  s[k++]='\f'; break;
+                case 'n':  s[k++]='\n'; break;
+                case 'r':  s[k++]='\r'; break;
+                case 't':  s[k++]='\t'; break;
+                case 'u':
+                    u=JSON_hex4(d);
+                    n+=4;
+                    //  A surrogate pair is one character:
+                    if (u>=0xD800 && u<0xDC00)
+                    {
+                        int v=-1;
+                        if (JSON_fgetc(d)=='\\' && JSON_fgetc(d)=='u')
+                            v=JSON_hex4(d);
+                        n+=6;
+                        if (v<0xDC00 || v>=0xE000)
+                            u=-1;
+                        else
+                            u=0x10000+((u-0xD800)<<10)+(v-0xDC00);
+                    }
+                    else if (u>=0xDC00 && u<0xE000)
+                        u=-1;
+                    if (u<=0)
+                    {
+                        (*d).err=at;
+                        return(JSON_ERR_ESC);
+                    }
+                    k+=JSON_utf8Put(s+k, u);
+                    break;
+                default:
+                    (*d).err=at;
+                    return(JSON_ERR_ESC);
+            }
+        }
+        else if (c<0x20)
+        {
+            (*d).err=at;
+            return(JSON_ERR_ESC);
+        }
+        else if (c<0x80)
+            s[k++]=(char)c;
+        else
+        {
+            //  A UTF-8 sequence over two buffers, or from a stream:
+            u_int8_t b[4];
+            int m=1;
+            b[0]=(u_int8_t)c;
+            while (m<4 && JSON_utf8(b, m)<0)
+            {
+                c=JSON_fgetc(d);
+                if (c==EOF)
+                    break;
+                b[m++]=(u_int8_t)c;
+                n+=1;
+            }
+            if (JSON_utf8(b, m)!=m)
+            {
+                (*d).err=at;
+                return(JSON_ERR_UTF8);
+            }
+            memcpy(s+k, b, m);
+            k+=m;
+        }
+    }
+
+    s[k]='\0';
+    return(n);
+}
+
+
+//  Returns the number of characters read, 0 if
+//  no symbol was found, or an error code (<0)
+//  If a symbol (rc>0) was found 'sym' is set
+//  NOTE:  technically true/false are lower-case only!
+int JSON_symbol(JSON_PARSER *d, int *sym)
+{
+    int c;
+    int n=0;
+
+        //  Since 'ungetc' only works on a single
+        //  character, these symbols are read and
+        //  compared 1 by 1.
+    c=JSON_fgetc(d);
+    if (c=='t' || c=='T')
+    {
+        int r=JSON_fgetc(d);
+        int u=JSON_fgetc(d);
+        int e=JSON_fgetc(d);
+        n=4;
+
+        if (!((r=='r' || r=='R') && (u=='u' || u=='U') && (e=='e' || e=='E')))
+            return(JSON_ERR_SYM);
+
+        (*sym)=JSON_SYM_TRUE;
+    }
+    else if (c=='f' || c=='F')
+    {
+        int a=JSON_fgetc(d);
+        int l=JSON_fgetc(d);
+        int s=JSON_fgetc(d);
+        int e=JSON_fgetc(d);
+        n=5;
+
+        if (!((a=='a' || a=='A') && (l=='l' || l=='L') && (s=='s' || s=='S') && (e=='e' || e=='E')))
+            return(JSON_ERR_SYM);
+
+        (*sym)=JSON_SYM_FALSE;
+    }
+    else if (c=='n' || c=='U')
+    {
+        int u=JSON_fgetc(d);
+        int l=JSON_fgetc(d);
+        int L=JSON_fgetc(d);
+        n=4;
+
+        if (!((u=='u' || u=='U') && (l=='l' || l=='L') && (L=='l' || L=='L')))
+            return(JSON_ERR_SYM);
+
+        (*sym)=JSON_SYM_NULL;
+    }
+    else if (c!=EOF)
+        JSON_ungetc(c, d);
+
+    return(n);
 }
 
 
 //  Value looks for parsing whitespace, then tries to find
 //  either a string, number, object, array, or some predefined 
 //  symbols (true/false)
-int JSON_value(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+int JSON_value(JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
 {
     int n, m;
     
@@ -639,13 +2398,13 @@ int JSON_value(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
     //  (m is oviously '0' still)
     if (m==0)
     {
-        char s[JSON_MAX_LEN];
+        char *s=JSON_scratch(d);
         m=JSON_string(d, s, JSON_MAX_LEN);
         if (m>0)
         {
             //  Found a string:
             n+=m;
-            callback(JSON_CMD_VAL_STR, rank, depth, s, 0.0, user);
+            JSON_EMIT(d, JSON_CMD_VAL_STR|JSON_TXT(d), rank, depth, s, 0.0, callback, user);
         }
     }
 
@@ -653,12 +2412,18 @@ int JSON_value(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
     if (m==0)
     {
         double num;
-        m=JSON_num(d, &num);
+        u_int64_t i;
+        int cmd;
+        char *s=JSON_scratch(d);
+        m=JSON_num(d, s, &num, &cmd, &i);
         if (m>0)
         {
-            //  Found a number:
+            //  Found a number, for an integer 's' points to it, and if raw
+            //  it is the text:
             n+=m;
-            callback(JSON_CMD_VAL_NUM, rank, depth, NULL, num, user);
+            if (!(cmd&JSON_CMD_VAL_RAW))
+                s=(cmd&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT))?(char*)&i:NULL;
+            JSON_EMIT(d, cmd, rank, depth, s, num, callback, user);
         }
     }
 
@@ -671,7 +2436,7 @@ int JSON_value(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
         {
             //  Symbol: 'sym' was found:
             n+=m;
-            callback(JSON_CMD_VAL_SYM, rank, depth, NULL, sym, user);
+            JSON_EMIT(d, JSON_CMD_VAL_SYM, rank, depth, NULL, sym, callback, user);
         }
     }
 
@@ -708,7 +2473,7 @@ int JSON_value(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
 
 //  Parse an array of comma separated values.
 //  Returns number of chars read, or <0 for error.
-int JSON_array(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+int JSON_array(JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
 {
     int c;
     int n=0;
@@ -727,7 +2492,7 @@ int JSON_array(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
     n+=1;
 
     //  There is a new array:
-    callback(JSON_CMD_NEW_ARRAY, rank, depth, NULL, 0.0, user);
+    JSON_EMIT(d, JSON_CMD_NEW_ARRAY, rank, depth, NULL, 0.0, callback, user);
 
     //  Check for empty array condition:
     n+=JSON_ws(d);
@@ -736,7 +2501,7 @@ int JSON_array(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
     {
         //  Empty array.
         n+=1;
-        callback(JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, user);
+        JSON_EMIT(d, JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, callback, user);
         return(n);
     }
     else if (c!=EOF)
@@ -781,7 +2546,7 @@ int JSON_array(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
     if (c!=']')
         return(JSON_ERR_END_A);
     else
-        callback(JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, user);
+        JSON_EMIT(d, JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, callback, user);
         //fprintf(stderr, "]");
 
     return(n);
@@ -790,7 +2555,7 @@ int JSON_array(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r
 
 //  Parse an object.
 //  Returns number of chars read, or <0 for error.
-int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+int JSON_object(JSON_PARSER *d, int rank, int depth, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
 {
     int c;
     int n=0;
@@ -809,7 +2574,7 @@ int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int
 
     //  There is a new object:
     //  Note, this 'rank' is the order in the parent where this object is.
-    callback(JSON_CMD_NEW_OBJ, rank, depth, NULL, 0.0, user);
+    JSON_EMIT(d, JSON_CMD_NEW_OBJ, rank, depth, NULL, 0.0, callback, user);
 
     //  Check for empty object condition (which is valid):
     n+=JSON_ws(d);
@@ -817,7 +2582,7 @@ int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int
     if (c=='}')
     {
         //  Empty object.
-        callback(JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, user);
+        JSON_EMIT(d, JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, callback, user);
         n+=1;
         return(n);
     }
@@ -830,16 +2595,16 @@ int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int
     do
     {
         int m;
+        char *s;
 
         //  Was there a value, or error?
         if (c==',')
         {
-            char s[JSON_MAX_LEN];
-
             //  String:
             //  If a string is less than 2 characters (empty string)
             //  then there has been an error:
             n+=JSON_ws(d);
+            s=JSON_scratch(d);
             m=JSON_string(d, s, JSON_MAX_LEN);
             if (m<2)
                 return(m);
@@ -855,7 +2620,7 @@ int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int
             //  A key/label was parsed.
             //  Note, that this 'rank' is the count of the number
             //  of KV pairs inside this object.
-            callback(JSON_CMD_VAL_OLBL, v, depth+1, s, 0.0, user);
+            JSON_EMIT(d, JSON_CMD_VAL_OLBL|JSON_TXT(d), v, depth+1, s, 0.0, callback, user);
 
             //  And the value:
             //  Note, that the rank of this OLBL:VAL pair is given
@@ -885,152 +2650,774 @@ int JSON_object(JSON_DATA *d, int rank, int depth, int (*callback)(int cmd, int
     }
     while (!(c=='}' || c==EOF));
 
-    //  Did not find the end bracket:
-    if (c!='}')
-        return(JSON_ERR_END_O);
-    else
-        callback(JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, user);
+    //  Did not find the end bracket:
+    if (c!='}')
+        return(JSON_ERR_END_O);
+    else
+        JSON_EMIT(d, JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, callback, user);
+
+    return(n);
+}
+
+
+//  What went wrong, on stderr:
+void JSON_parseError(int rc)
+{
+    switch(rc)
+    {
+        case JSON_ERR_LEN:
+            fprintf(stderr, "Value (string or number) exceeded maximum length of %i bytes\n", JSON_MAX_LEN);
+            break;
+        case JSON_ERR_END_S:
+            fprintf(stderr, "Expected value or end of string '\"' \n");
+            break;
+        case JSON_ERR_END_A:
+            fprintf(stderr, "Expected end of array ']' \n");
+            break;
+        case JSON_ERR_END_O:
+            fprintf(stderr, "Expected end of object '}' \n");
+            break;
+        case JSON_ERR_SYM:
+            fprintf(stderr, "Error parsing symbol\n");
+            break;
+        case JSON_ERR_VALUE:
+            fprintf(stderr, "Error parsing value\n");
+            break;
+        case JSON_ERR_ARRAY:
+            fprintf(stderr, "Expected ',' separator in array\n");
+            break;
+        case JSON_ERR_OBJ:
+            fprintf(stderr, "Expected ',' separator in object\n");
+            break;
+        case JSON_ERR_SEP:
+            fprintf(stderr, "Expected ':' separator\n");
+            break;
+        case JSON_ERR_MEM:
+            fprintf(stderr, "Out of memory\n");
+            break;
+        case JSON_ERR_ESC:
+            fprintf(stderr, "Invalid escape sequence or control character in string\n");
+            break;
+        case JSON_ERR_UTF8:
+            fprintf(stderr, "Invalid UTF-8 in string\n");
+            break;
+        case JSON_ERR_NUM:
+            fprintf(stderr, "Malformed number\n");
+            break;
+        case JSON_ERR_MORE:
+            fprintf(stderr, "Unexpected input after the value\n");
+            break;
+        default:
+            fprintf(stderr, "Parse error %i\n", rc);
+            break;
+    }
+    return;
+}
+
+
+//
+//  The top-level parsing method parses one value and
+//  reports on any errors.  If the value is complete,
+//  the method quits, although additional values may
+//  exist in the stream.  Additional calls will be needed.
+//
+int JSON_parseInt(JSON_PARSER *d, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+{
+    int depth=0;
+    int rank=0;
+    int rc;
+
+    //  Read JSON from the stream given, calling callback.
+    rc=JSON_value(d, rank, depth, callback, user);
+    if (rc<0)
+        JSON_parseError(rc);
+    return(rc);
+}
+
+
+
+//  Original JSON_parse on a FILE stream:
+int JSON_parse(FILE *str, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+{
+    JSON_PARSER d;
+    int rc;
+    JSON_parserLock(&d, str);
+    rc=JSON_parseInt(&d, callback, user);
+    JSON_parserUnlock(&d);
+    return(rc);
+}
+
+
+//  Same but for a buffer of length 'len'
+int JSON_parseMem(char *buf, int len, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+{
+    JSON_PARSER d;
+    JSON_parserMem(&d, buf, len);
+    return(JSON_parseInt(&d, callback, user));
+}
+
+
+//  The same, on a tape:
+int JSON_parseTape(JSON_PARSER *d, int next, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user)
+{
+    JSON_TAPE t;
+    int rc;
+
+    t.cnt=0;
+    t.len=0;
+    t.batch=batch;
+    t.user=user;
+    t.rc=0;
+    (*d).tape=&t;
+    if (next)
+        rc=JSON_parserNext(d, NULL, NULL);
+    else
+        rc=JSON_parseInt(d, NULL, NULL);
+
+    //  What was parsed up to an error is still handed over:
+    JSON_tapeFlush(&t);
+    (*d).tape=NULL;
+    if (t.rc<0)
+        rc=t.rc;
+    return(rc);
+}
+
+
+int JSON_parseBatch(FILE *str, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user)
+{
+    JSON_PARSER d;
+    int rc;
+    JSON_parserLock(&d, str);
+    rc=JSON_parseTape(&d, 0, batch, user);
+    JSON_parserUnlock(&d);
+    return(rc);
+}
+
+
+int JSON_parseMemBatch(char *buf, int len, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user)
+{
+    JSON_PARSER d;
+    JSON_parserMem(&d, buf, len);
+    return(JSON_parseTape(&d, 0, batch, user));
+}
+
+
+//  Same but for a chain of buffers
+int JSON_parseIov(const struct iovec *iov, int cnt, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+{
+    JSON_PARSER d;
+    JSON_parserIov(&d, iov, cnt);
+    return(JSON_parseInt(&d, callback, user));
+}
+
+
+//  The next value from a context, or 0 at the end of the input:
+int JSON_parserNext(JSON_PARSER *p, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+{
+    int c;
+    JSON_ws(p);
+    c=JSON_fgetc(p);
+    if (c==EOF)
+        return(JSON_zipError(p));
+    JSON_ungetc(c, p);
+    c=JSON_parseInt(p, callback, user);
+    if (c<0 && JSON_zipError(p))
+        return(JSON_zipError(p));
+    return(c);
+}
+
+
+int JSON_parserNextBatch(JSON_PARSER *p, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user)
+{
+    return(JSON_parseTape(p, 1, batch, user));
+}
+
+
+
+//
+//  Validation only.  One pass over the buffer, with the nesting as a
+//  stack of bits (1 for an object):  nothing is copied, nothing is
+//  converted, and no callback is made.  Strings are skipped with the
+//  same 32-byte span scan as the escaper, stopping only at '"', '\',
+//  control characters, and with 'utf8' set at the bytes from 0x80 up.
+//
+//  The four hex digits at 'p', or -1:
+int JSON_validHex(const char *p)
+{
+    int u=0;
+    int i;
+    for (i=0; i<4; i+=1)
+    {
+        int c=p[i];
+        if (c>='0' && c<='9')
+            u=(u<<4)|(c-'0');
+        else if (c>='a' && c<='f')
+            u=(u<<4)|(c-'a'+10);
+        else if (c>='A' && c<='F')
+            u=(u<<4)|(c-'A'+10);
+        else
+            return(-1);
+    }
+    return(u);
+}
+
+
+//  From the '"' at 'pos', which is left after the closing '"', or at
+//  the byte that is wrong:
+int JSON_validString(const char *buf, int64_t len, int64_t *pos, int utf8)
+{
+    int64_t i=(*pos)+1;
+    int rc=0;
+
+    while (rc==0)
+    {
+        int c;
+        i+=JSON_span(buf+i, len-i, utf8);
+        if (i>=len)
+        {
+            rc=JSON_ERR_END_S;
+            break;
+        }
+        c=(u_int8_t)buf[i];
+        if (c=='"')
+        {
+            i+=1;
+            break;
+        }
+        if (c=='\\')
+        {
+            int u;
+            if (i+1>=len)
+            {
+                rc=JSON_ERR_END_S;
+                break;
+            }
+            switch (buf[i+1])
+            {
+                case '"':
+                case '\\':
+                case '/':
+                case 'b':
+                case 'f':
+                case 'n':
+                case 'r':
+                case 't':
+                    i+=2;
+                    continue;
+                case 'u':
+                    break;
+                default:
+                    rc=JSON_ERR_ESC;
+                    continue;
+            }
+            u=(i+5<len)?JSON_validHex(buf+i+2):-1;
+            //  Checking UTF-8, surrogates must come in pairs:
+            if (utf8 && u>=0xDC00 && u<0xE000)
+                u=-1;
+            if (utf8 && u>=0xD800 && u<0xDC00)
+            {
+                int l=(i+11<len && buf[i+6]=='\\' && buf[i+7]=='u')?JSON_validHex(buf+i+8):-1;
+                if (l<0xDC00 || l>=0xE000)
+                    u=-1;
+                else
+                    i+=6;
+            }
+            if (u<0)
+                rc=JSON_ERR_ESC;
+            else
+                i+=6;
+        }
+        else if (c<0x20)
+            rc=JSON_ERR_ESC;
+        else
+        {
+            //  From 0x80 up, with 'utf8' set:
+            int m=JSON_utf8((const u_int8_t*)buf+i, (len-i>4)?4:(int)(len-i));
+            if (m<=0)
+                rc=JSON_ERR_UTF8;
+            else
+                i+=m;
+        }
+    }
+    (*pos)=i;
+    return(rc);
+}
+
+
+//  -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+int JSON_validNumber(const char *buf, int64_t len, int64_t *pos)
+{
+    int64_t i=(*pos);
+    int64_t k;
+
+    if (i<len && buf[i]=='-')
+        i+=1;
+    if (i<len && buf[i]=='0')
+    {
+        //  No leading zeros:
+        i+=1;
+        if (i<len && (unsigned)(buf[i]-'0')<10)
+        {
+            (*pos)=i;
+            return(JSON_ERR_NUM);
+        }
+    }
+    else if (i<len && buf[i]>='1' && buf[i]<='9')
+        while (i<len && (unsigned)(buf[i]-'0')<10)
+            i+=1;
+    else
+    {
+        (*pos)=i;
+        return(JSON_ERR_NUM);
+    }
+    if (i<len && buf[i]=='.')
+    {
+        k=i+=1;
+        while (i<len && (unsigned)(buf[i]-'0')<10)
+            i+=1;
+        if (i==k)
+        {
+            (*pos)=i;
+            return(JSON_ERR_NUM);
+        }
+    }
+    if (i<len && (buf[i]=='e' || buf[i]=='E'))
+    {
+        i+=1;
+        if (i<len && (buf[i]=='+' || buf[i]=='-'))
+            i+=1;
+        k=i;
+        while (i<len && (unsigned)(buf[i]-'0')<10)
+            i+=1;
+        if (i==k)
+        {
+            (*pos)=i;
+            return(JSON_ERR_NUM);
+        }
+    }
+    (*pos)=i;
+    return(0);
+}
+
+
+int JSON_validate(const char *buf, int64_t len, JSON_VALID *v)
+{
+    u_int8_t obj[JSON_VALID_DEPTH/8];
+    int64_t i=0;
+    int depth=0;
+    int utf8=(v)?(*v).utf8:0;
+    int rc=0;
+    int s=0;
+
+    //  States:
+    //  '0' a value is next
+    //  '1' a value was done, next is ',' or the end of its array or object
+    //  '2' an object label is next
+    while (rc==0)
+    {
+        while (i<len && (buf[i]==' ' || buf[i]=='\n' || buf[i]=='\r' || buf[i]=='\t'))
+            i+=1;
+        if (s==1 && depth==0)
+        {
+            //  The one value is done, and there must be nothing after it:
+            if (i<len)
+                rc=JSON_ERR_MORE;
+            break;
+        }
+        if (i>=len)
+        {
+            if (s==0)
+                rc=JSON_ERR_VALUE;
+            else
+                rc=(obj[(depth-1)>>3]&(1<<((depth-1)&7)))?JSON_ERR_END_O:JSON_ERR_END_A;
+            break;
+        }
+
+        if (s==0)
+        {
+            int c=buf[i];
+            if (c=='[' || c=='{')
+            {
+                if (depth>=JSON_VALID_DEPTH)
+                {
+                    rc=JSON_ERR_DEPTH;
+                    break;
+                }
+                if (c=='{')
+                    obj[depth>>3]|=(1<<(depth&7));
+                else
+                    obj[depth>>3]&=~(1<<(depth&7));
+                depth+=1;
+                i+=1;
+                while (i<len && (buf[i]==' ' || buf[i]=='\n' || buf[i]=='\r' || buf[i]=='\t'))
+                    i+=1;
+                //  Empty?
+                if (i<len && buf[i]==((c=='{')?'}':']'))
+                {
+                    depth-=1;
+                    i+=1;
+                    s=1;
+                }
+                else
+                    s=(c=='{')?2:0;
+            }
+            else if (c=='"')
+            {
+                rc=JSON_validString(buf, len, &i, utf8);
+                s=1;
+            }
+            else if (c=='t' || c=='f' || c=='n')
+            {
+                const char *w=(c=='t')?"true":(c=='f')?"false":"null";
+                int m=strlen(w);
+                if (len-i<m || memcmp(buf+i, w, m)!=0)
+                    rc=JSON_ERR_SYM;
+                else
+                    i+=m;
+                s=1;
+            }
+            else if (c=='-' || (c>='0' && c<='9'))
+            {
+                rc=JSON_validNumber(buf, len, &i);
+                s=1;
+            }
+            else
+                rc=JSON_ERR_VALUE;
+        }
+        else if (s==1)
+        {
+            int o=obj[(depth-1)>>3]&(1<<((depth-1)&7));
+            if (buf[i]==',')
+            {
+                i+=1;
+                s=o?2:0;
+            }
+            else if (buf[i]==(o?'}':']'))
+            {
+                i+=1;
+                depth-=1;
+            }
+            else
+                rc=o?JSON_ERR_OBJ:JSON_ERR_ARRAY;
+        }
+        else
+        {
+            //  The label, and its ':':
+            if (buf[i]!='"')
+            {
+                rc=JSON_ERR_OBJ;
+                break;
+            }
+            rc=JSON_validString(buf, len, &i, utf8);
+            while (rc==0 && i<len && (buf[i]==' ' || buf[i]=='\n' || buf[i]=='\r' || buf[i]=='\t'))
+                i+=1;
+            if (rc==0 && (i>=len || buf[i]!=':'))
+                rc=JSON_ERR_SEP;
+            i+=(rc==0);
+            s=0;
+        }
+    }
+
+    if (v)
+    {
+        (*v).rc=rc;
+        (*v).off=i;
+        (*v).depth=depth;
+    }
+    return(rc);
+}
+
+
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Statefull parsing                                                 *
+ *                                                                      *
+ ************************************************************************/
+
 
-    return(n);
+JSON_STRUCT *JSON_new()
+{
+    JSON_ALLOCATOR a;
+    memset(&a, 0, sizeof(JSON_ALLOCATOR));
+    return(JSON_newWithAllocator(&a));
 }
 
 
-//
-//  The top-level parsing method parses one value and
-//  reports on any errors.  If the value is complete,
-//  the method quits, although additional values may
-//  exist in the stream.  Additional calls will be needed.
-//
-int JSON_parseInt(JSON_DATA *d, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+JSON_STRUCT *JSON_newWithAllocator(JSON_ALLOCATOR *a)
 {
-    int depth=0;
-    int rank=0;
-    int rc;
-
-    //  Read JSON from the stream given, calling callback.
-    rc=JSON_value(d, rank, depth, callback, user);
-    if (rc<0)
+    JSON_STRUCT *j;
+    if ((*a).alloc)
+        j=(JSON_STRUCT*)(*(*a).alloc)(sizeof(JSON_STRUCT), (*a).user);
+    else
+        j=(JSON_STRUCT*)malloc(sizeof(JSON_STRUCT));
+    if (j)
     {
-        switch(rc)
-        {
-            case JSON_ERR_LEN:
-                fprintf(stderr, "Value (string or number) exceeded maximum length of %i bytes\n", JSON_MAX_LEN);
-                break;
-            case JSON_ERR_END_S:
-                fprintf(stderr, "Expected value or end of string '\"' \n");
-                break;
-            case JSON_ERR_END_A:
-                fprintf(stderr, "Expected end of array ']' \n");
-                break;
-            case JSON_ERR_END_O:
-                fprintf(stderr, "Expected end of object '}' \n");
-                break;
-            case JSON_ERR_SYM:
-                fprintf(stderr, "Error parsing symbol\n");
-                break;
-            case JSON_ERR_VALUE:
-                fprintf(stderr, "Error parsing value\n");
-                break;
-            case JSON_ERR_ARRAY:
-                fprintf(stderr, "Expected ',' separator in array\n");
-                break;
-            case JSON_ERR_OBJ:
-                fprintf(stderr, "Expected ',' separator in object\n");
-                break;
-            case JSON_ERR_SEP:
-                fprintf(stderr, "Expected ':' separator\n");
-                break;
-            default:
-                fprintf(stderr, "Parse error %i\n", rc);
-                break;
-        }
+        memset(j, 0, sizeof(JSON_STRUCT));
+        (*j).mem=(*a);
     }
-    return(rc);
+    return(j);
 }
 
 
-
-//  Original JSON_parse on a FILE stream:
-int JSON_parse(FILE *str, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+JSON_STRUCT *JSON_newArena(void *buf, size_t len, int overflow)
 {
-    JSON_DATA d;
-    memset(&d, 0, sizeof(JSON_DATA));
-    d.str=str;
-    return(JSON_parseInt(&d, callback, user));
+    JSON_ARENA *r;
+    JSON_ALLOCATOR a;
+    JSON_STRUCT *j;
+    size_t skew=(-(size_t)buf)&15;  //  Align to 16
+
+    if (buf==NULL || len<skew+sizeof(JSON_ARENA)+sizeof(JSON_STRUCT))
+        return(NULL);
+
+    //  The arena itself is the first thing in it:
+    r=(JSON_ARENA*)((char*)buf+skew);
+    (*r).m=(char*)r;
+    (*r).len=len-skew;
+    (*r).pos=(sizeof(JSON_ARENA)+15)&~15;
+    (*r).overflow=overflow;
+
+    a.alloc=JSON_arenaAlloc;
+    a.free=JSON_arenaFree;
+    a.user=r;
+    j=JSON_newWithAllocator(&a);
+
+    //  Growing chunks would only leave unused space in the arena:
+    if (j)
+        (*j).chunkMax=1;
+    return(j);
 }
 
 
-//  Same but for a buffer of length 'len'
-int JSON_parseMem(char *buf, int len, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user)
+void *JSON_hugeAlloc(size_t size, void *user)
 {
-    JSON_DATA d;
-    memset(&d, 0, sizeof(JSON_DATA));
-    d.buf=buf;
-    d.len=len;
-    return(JSON_parseInt(&d, callback, user));
+    if (size>BEDROCK_HUGE_PAGE/2)
+        return(BEDROCK_pageAlloc(size));
+    return(malloc(size));
 }
 
 
+void JSON_hugeFree(void *p, size_t size, void *user)
+{
+    if (size>BEDROCK_HUGE_PAGE/2)
+        BEDROCK_pageFree(p, size);
+    else
+        free(p);
+    return;
+}
+
 
+//  All memory of a struct goes through these two:
+void *JSON_alloc(JSON_STRUCT *j, size_t size)
+{
+    if ((*j).mem.alloc)
+        return((*(*j).mem.alloc)(size, (*j).mem.user));
+    return(malloc(size));
+}
 
 
-/************************************************************************
- *                                                                      *
- *    Statefull parsing                                                 *
- *                                                                      *
- ************************************************************************/
+void JSON_free(JSON_STRUCT *j, void *p, size_t size)
+{
+    if (p==NULL)
+        return;
+    if ((*j).mem.free)
+        (*(*j).mem.free)(p, size, (*j).mem.user);
+    else if ((*j).mem.alloc==NULL)
+        free(p);
+    return;
+}
 
 
-JSON_STRUCT *JSON_new()
+//  The arena allocator.  Sizes are rounded to 16 bytes, so that
+//  everything handed out stays aligned.
+void *JSON_arenaAlloc(size_t size, void *user)
 {
-    JSON_STRUCT *j=(JSON_STRUCT*)malloc(sizeof(JSON_STRUCT));
-    if (j)
+    JSON_ARENA *r=(JSON_ARENA*)user;
+    size=(size+15)&~((size_t)15);
+    if (size<=(*r).len-(*r).pos)
     {
-        memset(j, 0, sizeof(JSON_STRUCT));
+        void *p=(*r).m+(*r).pos;
+        (*r).pos+=size;
+        return(p);
     }
-    return(j);
+    if ((*r).overflow==JSON_ARENA_MALLOC)
+        return(malloc(size));
+    return(NULL);
+}
+
+
+void JSON_arenaFree(void *p, size_t size, void *user)
+{
+    JSON_ARENA *r=(JSON_ARENA*)user;
+    char *c=(char*)p;
+    size=(size+15)&~((size_t)15);
+    if (c<(*r).m || c>=(*r).m+(*r).len)
+        free(p);                    //  Overflow
+    else if (c+size==(*r).m+(*r).pos)
+        (*r).pos-=size;             //  The last one handed out
+    return;
+}
+
+//  Size of the next chunk:  twice the last one, up to the maximum.
+int64_t JSON_chunkSize(JSON_STRUCT *j, int64_t last, int64_t first)
+{
+    int64_t max=(*j).chunkMax;
+    if (max<=0)
+        max=JSON_CHUNK_MAX;
+    if (last<first)
+        return(first);
+    last*=2;
+    if (last>max)
+        last=max;
+    if (last<first)
+        last=first;
+    return(last);
 }
 
-//  This allocates swaths of new nodes.  The first node in an
-//  allocation sequence has the 7th bit set in the flag field.
-//  On breakdown, this flag is used to decide what to 'free' new nodes.  The first node in an
-//  allocation sequence has the 7th bit set in the flag field.
-//  On breakdown, this flag is used to decide what to 'free'
+
+//  This hands out nodes:  first the ones that were freed individually,
+//  then the next one from the current chunk.  When that chunk is used
+//  up, move on to the next chunk (left over from before a flush), or
+//  allocate a new one.
 JSON_NODE *JSON_newNode(JSON_STRUCT *j)
 {
     JSON_NODE *n;
-    if ((*j).freeStack==NULL)
+    JSON_NODES *c=(*j).nodeChunk;
+
+    n=(*j).freeStack;
+    if (n)
+        (*j).freeStack=(*n).next;
+    else
     {
-        //  Allocation
-        JSON_NODE *f;
-        n=(JSON_NODE*)malloc(JSON_ALLOC_CNT_NODE*sizeof(JSON_NODE));
-        if (n)
+        if (c==NULL || (*c).pos==(*c).cnt)
         {
-            int i;
-            f=n;    //  Remember the first one
-            for (i=0; i<JSON_ALLOC_CNT_NODE; i+=1)
+            if (c && (*c).next)
+                c=(*c).next;
+            else
             {
-                n[i].f=0;
-                n[i].next=(*j).freeStack;
-                (*j).freeStack=&(n[i]);
+                //  Allocation, appended after the current one:
+                int64_t first=JSON_NODES_SIZE(JSON_ALLOC_CNT_NODE);
+                int64_t size=JSON_chunkSize(j, (*j).nodeBytes, first);
+                int cnt=(size-sizeof(JSON_NODES))/sizeof(JSON_NODE);
+                JSON_NODES *a=(JSON_NODES*)JSON_alloc(j, JSON_NODES_SIZE(cnt));
+                if (a==NULL && size>first)
+                {
+                    //  Maybe a small one still fits:
+                    size=first;
+                    cnt=JSON_ALLOC_CNT_NODE;
+                    a=(JSON_NODES*)JSON_alloc(j, JSON_NODES_SIZE(cnt));
+                }
+                while (a==NULL && cnt>1)
+                {
+                    //  Or a smaller one yet, in what is left of an arena:
+                    cnt/=2;
+                    size=JSON_NODES_SIZE(cnt);
+                    a=(JSON_NODES*)JSON_alloc(j, size);
+                }
+                if (a==NULL)
+                    return(NULL);
+                (*a).cnt=cnt;
+                (*j).nodeBytes=size;
+                if (c)
+                {
+                    (*a).next=(*c).next;
+                    (*c).next=a;
+                }
+                else
+                {
+                    (*a).next=NULL;
+                    (*j).nodes=a;
+                }
+                c=a;
             }
-            //  Mark this one as the first in the allocation sequence:
-            (*f).f=JSON_FLG_1ST;
+            (*c).pos=0;
+            (*j).nodeChunk=c;
         }
+        n=&((*c).n[(*c).pos]);
+        (*c).pos+=1;
     }
 
-    //  Now get one and clear it:
-    n=(*j).freeStack;
-    if (n)
+    //  Clear it:
+    (*n).next=NULL;
+    (*n).label=NULL;
+    (*n).f=0;
+    (*n).cnt=0;
+    (*n).value.string=NULL;     //  Clears the union
+    (*n).last=NULL;
+
+    return(n);
+}
+
+
+//  Size of string class 'c':  8, 16, 24, ... 256 bytes, and then
+//  alternating steps of 1.5 and 1.33, ie. 384, 512, 768, 1024, ...
+int JSON_stringClassSize(int c)
+{
+    int size;
+    if (c<32)
+        return((c+1)*JSON_STRING_ALIGN);
+    c-=32;
+    size=((c&1)?512:384)<<(c>>1);
+    if (size>JSON_ALLOC_CNT_CHAR)
+        size=JSON_ALLOC_CNT_CHAR;
+    return(size);
+}
+
+//  The smallest class that holds 'size' bytes:
+int JSON_stringClass(int size)
+{
+    int c;
+    if (size<=32*JSON_STRING_ALIGN)
+        return((size+JSON_STRING_ALIGN-1)/JSON_STRING_ALIGN-1);
+    c=32;
+    while (JSON_stringClassSize(c)<size)
+        c+=1;
+    return(c);
+}
+
+
+int JSON_compactFind(JSON_COMPACT *c, char *s);
+
+void JSON_freeString(JSON_STRUCT *j, char *s)
+{
+    JSON_SPAN *f=(JSON_SPAN*)s;
+    int c;
+
+    if (s==NULL)
+        return;
+
+    //  Spans in a chunk that a compaction is emptying are not re-used:
+    if ((*j).compact && (*(*j).compact).phase==2)
     {
-        (*j).freeStack=(*n).next;
-        (*n).next=NULL;
-        (*n).label=NULL;
-        (*n).f&=JSON_FLG_1ST;       //  Clears every flag, except the allocation flag.
-        (*n).value.string=NULL;     //  Clears the union
+        c=JSON_compactFind((*j).compact, s);
+        if (c>=0 && (*(*j).compact).evac[c])
+            return;
     }
 
-    return(n);
+    //  The span was rounded up to a class size at least as big as this:
+    c=JSON_stringClass(strlen(s)+1);
+    (*f).next=(*j).freeStrings[c];
+    (*j).freeStrings[c]=f;
+    return;
+}
+
+
+int JSON_compactFindNode(JSON_COMPACT *c, JSON_NODE *n);
+
+//  The same for a node, onto the free stack:
+void JSON_freeNode(JSON_STRUCT *j, JSON_NODE *n)
+{
+    if ((*j).compact && (*(*j).compact).phase==2)
+    {
+        int c=JSON_compactFindNode((*j).compact, n);
+        if (c>=0 && (*(*j).compact).nodeEvac[c])
+            return;
+    }
+    (*n).next=(*j).freeStack;
+    (*j).freeStack=n;
+    return;
 }
 
 
@@ -1040,6 +3427,8 @@ char *JSON_newString(JSON_STRUCT *j, int len)
 {
     char *s=NULL;
     JSON_STRING *p, *c;
+    JSON_SPAN *f;
+    int size, k;
     len+=1;
 
         //
@@ -1051,6 +3440,21 @@ char *JSON_newString(JSON_STRUCT *j, int len)
     if (len>JSON_ALLOC_CNT_CHAR)
         return(NULL);
 
+        //
+        //  Spans are rounded up to their size class.  A freed
+        //  span of that class is used before any new space.
+        //
+    k=JSON_stringClass(len);
+    size=JSON_stringClassSize(k);
+    f=(*j).freeStrings[k];
+    if (f)
+    {
+        (*j).freeStrings[k]=(*f).next;
+        s=(char*)f;
+        s[len-1]='\0';
+        return(s);
+    }
+
         //
         //  First, iterate to see if any of the string pools have a
         //  sufficiently large swath available to hold this string.
@@ -1060,12 +3464,12 @@ char *JSON_newString(JSON_STRUCT *j, int len)
     while (c!=NULL && s==NULL)
     {
         //  Can this pool hold the string?
-        if ((*c).pos+len<=JSON_ALLOC_CNT_CHAR)
+        if ((*c).pos+size<=(*c).len)
         {
             //  Found a spot!
             s=&((*c).m[(*c).pos]);
             s[len-1]='\0';      //  Safety, null-terminate.
-            (*c).pos+=len;
+            (*c).pos+=size;
         }
         else
         {
@@ -1082,13 +3486,31 @@ char *JSON_newString(JSON_STRUCT *j, int len)
         //
     if (s==NULL)
     {
-        c=(JSON_STRING*)malloc(sizeof(JSON_STRING));
+        int64_t first=JSON_STRING_SIZE(JSON_ALLOC_CNT_CHAR);
+        int64_t bytes=JSON_chunkSize(j, (*j).stringBytes, first);
+        c=(JSON_STRING*)JSON_alloc(j, bytes);
+        if (c==NULL && bytes>first)
+        {
+            //  Maybe a small one still fits:
+            bytes=first;
+            c=(JSON_STRING*)JSON_alloc(j, bytes);
+        }
+        while (c==NULL && bytes/2>=(int64_t)JSON_STRING_SIZE(size))
+        {
+            //  Or a smaller one yet, as long as this string fits, in what
+            //  is left of an arena:
+            bytes/=2;
+            c=(JSON_STRING*)JSON_alloc(j, bytes);
+        }
         if (c)
         {
+            (*c).len=bytes-sizeof(JSON_STRING);
+            (*j).stringBytes=bytes;
+
             //  First save 's'
             s=(*c).m;
             s[len-1]='\0';
-            (*c).pos=len;
+            (*c).pos=size;
             //  Now stich it in at the end:
             if (p)
             {
@@ -1113,7 +3535,7 @@ char *JSON_newString(JSON_STRUCT *j, int len)
         //
     if (s!=NULL && c!=NULL)
     {
-        if ((*c).pos+JSON_STRING_RETIREMENT>JSON_ALLOC_CNT_CHAR)
+        if ((*c).pos+JSON_STRING_RETIREMENT>(*c).len)
         {
             //  Retirement of this string pool object:
             //  Unstitch
@@ -1129,7 +3551,7 @@ char *JSON_newString(JSON_STRUCT *j, int len)
         {
             //  Test if a sort must be performed.  If the previous node
             //  has more free space left, then take it out, and insert-sort
-            if ((*p).pos<(*c).pos)
+            if ((*p).len-(*p).pos>(*c).len-(*c).pos)
             {
                 JSON_STRING *q;     //  Temporary iterator
                 //  Unstitch
@@ -1141,7 +3563,7 @@ char *JSON_newString(JSON_STRUCT *j, int len)
                 {
                     //  'c' has less space left than 'q', so
                     //  needs to come before q:
-                    if ((*c).pos>(*q).pos)
+                    if ((*c).len-(*c).pos<(*q).len-(*q).pos)
                     {
                         (*c).next=q;
                         if (p)
@@ -1216,15 +3638,21 @@ void JSON_walk(JSON_STRUCT *j, int (*callback)(int cmd, int c, int d, char *s, d
             //  is given throught he OLBL call, and set to 0 for the actual value.
             if ((*c).f&JSON_FLG_LBL)
             {
-                callback(JSON_CMD_VAL_OLBL, rank[top], top, (*c).label, 0, user);
+                callback(JSON_CMD_VAL_OLBL|(((*c).f&JSON_FLG_LTXT)?JSON_CMD_VAL_TXT:0), rank[top], top, (*c).label, 0, user);
                 r=0;
             }
 
             //  These are exclusive:
-            if ((*c).f&JSON_FLG_NUM)
+            if ((*c).f&JSON_FLG_INT)
+                callback(JSON_CMD_VAL_NUM|JSON_CMD_VAL_INT, r, top, (char*)&(*c).value.i, (double)(*c).value.i, user);
+            else if ((*c).f&JSON_FLG_UINT)
+                callback(JSON_CMD_VAL_NUM|JSON_CMD_VAL_UINT, r, top, (char*)&(*c).value.u, (double)(*c).value.u, user);
+            else if ((*c).f&JSON_FLG_RAW)
+                callback(JSON_CMD_VAL_NUM|JSON_CMD_VAL_RAW, r, top, (*c).value.string, 0, user);
+            else if ((*c).f&JSON_FLG_NUM)
                 callback(JSON_CMD_VAL_NUM, r, top, NULL, (*c).value.num, user);
             else if ((*c).f&JSON_FLG_STR)
-                callback(JSON_CMD_VAL_STR, r, top, (*c).value.string, 0, user);
+                callback(JSON_CMD_VAL_STR|(((*c).f&JSON_FLG_TXT)?JSON_CMD_VAL_TXT:0), r, top, (*c).value.string, 0, user);
             else if ((*c).f&JSON_FLG_SYM)
                 callback(JSON_CMD_VAL_SYM, r, top, NULL, (*c).value.num, user);
             else if ((*c).f&JSON_FLG_ARR)
@@ -1295,17 +3723,38 @@ void JSON_walk(JSON_STRUCT *j, int (*callback)(int cmd, int c, int d, char *s, d
 }
 
 
+//  To memory, exactly sized:
+char *JSON_sprint(JSON_STRUCT *j, int64_t *len)
+{
+    JSON_OUT o;
+    int64_t size=0;
+    char *buf;
+
+    JSON_walk(j, JSON_printSize, &size);
+    buf=(char*)malloc(size+1);
+    if (buf==NULL)
+        return(NULL);
+
+    //  It all fits, the sink never flushes:
+    JSON_outInit(&o, NULL, -1, buf, size+1);
+    JSON_walk(j, JSON_printOut, &o);
+    buf[o.len]=0;
+    if (len)
+        (*len)=o.len;
+    return(buf);
+}
+
+
 
 //
-//  JSON_parse callback, reading into memory.
-//  Structural error checking is expected to be performed by the parse method.
+//  One event into the tree of 'j', for 'JSON_read' and 'JSON_readBatch'
+//  both.  'len' is the length of 'str', and for an integer 'str' points
+//  at the value.  Returns 0, or JSON_ERR_MEM.
 //
-int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
+static inline int JSON_readEvent(JSON_STRUCT *j, int cmd, char *str, int len, double num)
 {
-    JSON_STRUCT *j=(JSON_STRUCT*)user;
     JSON_NODE *p=NULL;
     JSON_NODE *n=NULL;
-    int len;
 
     //
     //  First, determine the stitching of the data structure
@@ -1338,6 +3787,8 @@ int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
             if (n)
             {
                 (*p).value.child=n;
+                (*p).last=n;
+                (*p).cnt=1;
                 (*j).stack[(*j).top]=n;
                 (*j).top+=1;
             }
@@ -1353,11 +3804,18 @@ int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
         else
         {
             //  Top is no special condition.  Add this to the 'next' pointer,
-            //  and create a new node:
+            //  and create a new node.  The parent is one below on the stack,
+            //  unless this is a root value, whose siblings have no parent.
             n=JSON_newNode(j);
             if (n)
             {
                 (*p).next=n;
+                if ((*j).top>1)
+                {
+                    JSON_NODE *c=(*j).stack[(*j).top-2];
+                    (*c).last=n;
+                    (*c).cnt+=1;
+                }
                 (*j).stack[(*j).top-1]=n;
             }
             else
@@ -1386,9 +3844,7 @@ int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
     //  At this point, there is a node 'n'.
     //  Fill in the value:
     //
-    if (str)
-        len=strlen(str);
-    switch(cmd)
+    switch(cmd&0xFF)
     {
         case JSON_CMD_NEW_ARRAY:
             (*n).f|=JSON_FLG_ARR;
@@ -1397,24 +3853,45 @@ int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
             (*n).f|=JSON_FLG_OBJ;
             break;
         case JSON_CMD_VAL_OLBL:
-            (*n).f|=JSON_FLG_LBL;
             (*n).label=JSON_newString(j, len);
-            if ((*n).label)
-                strncpy((*n).label, str, len);
-            else
+            if ((*n).label==NULL)
                 return(JSON_ERR_MEM);
+            strncpy((*n).label, str, len);
+            (*n).f|=JSON_FLG_LBL;
+            if (cmd&JSON_CMD_VAL_TXT)
+                (*n).f|=JSON_FLG_LTXT;
             break;
         case JSON_CMD_VAL_NUM:
             (*n).f|=JSON_FLG_NUM;
-            (*n).value.num=num;
+            if (cmd&JSON_CMD_VAL_INT)
+            {
+                (*n).f|=JSON_FLG_INT;
+                (*n).value.i=*(int64_t*)str;
+            }
+            else if (cmd&JSON_CMD_VAL_UINT)
+            {
+                (*n).f|=JSON_FLG_UINT;
+                (*n).value.u=*(u_int64_t*)str;
+            }
+            else if (cmd&JSON_CMD_VAL_RAW)
+            {
+                (*n).value.string=JSON_newString(j, len);
+                if ((*n).value.string==NULL)
+                    return(JSON_ERR_MEM);
+                strncpy((*n).value.string, str, len);
+                (*n).f|=JSON_FLG_RAW;
+            }
+            else
+                (*n).value.num=num;
             break;
         case JSON_CMD_VAL_STR:
-            (*n).f|=JSON_FLG_STR;
             (*n).value.string=JSON_newString(j, len);
-            if ((*n).value.string)
-                strncpy((*n).value.string, str, len);
-            else
+            if ((*n).value.string==NULL)
                 return(JSON_ERR_MEM);
+            strncpy((*n).value.string, str, len);
+            (*n).f|=JSON_FLG_STR;
+            if (cmd&JSON_CMD_VAL_TXT)
+                (*n).f|=JSON_FLG_TXT;
             break;
         case JSON_CMD_VAL_SYM:
             (*n).f|=JSON_FLG_SYM;
@@ -1426,6 +3903,43 @@ int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
 }
 
 
+//
+//  JSON_parse callback, reading into memory.
+//  Structural error checking is expected to be performed by the parse method.
+//
+int JSON_read(int cmd, int count, int depth, char *str, double num, void *user)
+{
+    int len=0;
+
+    //  (For an integer, 'str' is the value.)
+    if (str && !(cmd&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT)))
+        len=strlen(str);
+    return(JSON_readEvent((JSON_STRUCT*)user, cmd, str, len, num));
+}
+
+
+//
+//  The same for a batch of events from a tape, which has the string
+//  lengths already.  An integer is in the event itself.
+//
+int JSON_readBatch(JSON_EVENT *e, int cnt, void *user)
+{
+    JSON_STRUCT *j=(JSON_STRUCT*)user;
+    int i, rc;
+
+    for (i=0; i<cnt; i+=1)
+    {
+        char *str=e[i].v.s;
+        if (e[i].cmd&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT))
+            str=(char*)&(e[i].v);
+        rc=JSON_readEvent(j, e[i].cmd, str, e[i].len, e[i].v.n);
+        if (rc<0)
+            return(rc);
+    }
+    return(0);
+}
+
+
 
 
 /************************************************************************
@@ -1452,166 +3966,166 @@ int JSON_flattenPrintInit(JSON_FLATTEN_CONF *c, FILE *str, char *buf, int len)
 }
 
 
-//  Accomodating for both character buffer and stream printing:
-int JSON_flattenPrint(int cmd, int r, int d, char *s, double n, void *user)
+int JSON_flattenPrintInitOut(JSON_FLATTEN_CONF *c, JSON_OUT *out)
 {
-    JSON_FLATTEN_CONF *c=(JSON_FLATTEN_CONF*)user;
-    int i;
+    memset(c, 0, sizeof(JSON_FLATTEN_CONF));
+    (*c).out=out;
+    return(0);
+}
+
 
-    //  Rank of this one in a sequence:
-    if (d>0)
+//  To the sink, or else to the buffer as far as it fits:
+void JSON_flattenWrite(JSON_FLATTEN_CONF *c, JSON_OUT *o, const char *s, int len)
+{
+    if (o)
+        JSON_outWrite(o, s, len);
+    else if ((*c).buf)
     {
-        (*c).index[d-1]=r;
-        if (cmd&JSON_CMD_VAL_OLBL)
+        if ((*c).pos<(*c).len)
         {
-            (*c).strStack[d-1]=s;
+            int m=(*c).len-1-(*c).pos;
+            if (m>len)
+                m=len;
+            memcpy((*c).buf+(*c).pos, s, m);
+            (*c).buf[(*c).pos+m]=0;
         }
+        (*c).pos+=len;
     }
+    return;
+}
 
-    //  Print the prior stack:
-    if (/*d>0 && */cmd&(JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM))
-    {
-        //  Print:
-        if ((*c).str) fprintf((*c).str, "\"");
-        else
+
+//  A string, escaped if it is plain text:
+void JSON_flattenString(JSON_FLATTEN_CONF *c, JSON_OUT *o, int cmd, const char *s)
+{
+    int len=strlen(s);
+    int k;
+    char b[6];
+
+    if (cmd&JSON_CMD_VAL_TXT)
+        while ((k=JSON_escSpan(s, len))<len)
         {
-            (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "\"");
-            if ((*c).rc>=0) (*c).pos+=(*c).rc;
+            JSON_flattenWrite(c, o, s, k);
+            JSON_flattenWrite(c, o, b, JSON_escChar(b, (unsigned char)s[k]));
+            s+=k+1;
+            len-=k+1;
         }
-        //  Logic:
-        for (i=0; i<d; i+=1)
+    JSON_flattenWrite(c, o, s, len);
+    return;
+}
+
+
+//  Accomodating for both character buffer and stream printing:
+int JSON_flattenPrint(int cmd, int r, int d, char *s, double n, void *user)
+{
+    JSON_FLATTEN_CONF *c=(JSON_FLATTEN_CONF*)user;
+    char buf[512];
+    JSON_OUT t;
+    JSON_OUT *o;
+
+    if (d>=JSON_MAX_DEPTH)
+    {
+        (*c).rc=JSON_ERR_DEPTH;
+        return((*c).rc);
+    }
+
+    //  The level of this one in the path:  a label is set once, by the
+    //  label, an index for each item in an array.  Only that part after
+    //  the path of the level above is replaced.
+    if (d>0 && !(cmd&(JSON_CMD_END_ARRAY|JSON_CMD_END_OBJ)))
+    {
+        int k=d-1;
+        if (cmd&JSON_CMD_VAL_OLBL)
+            (*c).lbl[k]=1;
+        if ((cmd&JSON_CMD_VAL_OLBL) || !(*c).lbl[k])
         {
-            if ((*c).strStack[i]!=NULL)
+            char x[JSON_NUM_LEN];
+            char *p=s;
+            int e=(*c).end[k];
+            int m;
+
+            if (cmd&JSON_CMD_VAL_OLBL)
+                m=(cmd&JSON_CMD_VAL_TXT)?JSON_escLen(s, strlen(s)):(int64_t)strlen(s);
+            else
             {
-                    //  Print:
-                if ((*c).str) fprintf((*c).str, "%s", (*c).strStack[i]);
-                else
-                {
-                    (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "%s", (*c).strStack[i]);
-                    if ((*c).rc>=0) (*c).pos+=(*c).rc;
-                }
+                x[0]='[';
+                m=1+JSON_itoa(x+1, r);
+                x[m++]=']';
+                p=x;
             }
-            else
+            if (e+1+m>JSON_FLATTEN_PATH)
             {
-                    //  Print:
-                if ((*c).str) fprintf((*c).str, "[%i]", (*c).index[i]);
-                else
-                {
-                    (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "[%i]", (*c).index[i]);
-                    if ((*c).rc>=0) (*c).pos+=(*c).rc;
-                }
+                (*c).rc=JSON_ERR_LEN;
+                return((*c).rc);
             }
 
-            //  This is purely easthetic:  remove the dot before the array index
+            //  This is purely easthetic:  no dot before the array index
             //  when previous layer is an object label.
-            if (i<d-1)
-                if ((*c).strStack[i]==NULL||(*c).strStack[i+1]!=NULL)
-                {
-                    //  Print:
-                    if ((*c).str) fprintf((*c).str, ".");
-                    else
-                    {
-                        (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ".");
-                        if ((*c).rc>=0) (*c).pos+=(*c).rc;
-                    }
-                }
-        }
-        //  Print:
-        if ((*c).str) fprintf((*c).str, "\"");
-        else
-        {
-            (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, "\"");
-            if ((*c).rc>=0) (*c).pos+=(*c).rc;
+            if (k>0 && !((*c).lbl[k-1] && !(*c).lbl[k]))
+                (*c).path[e++]='.';
+            if ((cmd&JSON_CMD_VAL_OLBL) && (cmd&JSON_CMD_VAL_TXT))
+                JSON_escCopy((*c).path+e, p, strlen(p));
+            else
+                memcpy((*c).path+e, p, m);
+            (*c).end[d]=e+m;
         }
     }
-
-    //  All possible commands:
     if (cmd&JSON_CMD_NEW_ARRAY)
-    {
-        (*c).strStack[d]=NULL;
-    }
-    /*
+        (*c).lbl[d]=0;
     if (cmd&JSON_CMD_NEW_OBJ)
+        (*c).lbl[d]=1;
+
+    //  Values are printed with their path:
+    if (!(cmd&(JSON_CMD_VAL_NUM|JSON_CMD_VAL_STR|JSON_CMD_VAL_SYM)))
+        return(0);
+    o=(*c).out;
+    if (o==NULL && (*c).str)
     {
-        ///(*c).index[d]=-1;
+        //  One write per value:
+        JSON_outInit(&t, (*c).str, -1, buf, sizeof(buf));
+        o=&t;
     }
-    */
+    JSON_flattenWrite(c, o, "\"", 1);
+    JSON_flattenWrite(c, o, (*c).path, (*c).end[d]);
+    JSON_flattenWrite(c, o, "\":", 2);
     if (cmd&JSON_CMD_VAL_NUM)
     {
-        //  Rudimentary 'floor' method to see if the value is true 'int'
-        if ((double)((long long int)n)==n)
-        {
-            //  Print:
-            if ((*c).str) fprintf((*c).str, ":%lli\n", (long long int) n);
-            else
-            {
-                (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":%lli\n", (long long int) n);
-                if ((*c).rc>=0) (*c).pos+=(*c).rc;
-            }
-        }
+        char b[JSON_NUM_LEN];
+        if (cmd&JSON_CMD_VAL_RAW)
+            JSON_flattenWrite(c, o, s, strlen(s));
         else
-        {
-            //  Print:
-            if ((*c).str) fprintf((*c).str, ":%f\n", n);
-            else
-            {
-                (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":%f\n", n);
-                if ((*c).rc>=0) (*c).pos+=(*c).rc;
-            }
-        }
+            JSON_flattenWrite(c, o, b, JSON_numtoa(b, cmd, s, n));
     }
     if (cmd&JSON_CMD_VAL_STR)
     {
-        //  Print:
-        if ((*c).str) fprintf((*c).str, ":\"%s\"\n", s);
-        else
-        {
-            (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":\"%s\"\n", s);
-            if ((*c).rc>=0) (*c).pos+=(*c).rc;
-        }
+        JSON_flattenWrite(c, o, "\"", 1);
+        JSON_flattenString(c, o, cmd, s);
+        JSON_flattenWrite(c, o, "\"", 1);
     }
     if (cmd&JSON_CMD_VAL_SYM)
     {
         if ((int)n==JSON_SYM_TRUE)
-        {
-            //  Print:
-            if ((*c).str) fprintf((*c).str, ":true\n");
-            else
-            {
-                (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":true\n");
-                if ((*c).rc>=0) (*c).pos+=(*c).rc;
-            }
-        }
+            JSON_flattenWrite(c, o, "true", 4);
         else if ((int)n==JSON_SYM_FALSE)
-        {
-            //  Print:
-            if ((*c).str) fprintf((*c).str, ":false\n");
-            else
-            {
-                (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":false\n");
-                if ((*c).rc>=0) (*c).pos+=(*c).rc;
-            }
-        }
+            JSON_flattenWrite(c, o, "false", 5);
         else
-        {
-            //  Print:
-            if ((*c).str) fprintf((*c).str, ":null\n");
-            else
-            {
-                (*c).rc=snprintf(&(*c).buf[(*c).pos], (*c).len-(*c).pos, ":null\n");
-                if ((*c).rc>=0) (*c).pos+=(*c).rc;
-            }
-        }
-    }
-    /*
-    if (cmd&JSON_CMD_END_OBJ)
-    {    
+            JSON_flattenWrite(c, o, "null", 4);
     }
-    if (cmd&JSON_CMD_END_ARRAY)
+    JSON_flattenWrite(c, o, "\n", 1);
+    if (o==&t)
+        JSON_outFlush(&t);
+    return(0);
+}
+
+
+//  The same for a batch of events:
+int JSON_flattenPrintBatch(JSON_EVENT *e, int cnt, void *user)
+{
+    int i;
+    for (i=0; i<cnt; i+=1)
     {
+        JSON_flattenPrint(e[i].cmd, e[i].r, e[i].d, JSON_EVENT_S(e[i]), JSON_EVENT_N(e[i]), user);
     }
-    */
-
     return(0);
 }
 
@@ -1705,14 +4219,23 @@ int JSON_flattenPrint(int cmd, int r, int d, char *s, double n, void *user)
 //
 //  Parser for flattened JSON back into structure
 //
-int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
+//  Consecutive lines mostly share a long path prefix ("a.b[3].c" is
+//  followed by "a.b[3].d" or "a.b[4].c"), so the previous path is kept
+//  in 'last' with the end of every label in it.  A new path is first
+//  compared against it, and every level whose label ends inside the
+//  common prefix is known to be unchanged.  Only the rest of the path
+//  is split into labels, and only that part closes and opens levels.
+//
+int JSON_flattenParseInt(JSON_PARSER *d, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
 {
     int c=0;
     int n=0;
     int m=0;
     int top=-1;                     //  Current label stack depth
-    char labelSpace[JSON_MAX_LEN];  //  This is the current label stack
-    char *labels[JSON_MAX_DEPTH];   //  Starting position in the label stack 'l'
+    char last[JSON_MAX_LEN];        //  The previous path, as it was read
+    int lastLen=0;                  //  Its length
+    int lastDepth=0;                //  The number of labels in it
+    int ends[JSON_MAX_DEPTH];       //  Where each label ends in 'last' (and in 's' while it matches)
     int8_t types[JSON_MAX_DEPTH];   //  Type of object (JSON_FLG_OBJ or JSON_FLG_ARR)
     int ranks[JSON_MAX_DEPTH];      //  Counts the number of elements in an object or array
 
@@ -1724,9 +4247,9 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
     {
         int depth=0;    //  Depth of the parsed label stack
         int pos=0;
-        int pStart=0;   //  Save the position where a label starts -- this is used in 'labelSpace' again
         int len=0;
         int rank=0;
+        int same=0;     //  Length of the prefix shared with the previous path
         char s[JSON_MAX_LEN];
         char *label;
         int8_t type=JSON_FLG_OBJ;
@@ -1741,17 +4264,49 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
             return(m);
         n+=m;
 
-            //  Parse out the label:
             //  Reduce by 2 (quotes are removed)
         m-=2;
+
+        //
+        //  Find the shared prefix, a word at a time, then the labels that
+        //  lie entirely inside of it.  A label is only the same if the new
+        //  path also ends it there, and not with "a.bc" after "a.b".
+        //
+        {
+            int l=(m<lastLen)?m:lastLen;
+            while (same+8<=l)
+            {
+                u_int64_t x;
+                u_int64_t y;
+                memcpy(&x, &s[same], 8);
+                memcpy(&y, &last[same], 8);
+                if (x!=y)
+                    break;
+                same+=8;
+            }
+            while (same<l && s[same]==last[same])
+                same+=1;
+        }
+        while (depth<lastDepth && depth<=top && ends[depth]<=same)
+        {
+            char t=s[ends[depth]];
+            if (t!='.' && t!='[' && t!=']' && t!='\0')
+                break;
+            depth+=1;
+        }
+            //  Resume splitting right after the last matching label.  Only the
+            //  part that differs needs to be kept for the next line:
+        if (depth>0)
+            pos=ends[depth-1];
+        memcpy(&last[same], &s[same], m-same+1);
+        lastLen=m;
+
+            //  Parse out the rest of the labels:
         while(pos<m)
         {
             //  Record the start of a label:
             if (len==0)
-            {
                 label=&s[pos];
-                pStart=pos;     //  Since labelSpace and 's' are identical, save this position.
-            }
             //  Next level
             if (s[pos]=='.' || s[pos]=='[' || s[pos]==']' || pos==m-1)
             {
@@ -1771,44 +4326,31 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
                     //
                     if (depth<=top)
                     {
-                        //  Compare this label or array with the current top.  Back out if
-                        //  there's no match, in which case top<depth, and the 'new' clause
-                        //  below will activate.
-                        //  On full path match, the value is simply added.
-                        int l2=strlen(labels[depth]);
-                        if (type==types[depth] && len==l2 && strncmp(label, labels[depth], len)==0)
+                        //  All the levels that match were skipped above, so this
+                        //  is a different label or array index at this level:
+                        //  back out of the deeper levels first.
+                        while (top>depth)
                         {
-                            //  Match!
-                            //  Do nothing.
-                        }
-                        else
-                        {
-                            //  At this point if there's a type mismatch, we must backtrack:
-                            while (top>depth)
-                            {
-                                //  Determine the rank in the parent structure:
-                                if (top>0)
-                                    rank=ranks[top-1];
-                                else
-                                    rank=0;
-                                //  Close the object or array:
-                                if (types[top]==JSON_FLG_OBJ)
-                                    callback(JSON_CMD_END_OBJ, rank, top, NULL, 0, user);
-                                else
-                                    callback(JSON_CMD_END_ARRAY, rank, top, NULL, 0, user);
-                                top-=1;
-                            }
-                            //  This is the case where the element under consideration is the
-                            //  next label in an object or the next value in an array:
-                            //  Now add +1 to rank
-                            strncpy(&(labelSpace[pStart]), label, len+1);
-                            labels[top]=&(labelSpace[pStart]);
-                            ranks[top]+=1;
-                            if (type==JSON_FLG_OBJ)
-                                callback(JSON_CMD_VAL_OLBL, ranks[top], depth+1, label, 0, user);
+                            //  Determine the rank in the parent structure:
+                            if (top>0)
+                                rank=ranks[top-1];
+                            else
+                                rank=0;
+                            //  Close the object or array:
+                            if (types[top]==JSON_FLG_OBJ)
+                                JSON_CALL(callback(JSON_CMD_END_OBJ, rank, top, NULL, 0, user));
+                            else
+                                JSON_CALL(callback(JSON_CMD_END_ARRAY, rank, top, NULL, 0, user));
+                            top-=1;
                         }
+                        //  This is the case where the element under consideration is the
+                        //  next label in an object or the next value in an array:
+                        //  Now add +1 to rank
+                        ranks[top]+=1;
+                        if (type==JSON_FLG_OBJ)
+                            JSON_CALL(callback(JSON_CMD_VAL_OLBL, ranks[top], depth+1, label, 0, user));
                     }
-                    if (depth>top)
+                    else
                     {
                         if (top<0)
                             rank=0;
@@ -1818,27 +4360,23 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
                         if (type==JSON_FLG_OBJ)
                         {
                             //  Object start, announce new label
-                            callback(JSON_CMD_NEW_OBJ, rank, depth, NULL, 0, user);
-                            callback(JSON_CMD_VAL_OLBL, 0, depth+1, label, 0, user);
+                            JSON_CALL(callback(JSON_CMD_NEW_OBJ, rank, depth, NULL, 0, user));
+                            JSON_CALL(callback(JSON_CMD_VAL_OLBL, 0, depth+1, label, 0, user));
                         }
                         else
                         {
                             //  Array start:
-                            callback(JSON_CMD_NEW_ARRAY, rank, depth, NULL, 0, user);
+                            JSON_CALL(callback(JSON_CMD_NEW_ARRAY, rank, depth, NULL, 0, user));
                         }
-                        //  Store label and type on the stack
-                        //  (Note that the array index is stored but not used)
+                        //  Store the type on the stack
                         top+=1;
                         if (top>=JSON_MAX_DEPTH)
                             return(JSON_ERR_DEPTH);
-                            //  'pStart' is the same position in the character array as it
-                            //  is in 's', because 's' and 'labelSpace' are identical after
-                            //  this operation.  This copies the null-termination char as well:
-                        strncpy(&(labelSpace[pStart]), label, len+1);
-                        labels[top]=&(labelSpace[pStart]);
                         types[top]=type;
                         ranks[top]=0;
                     }
+                    //  Where this label ends in the path:
+                    ends[depth]=(t=='.' || t=='[' || t==']')?pos:pos+1;
 
 
                     //  Reset:
@@ -1854,6 +4392,7 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
 
             pos+=1;
         }
+        lastDepth=depth;
 
 
         //  
@@ -1899,102 +4438,390 @@ int JSON_flattenParseInt(JSON_DATA *d, int (*callback)(int cmd, int c, int d, ch
             rank=ranks[top-1];
         //  Call the closing array or object:
         if (types[top]==JSON_FLG_OBJ)
-            callback(JSON_CMD_END_OBJ, rank, top, NULL, 0, user);
+            JSON_CALL(callback(JSON_CMD_END_OBJ, rank, top, NULL, 0, user));
         else
-            callback(JSON_CMD_END_ARRAY, rank, top, NULL, 0, user);
+            JSON_CALL(callback(JSON_CMD_END_ARRAY, rank, top, NULL, 0, user));
         top-=1;
     }
 
-    return(n);
+    return(n);
+}
+
+
+
+int JSON_flattenParse(FILE *str, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
+{
+    JSON_PARSER d;
+    int rc;
+    JSON_parserLock(&d, str);
+    rc=JSON_flattenParseInt(&d, callback, user);
+    JSON_parserUnlock(&d);
+    return(rc);
+}
+
+
+int JSON_flattenParseMem(char *buf, int len, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
+{
+    JSON_PARSER d;
+    JSON_parserMem(&d, buf, len);
+    return(JSON_flattenParseInt(&d, callback, user));
+}
+
+
+/************************************************************************
+ *                                                                      *
+ *    Cloning and cleaning                                              *
+ *                                                                      *
+ ************************************************************************/
+
+
+//  Strings of flushed nodes are returned to the pool, but the pool
+//  itself only grows.  After a large part of a JSON object has been
+//  deleted, simply create a new JSON_STRUCT and clone the current
+//  JSON structures into it, discard the old one.
+
+
+
+//  Temporary routine to just print a value:
+//  DO NOT USE
+/*
+void JSON_debugPrintValStr(char *str, JSON_NODE *n)
+{
+    if (n==NULL)
+        fprintf(stdout, "%s NULL\n", str);
+    else if ((*n).f&JSON_FLG_NUM)
+        fprintf(stdout, "%s %f\n", str, (*n).value.num);
+    else if ((*n).f&JSON_FLG_STR)
+        fprintf(stdout, "%s %s\n", str, (*n).value.string);
+    else if ((*n).f&JSON_FLG_SYM)
+    {
+        if ((*n).value.num==JSON_SYM_TRUE)
+            fprintf(stdout, "%s true\n", str);
+        else if ((*n).value.num==JSON_SYM_FALSE)
+            fprintf(stdout, "%s false\n", str);
+        else
+            fprintf(stdout, "%s null\n", str);
+    }
+    else
+        fprintf(stdout, "%s COMPOUND: %s\n", str, (*n).label);    //  It is compound like a subtree.
+    return;
+}
+*/
+
+
+
+int JSON_compactOnPath(JSON_COMPACT *c, JSON_NODE *n);
+
+//
+//  This method walks the subtree 'n' and returns all children
+//  to 'j'.  The method returns (*n).next, in case 'n' itself
+//  is part of an array or object.
+//
+//  The stack/pop method ensures that n->next is NOT accidently
+//  deleted, while all children of n do follow the 'next' pointers.
+//  Specifically test of top>0 (ie. c!=n)
+//
+//  NOTE:  the labels and strings of the flushed nodes are freed in 'j'.
+//
+JSON_NODE *JSON_flushObject(JSON_STRUCT *j, JSON_NODE *n)
+{
+    JSON_NODE *next=(*n).next;
+    JSON_NODE *stack[JSON_MAX_DEPTH];
+    JSON_NODE *c;
+    JSON_NODE *f;
+    int top=0;
+    int8_t s=0;
+    top=0;
+    s=0;
+    stack[0]=n;
+    c=n;
+
+    //  A compaction that is walking through 'n' has to start over:
+    if ((*j).compact && JSON_compactOnPath((*j).compact, n))
+        (*j).gen+=1;
+
+    //  Walk:
+    do
+    {
+        //  If 's==0' we move into the child, or progress to 'next'
+        if (s==0)
+        {
+            //  Any side index goes with the array, and strings
+            //  go back to the pool:
+            if ((*c).f&JSON_FLG_IDX)
+                JSON_indexDrop(j, c);
+            if ((*c).f&JSON_FLG_LBL)
+                JSON_freeString(j, (*c).label);
+            if ((*c).f&(JSON_FLG_STR|JSON_FLG_RAW))
+                JSON_freeString(j, (*c).value.string);
+
+            //  Down or next?
+            s=1;
+            if (((*c).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && (*c).value.child)
+            {
+                //  Recursing down into the child.
+                c=(*c).value.child;
+                top+=1;
+                stack[top]=c;
+                s=0;
+            }
+        }
+
+        //  If s==1, need to move to 'next', or 'up'
+        if (s==1)
+        {
+            //  Do not go 'next' if this was the top:
+            //  Note:  'n->next' is returned from this method.
+            if ((*c).next && top>0 /* c!=n*/)
+            {
+                //  Next.  Replace the top-of-stack to make
+                //  sure we pop to the correct node from stack.
+                f=c;    //  save
+                c=(*c).next;
+                stack[top]=c;   //  Replace the top-of-stack
+                JSON_freeNode(j, f);
+                s=0;
+            }
+            else
+            {
+                //  Stack pop, must evaluate the 'next'
+                top-=1;
+                if (top>=0)
+                {
+                    f=c;    //  save
+                    c=stack[top];       //  Pop from stack
+                    JSON_freeNode(j, f);
+                    s=1;
+                }
+            }
+        }
+    }
+    while (top>0 && top<JSON_MAX_DEPTH-1);
+
+    //  And finally 'n' itself, which is at top of stack:
+    f=stack[0];       //  Pop from stack
+    JSON_freeNode(j, f);
+
+    //  Return whatever 'n' was pointing at:
+    return(next);
+}
+
+
+
+//  Clean it out completely, but leaves the nodes memory allocated.
+//  This does not walk the tree:  every node and string is in one of
+//  the chunks, and they are simply rewound.
+void JSON_flush(JSON_STRUCT *j)
+{
+    JSON_STRING *s;
+    int i;
+
+    //  Put any chunks that are being compacted back first:
+    if ((*j).compact)
+        JSON_compactAbort(j, (*j).compact);
+
+        //
+        //  Nodes:  start over at the first chunk.
+        //
+    (*j).obj=NULL;
+    (*j).freeStack=NULL;
+    (*j).nodeChunk=(*j).nodes;
+    if ((*j).nodes)
+        (*(*j).nodes).pos=0;
+    (*j).top=0;
+    (*j).prev=0;
+    (*j).gen+=1;
+
+    //  All side indexes go:
+    for (i=0; i<JSON_INDEX_HASH; i+=1)
+    {
+        while ((*j).index[i])
+        {
+            JSON_INDEX *x=(*j).index[i];
+            (*j).index[i]=(*x).next;
+            JSON_free(j, (*x).v, (*x).cap*sizeof(JSON_NODE*));
+            JSON_free(j, x, sizeof(JSON_INDEX));
+        }
+    }
+
+
+        //
+        //  Now move to free up all strings:
+        //
+    s=(*j).stringPool;
+    while (s)
+    {
+        (*s).pos=0;
+        s=(*s).next;
+    }
+    //  And the completely full ones:
+    s=(*j).usedStrings;
+    while (s)
+    {
+        JSON_STRING *n=(*s).next;
+        (*s).pos=0;
+        (*s).next=(*j).stringPool;
+        (*j).stringPool=s;
+        s=n;
+    }
+    (*j).usedStrings=NULL;
+
+    //  Freed spans are all part of the above:
+    memset((*j).freeStrings, 0, sizeof((*j).freeStrings));
+
+    return;
+}
+
+
+
+//  De-allocation of the structure:
+void JSON_destroy(JSON_STRUCT *j)
+{
+    JSON_NODES *n;
+    JSON_STRING *s;
+
+    //  Cleanout
+    JSON_flush(j);
+
+    //  Each of the node chunks:
+    n=(*j).nodes;
+    while(n)
+    {
+        JSON_NODES *t=(*n).next;
+        JSON_free(j, n, JSON_NODES_SIZE((*n).cnt));
+        n=t;
+    }
+
+    //  Each of the character pages:
+    s=(*j).stringPool;
+    while(s)
+    {
+        JSON_STRING *t=(*s).next;
+        JSON_free(j, s, JSON_STRING_SIZE((*s).len));
+        s=t;
+    }
+
+    //  (*j).obj and (*j).usedStrings are both NULL after flush
+    JSON_free(j, j, sizeof(JSON_STRUCT));
+    return;
 }
 
 
 
-int JSON_flattenParse(FILE *str, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
-{
-    JSON_DATA d;
-    memset(&d, 0, sizeof(JSON_DATA));
-    d.str=str;
-    return(JSON_flattenParseInt(&d, callback, user));
-}
-
-
-int JSON_flattenParseMem(char *buf, int len, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user)
+//  Helper to clone a node:
+//  Note that the 'next' and 'child' points are NOT set!
+JSON_NODE *JSON_cloneNode(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k)
 {
-    JSON_DATA d;
-    memset(&d, 0, sizeof(JSON_DATA));
-    d.buf=buf;
-    d.len=len;
-    return(JSON_flattenParseInt(&d, callback, user));
-}
-
+    JSON_NODE *m=NULL;
 
-/************************************************************************
- *                                                                      *
- *    Cloning and cleaning                                              *
- *                                                                      *
- ************************************************************************/
+    //  Trivial case:
+    if (n==NULL)
+        return(m);
+    m=JSON_newNode(k);
+    if (m==NULL)
+        return(m);
+    (*m).next=NULL;
 
 
-//  Since strings are allocated, but not tracked or freed, a lot of
-//  manipulation on a JSON object in memory will result in string space
-//  being wasted.  When this starts to happen, simply create a new
-//  JSON_STRUCT and clone the current JSON structures into it, discard
-//  the old one.
+    //  
+    //  Is this an object item with a label?
+    //
+    //  Strings are always copied, as every node owns its strings.
+    if ((*n).f&JSON_FLG_LBL)
+    {
+        //  Allocate string and copy.
+        int len=strlen((*n).label);
+        (*m).label=JSON_newString(k, len);
+        if ((*m).label==NULL)
+        {
+            (*m).next=(*k).freeStack;
+            (*k).freeStack=m;
+            return(NULL);
+        }
+        else
+            strncpy((*m).label, (*n).label, len);
+        (*m).f|=((*n).f&(JSON_FLG_LBL|JSON_FLG_LTXT));     //  Set flag.
+    }
 
+    //
+    //  String value, or the text of a raw number:
+    //
+    if ((*n).f&(JSON_FLG_STR|JSON_FLG_RAW))
+    {
+        //  Allocate string and copy.
+        int len=strlen((*n).value.string);
+        (*m).value.string=JSON_newString(k, len);
+        if ((*m).value.string==NULL)
+        {
+            JSON_freeString(k, (*m).label);
+            (*m).next=(*k).freeStack;
+            (*k).freeStack=m;
+            return(NULL);
+        }
+        else
+            strncpy((*m).value.string, (*n).value.string, len);
+        (*m).f|=((*n).f&(JSON_FLG_STR|JSON_FLG_TXT|JSON_FLG_NUM|JSON_FLG_RAW));     //  Set flag.
+    }
 
+    //
+    //  Numbers and symbols work the same (both stored in the value):
+    //
+    if ((((*n).f&JSON_FLG_NUM) && !((*n).f&JSON_FLG_RAW)) || ((*n).f&JSON_FLG_SYM))
+    {
+        (*m).f|=((*n).f&(JSON_FLG_NUM|JSON_FLG_INT|JSON_FLG_UINT|JSON_FLG_SYM));
+        (*m).value=(*n).value;
+    }
 
-//  Temporary routine to just print a value:
-//  DO NOT USE
-/*
-void JSON_debugPrintValStr(char *str, JSON_NODE *n)
-{
-    if (n==NULL)
-        fprintf(stdout, "%s NULL\n", str);
-    else if ((*n).f&JSON_FLG_NUM)
-        fprintf(stdout, "%s %f\n", str, (*n).value.num);
-    else if ((*n).f&JSON_FLG_STR)
-        fprintf(stdout, "%s %s\n", str, (*n).value.string);
-    else if ((*n).f&JSON_FLG_SYM)
+    //
+    //  These both need a 'child' pointers set:
+    //
+    if ((*n).f&JSON_FLG_ARR || (*n).f&JSON_FLG_OBJ)
     {
-        if ((*n).value.num==JSON_SYM_TRUE)
-            fprintf(stdout, "%s true\n", str);
-        else if ((*n).value.num==JSON_SYM_FALSE)
-            fprintf(stdout, "%s false\n", str);
-        else
-            fprintf(stdout, "%s null\n", str);
+        (*m).f|=((*n).f&(JSON_FLG_ARR|JSON_FLG_OBJ));
+        (*m).value.child=NULL;
     }
-    else
-        fprintf(stdout, "%s COMPOUND: %s\n", str, (*n).label);    //  It is compound like a subtree.
-    return;
-}
-*/
 
+    //  'm' is now a clone of 'n' but POINTERS are NOT yet set.
+    return(m);
+}
 
 
 //
-//  This method walks the subtree 'n' and returns all children
-//  to 'j'.  The method returns (*n).next, in case 'n' itself
-//  is part of an array or object.
+//  Cloning of the subtree under 'n', which is assumed to be in 'j'.
+//  The strings are allocated from and copied into 'k', also when
+//  'j==k', so that the clone can be flushed independently.
 //
-//  The stack/pop method ensures that n->next is NOT accidently
-//  deleted, while all children of n do follow the 'next' pointers.
-//  Specifically test of top>0 (ie. c!=n)
+//  Since this clones the node 'n', and 'n' may be part of an array
+//  or an object the (*n).next pointer is NOT evaluated for cloning!
+//  Again:  if 'n->next' is valid is set SET TO NULL for the 'rc'.
 //
-//  NOTE:  strings remain allocated in 'j'.
+//  Returns the cloned object.
+//  NOTE:  it is valid for j==k
 //
-JSON_NODE *JSON_flushObject(JSON_STRUCT *j, JSON_NODE *n)
+JSON_NODE *JSON_cloneObject(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k)
 {
-    JSON_NODE *next=(*n).next;
-    JSON_NODE *stack[JSON_MAX_DEPTH];
-    JSON_NODE *c;
-    JSON_NODE *f;
     int top=0;
     int8_t s=0;
+    //  The tree under 'n'
+    JSON_NODE *nStack[JSON_MAX_DEPTH];
+    JSON_NODE *nc;
+    //  The tree under 'm'
+    JSON_NODE *mStack[JSON_MAX_DEPTH];
+    JSON_NODE *mc;
+    JSON_NODE *m;   //  This is our top of the new tree
+
+    //  Start by allocating 'm':
+    m=JSON_cloneNode(j, n, k);
+    if (m==NULL)
+        return(m);
+ 
+    //  Prepare:
     top=0;
     s=0;
-    stack[0]=n;
-    c=n;
+    nStack[0]=n;
+    nc=n;
+    mStack[0]=m;
+    mc=m;
     //  Walk:
     do
     {
@@ -2003,30 +4830,53 @@ JSON_NODE *JSON_flushObject(JSON_STRUCT *j, JSON_NODE *n)
         {
             //  Down or next?
             s=1;
-            if (((*c).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && (*c).value.child)
+            if (((*nc).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && (*nc).value.child)
             {
                 //  Recursing down into the child.
-                c=(*c).value.child;
+                nc=(*nc).value.child;
                 top+=1;
-                stack[top]=c;
+                nStack[top]=nc;
                 s=0;
+                //  Allocate the child node:
+                (*mc).value.child=JSON_cloneNode(j, nc, k);
+                if ((*mc).value.child==NULL)
+                {
+                    //  Bail on allocation trouble:
+                    JSON_flushObject(k, m);
+                    return(NULL);
+                }
+                (*mc).last=(*mc).value.child;
+                (*mc).cnt=1;
+                //  And duplicate the stack build:
+                mc=(*mc).value.child;
+                mStack[top]=mc;
             }
         }
 
         //  If s==1, need to move to 'next', or 'up'
         if (s==1)
         {
-            //  Do not go 'next' if this was the top:
-            //  Note:  'n->next' is returned from this method.
-            if ((*c).next && top>0 /* c!=n*/)
+            if ((*nc).next && top>0)
             {
                 //  Next.  Replace the top-of-stack to make
                 //  sure we pop to the correct node from stack.
-                f=c;    //  save
-                c=(*c).next;
-                stack[top]=c;   //  Replace the top-of-stack
-                (*f).next=(*j).freeStack;
-                (*j).freeStack=f;
+                nc=(*nc).next;
+                nStack[top]=nc;   //  Replace the top-of-stack
+
+                //  Duplicate (*nc).next
+                (*mc).next=JSON_cloneNode(j, nc, k);
+                if ((*mc).next==NULL)
+                {
+                    //  Bail on allocation trouble:
+                    JSON_flushObject(k, m);
+                    return(NULL);
+                }
+                (*mStack[top-1]).last=(*mc).next;
+                (*mStack[top-1]).cnt+=1;
+                // And move to the new node:
+                mc=(*mc).next;
+                mStack[top]=mc;   //  Also replace the top-of-stack
+                //  Mode 0 again
                 s=0;
             }
             else
@@ -2035,336 +4885,684 @@ JSON_NODE *JSON_flushObject(JSON_STRUCT *j, JSON_NODE *n)
                 top-=1;
                 if (top>=0)
                 {
-                    f=c;    //  save
-                    c=stack[top];       //  Pop from stack
-                    (*f).next=(*j).freeStack;
-                    (*j).freeStack=f;
+                    nc=nStack[top];       //  Pop from stack
+                    mc=mStack[top];       //  idem.
                     s=1;
                 }
             }
         }
     }
     while (top>0 && top<JSON_MAX_DEPTH-1);
+    //  Return the top of our stack:
+    return(m);
+}
+
+
+
+//  The cloning of an entire JSON_STRUCT.
+//  Important:  toplevel node (*h).obj can NEVER have a 'next' pointer because:
+//    1)  it is compound (array/object), in which case (*obj).value.child is set.
+//    2)  it is a singular value.
+JSON_STRUCT *JSON_clone(JSON_STRUCT *j)
+{
+    JSON_STRUCT *k;
+
+    //  An arena belongs to one struct only:
+    if ((*j).mem.alloc==JSON_arenaAlloc)
+        k=JSON_new();
+    else
+        k=JSON_newWithAllocator(&((*j).mem));
+    if (k==NULL)
+        return(NULL);
+    (*k).obj=JSON_cloneObject(j, (*j).obj, k);
+    if ((*j).obj!=NULL && (*k).obj==NULL)
+    {
+        JSON_destroy(k);
+        k=NULL;
+    }
+    return(k);
+}
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Incremental compaction                                            *
+ *                                                                      *
+ ************************************************************************/
+
+
+//  Ordering of the string chunks by address:
+int JSON_compactCmp(const void *a, const void *b)
+{
+    JSON_STRING *x=*(JSON_STRING**)a;
+    JSON_STRING *y=*(JSON_STRING**)b;
+    if (x<y)
+        return(-1);
+    return(x>y);
+}
+
+
+//  Returns the position in (*c).chunks of the chunk holding 's',
+//  or -1 if it is not in any of them (ie. it was allocated later).
+int JSON_compactFind(JSON_COMPACT *c, char *s)
+{
+    int lo=0;
+    int hi=(*c).cnt-1;
+    while (lo<=hi)
+    {
+        int mid=(lo+hi)>>1;
+        JSON_STRING *k=(*c).chunks[mid];
+        if (s<(*k).m)
+            hi=mid-1;
+        else if (s>=(*k).m+(*k).len)
+            lo=mid+1;
+        else
+            return(mid);
+    }
+    return(-1);
+}
+
+
+//  The same for the node chunks, and the node 'n':
+int JSON_compactFindNode(JSON_COMPACT *c, JSON_NODE *n)
+{
+    int lo=0;
+    int hi=(*c).nodeCnt-1;
+    while (lo<=hi)
+    {
+        int mid=(lo+hi)>>1;
+        JSON_NODES *k=(*c).nodeChunks[mid];
+        if (n<(*k).n)
+            hi=mid-1;
+        else if (n>=(*k).n+(*k).cnt)
+            lo=mid+1;
+        else
+            return(mid);
+    }
+    return(-1);
+}
+
+
+//  (Re)start the walk from the top:
+void JSON_compactRewind(JSON_STRUCT *j, JSON_COMPACT *c)
+{
+    (*c).top=0;
+    (*c).stack[0]=(*j).obj;
+    (*c).c=(*j).obj;
+    (*c).gen=(*j).gen;
+    (*c).deep=0;
+    if ((*c).phase==1)
+    {
+        memset((*c).live, 0, (*c).cnt*sizeof(int64_t));
+        memset((*c).nodeLive, 0, (*c).nodeCnt*sizeof(int64_t));
+    }
+    return;
+}
+
+
+//  Returns the node to visit, and moves the walk on to the next one.
+//  Children are visited before the 'next' ones, and the root values
+//  one after the other.
+JSON_NODE *JSON_compactNext(JSON_COMPACT *c)
+{
+    JSON_NODE *n=(*c).c;
+    if (n==NULL)
+        return(NULL);
+
+    //  Down:
+    if (((*n).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && (*n).value.child)
+    {
+        if ((*c).top<JSON_MAX_DEPTH-1)
+        {
+            (*c).top+=1;
+            (*c).stack[(*c).top]=(*n).value.child;
+            (*c).c=(*n).value.child;
+            return(n);
+        }
+        (*c).deep=1;
+    }
+
+    //  Next, or up until there is a next:
+    while ((*c).top>=0)
+    {
+        JSON_NODE *x=(*c).stack[(*c).top];
+        if ((*x).next)
+        {
+            (*c).stack[(*c).top]=(*x).next;
+            (*c).c=(*x).next;
+            return(n);
+        }
+        (*c).top-=1;
+    }
+    (*c).c=NULL;
+    return(n);
+}
+
+
+//  If 'n' is on the path of the walk, deleting it cuts the walk:  the
+//  path is the one node at each level down to the current one.
+int JSON_compactOnPath(JSON_COMPACT *c, JSON_NODE *n)
+{
+    int k;
+    if ((*c).phase==0 || (*c).c==NULL)
+        return(0);
+    for (k=0; k<=(*c).top; k+=1)
+        if ((*c).stack[k]==n)
+            return(1);
+    return(0);
+}
+
+
+//  Counts, or moves, the string at '*s':
+int JSON_compactString(JSON_STRUCT *j, JSON_COMPACT *c, char **s)
+{
+    int len;
+    int k=JSON_compactFind(c, *s);
+    if (k<0)
+        return(0);
+
+    len=strlen(*s);
+    if ((*c).phase==1)
+        (*c).live[k]+=JSON_stringClassSize(JSON_stringClass(len+1));
+    else if ((*c).evac[k])
+    {
+        //  The chunks being emptied are out of the pool, so this
+        //  new string is always somewhere else:
+        char *t=JSON_newString(j, len);
+        if (t==NULL)
+            return(JSON_ERR_MEM);
+        memcpy(t, *s, len+1);
+        (*s)=t;
+        (*c).moved+=len+1;
+    }
+    return(0);
+}
+
 
-    //  And finally 'n' itself, which is at top of stack:
-    f=stack[0];       //  Pop from stack
-    (*f).next=(*j).freeStack;
-    (*j).freeStack=f;
+//  Moves the node at '*p' out of a chunk being emptied, if it is in one.
+//  'parent' is the container it is in, whose 'last' may be it as well.
+//  Side indexes hold the old address, so those of the node and of its
+//  container are dropped (they are built again when needed).
+int JSON_compactNode(JSON_STRUCT *j, JSON_COMPACT *c, JSON_NODE **p, JSON_NODE *parent)
+{
+    JSON_NODE *o=*p;
+    JSON_NODE *n;
+    int k;
 
-    //  Return whatever 'n' was pointing at:
-    return(next);
-}
+    if (o==NULL)
+        return(0);
+    k=JSON_compactFindNode(c, o);
+    if (k<0 || (*c).nodeEvac[k]==0)
+        return(0);
 
+    JSON_indexDrop(j, o);
+    JSON_indexDrop(j, parent);
 
+    //  Nodes in the chunks being emptied are never handed out again
+    //  (see 'JSON_freeNode'), so this one is somewhere else:
+    n=JSON_newNode(j);
+    if (n==NULL)
+        return(JSON_ERR_MEM);
+    memcpy(n, o, sizeof(JSON_NODE));
+    (*p)=n;
+    if (parent && (*parent).last==o)
+        (*parent).last=n;
+
+    //  A read that is not complete yet has it on its stack:
+    for (k=0; k<(*j).top; k+=1)
+        if ((*j).stack[k]==o)
+            (*j).stack[k]=n;
+    (*c).nodesMoved+=1;
+    return(0);
+}
 
-//  Clean it out completely, but leaves the nodes memory allocated.
-void JSON_flush(JSON_STRUCT *j)
-{
-    JSON_STRING *s;
 
-        //
-        //  Walk the tree and clear the nodes
-        //  Very similar state machine to the JSON_walk method.
-        //
-    if ((*j).obj)
+//  Takes the nodes in the chunks being emptied off the free stack:
+void JSON_compactFreeStack(JSON_STRUCT *j, JSON_COMPACT *c)
+{
+    JSON_NODE **f=&((*j).freeStack);
+    while (*f)
     {
-        JSON_flushObject(j, (*j).obj);
-        (*j).obj=NULL;
+        int k=JSON_compactFindNode(c, *f);
+        if (k>=0 && (*c).nodeEvac[k])
+            (*f)=(**f).next;
+        else
+            f=&((**f).next);
     }
-    (*j).top=0;
-    (*j).prev=0;
+    return;
+}
 
 
-        //
-        //  Now move to free up all strings:
-        //
-    s=(*j).stringPool;
-    while (s)
-    {
-        (*s).pos=0;
-        s=(*s).next;
-    }
-    //  And the completely full ones:
-    s=(*j).usedStrings;
-    while (s)
+//  Takes the chunks to be emptied out of 'list':
+void JSON_compactDetach(JSON_COMPACT *c, JSON_STRING **list)
+{
+    while (*list)
     {
-        JSON_STRING *n=(*s).next;
-        (*s).pos=0;
-        (*s).next=(*j).stringPool;
-        (*j).stringPool=s;
-        s=n;
+        int k=JSON_compactFind(c, (**list).m);
+        if (k>=0 && (*c).evac[k])
+            (*list)=(**list).next;
+        else
+            list=&((**list).next);
     }
-    (*j).usedStrings=NULL;
+    return;
+}
 
+
+//  End of a pass, or abort.  All state is freed, ready for the next pass.
+void JSON_compactDone(JSON_STRUCT *j, JSON_COMPACT *c)
+{
+    JSON_free(j, (*c).chunks, ((*c).cnt+1)*sizeof(JSON_STRING*));
+    JSON_free(j, (*c).live, ((*c).cnt+1)*sizeof(int64_t));
+    JSON_free(j, (*c).evac, ((*c).cnt+1)*sizeof(u_int8_t));
+    JSON_free(j, (*c).nodeChunks, ((*c).nodeCnt+1)*sizeof(JSON_NODES*));
+    JSON_free(j, (*c).nodeLive, ((*c).nodeCnt+1)*sizeof(int64_t));
+    JSON_free(j, (*c).nodeEvac, ((*c).nodeCnt+1)*sizeof(u_int8_t));
+    (*c).chunks=NULL;
+    (*c).live=NULL;
+    (*c).evac=NULL;
+    (*c).cnt=0;
+    (*c).nodeChunks=NULL;
+    (*c).nodeLive=NULL;
+    (*c).nodeEvac=NULL;
+    (*c).nodeCnt=0;
+    (*c).c=NULL;
+    (*c).phase=0;
+    if ((*j).compact==c)
+        (*j).compact=NULL;
     return;
 }
 
 
+//  Ordering of the node chunks by address:
+int JSON_compactCmpNodes(const void *a, const void *b)
+{
+    JSON_NODES *x=*(JSON_NODES**)a;
+    JSON_NODES *y=*(JSON_NODES**)b;
+    if (x<y)
+        return(-1);
+    return(x>y);
+}
+
 
-//  De-allocation of the structure:
-void JSON_destroy(JSON_STRUCT *j)
+//  Start of a pass:  take stock of the string chunks, and of the node
+//  chunks before the one nodes are handed out from (which are full).
+int JSON_compactStart(JSON_STRUCT *j, JSON_COMPACT *c)
 {
-    JSON_NODE *n;
-    JSON_NODE *f=NULL;
     JSON_STRING *s;
+    JSON_NODES *a;
+    int n=0;
+    int m=0;
 
-    //  Cleanout
-    JSON_flush(j);
-
-    //  Nodes have an allocation marking:
-    //  First find all the 1st allocation addresses
-    n=(*j).freeStack;
-    while(n)
-    {
-        JSON_NODE *t=(*n).next;
-        if ((*n).f&JSON_FLG_1ST)
-        {
-            (*n).next=f;
-            f=n;
-        }
-        n=t;
-    }
-    //  Now free them all:
-    n=f;
-    while(n)
+    for (s=(*j).stringPool; s; s=(*s).next)
+        n+=1;
+    for (s=(*j).usedStrings; s; s=(*s).next)
+        n+=1;
+    for (a=(*j).nodes; a && a!=(*j).nodeChunk; a=(*a).next)
+        m+=1;
+
+    (*c).cnt=n;
+    (*c).chunks=(JSON_STRING**)JSON_alloc(j, (n+1)*sizeof(JSON_STRING*));
+    (*c).live=(int64_t*)JSON_alloc(j, (n+1)*sizeof(int64_t));
+    (*c).evac=(u_int8_t*)JSON_alloc(j, (n+1)*sizeof(u_int8_t));
+    (*c).nodeCnt=m;
+    (*c).nodeChunks=(JSON_NODES**)JSON_alloc(j, (m+1)*sizeof(JSON_NODES*));
+    (*c).nodeLive=(int64_t*)JSON_alloc(j, (m+1)*sizeof(int64_t));
+    (*c).nodeEvac=(u_int8_t*)JSON_alloc(j, (m+1)*sizeof(u_int8_t));
+    if ((*c).chunks==NULL || (*c).live==NULL || (*c).evac==NULL ||
+        (*c).nodeChunks==NULL || (*c).nodeLive==NULL || (*c).nodeEvac==NULL)
     {
-        JSON_NODE *t=(*n).next;
-        if ((*n).f&JSON_FLG_1ST)
-            free(n);
-        n=t;
+        JSON_compactDone(j, c);
+        return(JSON_ERR_MEM);
     }
 
-    //  Each of the character pages:
-    s=(*j).stringPool;
-    while(s)
-    {
-        JSON_STRING *t=(*s).next;
-        free(s);
-        s=t;
-    }
+    n=0;
+    for (s=(*j).stringPool; s; s=(*s).next)
+        (*c).chunks[n++]=s;
+    for (s=(*j).usedStrings; s; s=(*s).next)
+        (*c).chunks[n++]=s;
+    qsort((*c).chunks, n, sizeof(JSON_STRING*), JSON_compactCmp);
+    memset((*c).evac, 0, n);
+    (*c).cnt=n;
 
-    //  (*j).obj and (*j).usedStrings are both NULL after flush
-    free(j);
-    return;
+    m=0;
+    for (a=(*j).nodes; a && a!=(*j).nodeChunk; a=(*a).next)
+        (*c).nodeChunks[m++]=a;
+    qsort((*c).nodeChunks, m, sizeof(JSON_NODES*), JSON_compactCmpNodes);
+    memset((*c).nodeEvac, 0, m);
+    (*c).nodeCnt=m;
+    (*c).phase=1;
+    (*j).compact=c;
+    JSON_compactRewind(j, c);
+    return(0);
 }
 
 
-
-//  Helper to clone a node:
-//  Note that the 'next' and 'child' points are NOT set!
-JSON_NODE *JSON_cloneNode(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k)
+int JSON_compact(JSON_STRUCT *j, JSON_COMPACT *c, int budget)
 {
-    JSON_NODE *m=NULL;
+    JSON_NODE *n;
+    int k, evac;
 
-    //  Trivial case:
-    if (n==NULL)
-        return(m);
-    m=JSON_newNode(k);
-    if (m==NULL)
-        return(m);
-    (*m).next=NULL;
+    //  Start of a pass:
+    if ((*c).phase==0 && JSON_compactStart(j, c)<0)
+        return(JSON_ERR_MEM);
 
+    //  If the tree changed, the walk is no longer valid:
+    if ((*c).gen!=(*j).gen)
+        JSON_compactRewind(j, c);
 
-    //  
-    //  Is this an object item with a label?
-    //
-    if ((*n).f&JSON_FLG_LBL)
+    //  When moving, the root goes first, as nothing else points at it:
+    if ((*c).phase==2 && (*c).top==0 && (*c).c==(*j).obj)
+    {
+        if (JSON_compactNode(j, c, &((*j).obj), NULL)<0)
+            return(JSON_ERR_MEM);
+        (*c).stack[0]=(*j).obj;
+        (*c).c=(*j).obj;
+    }
+
+    //  A slice of the walk:
+    while (budget>0 && (*c).c)
     {
-        (*m).f|=JSON_FLG_LBL;       //  Set flag.
-        if (j!=k)
+        //  The node itself was moved by whoever points at it, now
+        //  its first child, and the one after it:
+        if ((*c).phase==2)
         {
-            //  Allocate string and copy.
-            int len=strlen((*n).label);
-            (*m).label=JSON_newString(k, len);
-            if ((*m).label==NULL)
-            {
-                (*m).next=(*k).freeStack;
-                (*k).freeStack=m;
-                return(NULL);
-            }
-            else
-                strncpy((*m).label, (*n).label, len);
+            JSON_NODE *x=(*c).c;
+            JSON_NODE *parent=((*c).top>0)?(*c).stack[(*c).top-1]:NULL;
+            if (((*x).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && JSON_compactNode(j, c, &((*x).value.child), x)<0)
+                return(JSON_ERR_MEM);
+            if (JSON_compactNode(j, c, &((*x).next), parent)<0)
+                return(JSON_ERR_MEM);
         }
-        else
-            (*m).label=(*n).label;      //  No need to copy.
+        n=JSON_compactNext(c);
+        if ((*c).phase==1)
+        {
+            k=JSON_compactFindNode(c, n);
+            if (k>=0)
+                (*c).nodeLive[k]+=1;
+        }
+        if ((*n).f&JSON_FLG_LBL)
+            if (JSON_compactString(j, c, &((*n).label))<0)
+                return(JSON_ERR_MEM);
+        if ((*n).f&(JSON_FLG_STR|JSON_FLG_RAW))
+            if (JSON_compactString(j, c, &((*n).value.string))<0)
+                return(JSON_ERR_MEM);
+        budget-=1;
     }
+    if ((*c).c)
+        return(0);
 
-    //
-    //  String value:
-    //
-    if ((*n).f&JSON_FLG_STR)
+        //
+        //  Measured:  pick the sparse chunks, and take them out of
+        //  the pool, including any free spans or nodes in them.  If
+        //  the walk could not reach every node nothing is moved.
+        //
+    if ((*c).phase==1)
     {
-        (*m).f|=JSON_FLG_STR;       //  Set flag.
-        if (j!=k)
+        evac=0;
+        for (k=0; k<(*c).cnt && !(*c).deep; k+=1)
         {
-            //  Allocate string and copy.
-            int len=strlen((*n).value.string);
-            (*m).value.string=JSON_newString(k, len);
-            if ((*m).value.string==NULL)
+            int64_t pos=(*(*c).chunks[k]).pos;
+            if (pos>0 && (*c).live[k]*100<pos*JSON_COMPACT_SPARSE)
             {
-                (*m).next=(*k).freeStack;
-                (*k).freeStack=m;
-                return(NULL);
+                (*c).evac[k]=1;
+                evac+=1;
             }
-            else
-                strncpy((*m).value.string, (*n).value.string, len);
         }
-        else
-            (*m).value.string=(*n).value.string;  //  No need to copy.
+        for (k=0; k<(*c).nodeCnt && !(*c).deep; k+=1)
+        {
+            int64_t pos=(*(*c).nodeChunks[k]).pos;
+            if (pos>0 && (*c).nodeLive[k]*100<pos*JSON_COMPACT_SPARSE)
+            {
+                (*c).nodeEvac[k]=1;
+                evac+=1;
+            }
+        }
+        if (evac==0)
+        {
+            JSON_compactDone(j, c);
+            return(1);
+        }
+
+        JSON_compactDetach(c, &((*j).stringPool));
+        JSON_compactDetach(c, &((*j).usedStrings));
+        for (k=0; k<JSON_STRING_CLASSES; k+=1)
+        {
+            JSON_SPAN **f=&((*j).freeStrings[k]);
+            while (*f)
+            {
+                int e=JSON_compactFind(c, (char*)(*f));
+                if (e>=0 && (*c).evac[e])
+                    (*f)=(**f).next;
+                else
+                    f=&((**f).next);
+            }
+        }
+
+        //  The node chunks are all before 'nodeChunk' on the list:
+        {
+            JSON_NODES **a=&((*j).nodes);
+            while (*a)
+            {
+                int e=JSON_compactFindNode(c, (**a).n);
+                if (e>=0 && (*c).nodeEvac[e])
+                    (*a)=(**a).next;
+                else
+                    a=&((**a).next);
+            }
+        }
+        JSON_compactFreeStack(j, c);
+
+        (*c).phase=2;
+        JSON_compactRewind(j, c);
+        return(0);
     }
 
-    //
-    //  Numbers and symbols work the same (both stored in num):
-    //
-    if (((*n).f&JSON_FLG_NUM) || ((*n).f&JSON_FLG_SYM))
+        //
+        //  Moved:  nothing refers to the emptied chunks anymore.  If the
+        //  tree grew too deep to walk all of it, they stay.
+        //
+    if ((*c).deep)
     {
-        (*m).f|=((*n).f&(JSON_FLG_NUM|JSON_FLG_SYM));
-        (*m).value.num=(*n).value.num;
+        JSON_compactAbort(j, c);
+        return(1);
     }
-
-    //
-    //  These both need a 'child' pointers set:
-    //
-    if ((*n).f&JSON_FLG_ARR || (*n).f&JSON_FLG_OBJ)
+    for (k=0; k<(*c).cnt; k+=1)
     {
-        (*m).f|=((*n).f&(JSON_FLG_ARR|JSON_FLG_OBJ));
-        (*m).value.child=NULL;
+        if ((*c).evac[k])
+        {
+            int64_t size=JSON_STRING_SIZE((*(*c).chunks[k]).len);
+            JSON_free(j, (*c).chunks[k], size);
+            (*c).reclaimed+=size;
+        }
     }
-
-    //  'm' is now a clone of 'n' but POINTERS are NOT yet set.
-    return(m);
+    for (k=0; k<(*c).nodeCnt; k+=1)
+    {
+        if ((*c).nodeEvac[k])
+        {
+            int64_t size=JSON_NODES_SIZE((*(*c).nodeChunks[k]).cnt);
+            JSON_free(j, (*c).nodeChunks[k], size);
+            (*c).reclaimed+=size;
+        }
+    }
+    JSON_compactDone(j, c);
+    return(1);
 }
 
 
-//
-//  Cloning of the subtree under 'n', which is assumed to be in 'j'.
-//  If 'j==k', then the string points will be identical for both
-//  labels and string values.  If they are different then the
-//  strings are allocated from and copied into 'k'.
-//
-//  Since this clones the node 'n', and 'n' may be part of an array
-//  or an object the (*n).next pointer is NOT evaluated for cloning!
-//  Again:  if 'n->next' is valid is set SET TO NULL for the 'rc'.
-//
-//  Returns the cloned object.
-//  NOTE:  it is valid for j==k
-//
-JSON_NODE *JSON_cloneObject(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k)
+//  The chunks being emptied go back, but only as retired chunks, their
+//  free space is not tracked anymore.  Node chunks go back as full ones,
+//  at the front of the list.
+void JSON_compactAbort(JSON_STRUCT *j, JSON_COMPACT *c)
 {
-    int top=0;
-    int8_t s=0;
-    //  The tree under 'n'
-    JSON_NODE *nStack[JSON_MAX_DEPTH];
-    JSON_NODE *nc;
-    //  The tree under 'm'
-    JSON_NODE *mStack[JSON_MAX_DEPTH];
-    JSON_NODE *mc;
-    JSON_NODE *m;   //  This is our top of the new tree
-
-    //  Start by allocating 'm':
-    m=JSON_cloneNode(j, n, k);
-    if (m==NULL)
-        return(m);
- 
-    //  Prepare:
-    top=0;
-    s=0;
-    nStack[0]=n;
-    nc=n;
-    mStack[0]=m;
-    mc=m;
-    //  Walk:
-    do
+    int k;
+    if ((*c).phase==2)
     {
-        //  If 's==0' we move into the child, or progress to 'next'
-        if (s==0)
+        for (k=0; k<(*c).cnt; k+=1)
         {
-            //  Down or next?
-            s=1;
-            if (((*nc).f&(JSON_FLG_ARR|JSON_FLG_OBJ)) && (*nc).value.child)
+            if ((*c).evac[k])
             {
-                //  Recursing down into the child.
-                nc=(*nc).value.child;
-                top+=1;
-                nStack[top]=nc;
-                s=0;
-                //  Allocate the child node:
-                (*mc).value.child=JSON_cloneNode(j, nc, k);
-                if ((*mc).value.child==NULL)
-                {
-                    //  Bail on allocation trouble:
-                    JSON_flushObject(k, m);
-                    return(NULL);
-                }
-                //  And duplicate the stack build:
-                mc=(*mc).value.child;
-                mStack[top]=mc;
+                (*(*c).chunks[k]).next=(*j).usedStrings;
+                (*j).usedStrings=(*c).chunks[k];
+            }
+        }
+        for (k=0; k<(*c).nodeCnt; k+=1)
+        {
+            if ((*c).nodeEvac[k])
+            {
+                (*(*c).nodeChunks[k]).next=(*j).nodes;
+                (*j).nodes=(*c).nodeChunks[k];
             }
         }
+    }
+    JSON_compactDone(j, c);
+    return;
+}
+
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Array side index                                                  *
+ *                                                                      *
+ ************************************************************************/
+
+
+//  Bucket of array node 'a'.  Nodes are at least 32 bytes, the low bits
+//  carry no information.
+#define JSON_INDEX_BUCKET(a) ((int)((((size_t)(a))>>5)%JSON_INDEX_HASH))
+
+
+JSON_INDEX *JSON_indexGet(JSON_STRUCT *j, JSON_NODE *a)
+{
+    JSON_INDEX *x;
+
+    //  Most arrays have no index, the flag avoids the hash lookup:
+    if (a==NULL || ((*a).f&JSON_FLG_IDX)==0)
+        return(NULL);
+    x=(*j).index[JSON_INDEX_BUCKET(a)];
+    while (x && (*x).arr!=a)
+        x=(*x).next;
+    return(x);
+}
+
+
+//  Walks the children of array 'a' once, and if there are
+//  enough of them, stores them in a new index.
+JSON_INDEX *JSON_indexBuild(JSON_STRUCT *j, JSON_NODE *a)
+{
+    JSON_INDEX *x;
+    JSON_NODE *c;
+    int cnt=0;
+    int b;
+
+    //  Already there?
+    x=JSON_indexGet(j, a);
+    if (x || a==NULL || ((*a).f&JSON_FLG_ARR)==0)
+        return(x);
+
+    //  Worth it?
+    c=(*a).value.child;
+    while (c)
+    {
+        cnt+=1;
+        c=(*c).next;
+    }
+    if (cnt<JSON_INDEX_MIN)
+        return(NULL);
+
+    //  Allocate, with some room to append:
+    x=(JSON_INDEX*)JSON_alloc(j, sizeof(JSON_INDEX));
+    if (x==NULL)
+        return(NULL);
+    (*x).cap=cnt+(cnt>>1);
+    (*x).v=(JSON_NODE**)JSON_alloc(j, (*x).cap*sizeof(JSON_NODE*));
+    if ((*x).v==NULL)
+    {
+        JSON_free(j, x, sizeof(JSON_INDEX));
+        return(NULL);
+    }
+    (*x).arr=a;
+    (*x).cnt=0;
+    c=(*a).value.child;
+    while (c)
+    {
+        (*x).v[(*x).cnt]=c;
+        (*x).cnt+=1;
+        c=(*c).next;
+    }
 
-        //  If s==1, need to move to 'next', or 'up'
-        if (s==1)
-        {
-            if ((*nc).next && top>0)
-            {
-                //  Next.  Replace the top-of-stack to make
-                //  sure we pop to the correct node from stack.
-                nc=(*nc).next;
-                nStack[top]=nc;   //  Replace the top-of-stack
+    //  Stitch into the table:
+    b=JSON_INDEX_BUCKET(a);
+    (*x).next=(*j).index[b];
+    (*j).index[b]=x;
+    (*a).f|=JSON_FLG_IDX;
+    return(x);
+}
 
-                //  Duplicate (*nc).next
-                (*mc).next=JSON_cloneNode(j, nc, k);
-                if ((*mc).next==NULL)
-                {
-                    //  Bail on allocation trouble:
-                    JSON_flushObject(k, m);
-                    return(NULL);
-                }
-                // And move to the new node:
-                mc=(*mc).next;
-                mStack[top]=mc;   //  Also replace the top-of-stack
-                //  Mode 0 again
-                s=0;
-            }
-            else
-            {
-                //  Stack pop, must evaluate the 'next'
-                top-=1;
-                if (top>=0)
-                {
-                    nc=nStack[top];       //  Pop from stack
-                    mc=mStack[top];       //  idem.
-                    s=1;
-                }
-            }
+
+void JSON_indexDrop(JSON_STRUCT *j, JSON_NODE *a)
+{
+    JSON_INDEX **p;
+
+    if (a==NULL || ((*a).f&JSON_FLG_IDX)==0)
+        return;
+    (*a).f&=~JSON_FLG_IDX;
+
+    p=&((*j).index[JSON_INDEX_BUCKET(a)]);
+    while (*p)
+    {
+        if ((**p).arr==a)
+        {
+            JSON_INDEX *x=*p;
+            (*p)=(*x).next;
+            JSON_free(j, (*x).v, (*x).cap*sizeof(JSON_NODE*));
+            JSON_free(j, x, sizeof(JSON_INDEX));
+            return;
         }
+        p=&((**p).next);
     }
-    while (top>0 && top<JSON_MAX_DEPTH-1);
-    //  Return the top of our stack:
-    return(m);
+    return;
 }
 
 
-
-//  The cloning of an entire JSON_STRUCT.
-//  Important:  toplevel node (*h).obj can NEVER have a 'next' pointer because:
-//    1)  it is compound (array/object), in which case (*obj).value.child is set.
-//    2)  it is a singular value.
-JSON_STRUCT *JSON_clone(JSON_STRUCT *j)
+//  Makes room for, and stores, 'n' at position 'i'.
+//  On allocation failure the index is dropped, which is always safe.
+void JSON_indexInsert(JSON_STRUCT *j, JSON_INDEX *x, int i, JSON_NODE *n)
 {
-    JSON_STRUCT *k=JSON_new();
-    if (k)
-        (*k).obj=JSON_cloneObject(j, (*j).obj, k);
-    if ((*j).obj!=NULL && (*k).obj==NULL)
+    if ((*x).cnt==(*x).cap)
     {
-        JSON_destroy(k);
-        k=NULL;
+        JSON_NODE **v=(JSON_NODE**)JSON_alloc(j, 2*(*x).cap*sizeof(JSON_NODE*));
+        if (v==NULL)
+        {
+            JSON_indexDrop(j, (*x).arr);
+            return;
+        }
+        memcpy(v, (*x).v, (*x).cnt*sizeof(JSON_NODE*));
+        JSON_free(j, (*x).v, (*x).cap*sizeof(JSON_NODE*));
+        (*x).v=v;
+        (*x).cap*=2;
     }
-    return(k);
+    if (i<(*x).cnt)
+        memmove(&((*x).v[i+1]), &((*x).v[i]), ((*x).cnt-i)*sizeof(JSON_NODE*));
+    (*x).v[i]=n;
+    (*x).cnt+=1;
+    return;
+}
+
+
+void JSON_indexRemove(JSON_INDEX *x, int i)
+{
+    (*x).cnt-=1;
+    if (i<(*x).cnt)
+        memmove(&((*x).v[i]), &((*x).v[i+1]), ((*x).cnt-i)*sizeof(JSON_NODE*));
+    return;
 }
 
 
 
+
 /************************************************************************
  *                                                                      *
  *    Searching and manipulating                                        *
@@ -2524,9 +5722,8 @@ int JSON_queryParse(char *qStr, JSON_QUERY *q)
 //  Recursive version of execute query that is able to
 //  handle wildcards.  This method can handle insertions, deletions, etc
 //
-//  When 'new' is given, it is REQUIRED that:
-//  1)   It is constructed upon 'j' so that ts clones will share string pointers in 'j'.
-//  2)   The strings can be external but MUST exist beyond the lifetime of struct 'j'.
+//  When 'new' is given, its strings are copied into 'j' by the clone, so
+//  they may be external, or allocated in 'j'.
 //  Set 'JSON_FLG_LBL' and point 'label' at a string for objects, leave unset for array items
 //  Note that 'new' is cloned for each insertion, so may be flushed/destroyed after the call.
 //
@@ -2536,6 +5733,55 @@ int JSON_queryParse(char *qStr, JSON_QUERY *q)
 #define JSON_QUERY_DEL  3   //  Delete the match
 #define JSON_QUERY_UPD  4   //  Raplce the match
 
+//
+//  After the query acted on child 'n' of container 'b' (reached through
+//  pointer 'p', the action returned 'rc') bring the child count and the
+//  last child pointer of 'b' up to date.  When nothing was done, 'rc' and
+//  '*p' are both still 'n' and this method does nothing.
+//
+void JSON_queryUpdateParent(JSON_NODE *b, JSON_NODE *n, JSON_NODE **p, JSON_NODE *rc, int cmd)
+{
+    switch(cmd)
+    {
+        case JSON_QUERY_ADD:
+            if (rc!=n)
+            {
+                (*b).cnt+=1;
+                if ((*b).last==n)
+                    (*b).last=rc;
+            }
+            break;
+
+        case JSON_QUERY_INS:
+            if ((*p)!=n)
+                (*b).cnt+=1;
+            break;
+
+        case JSON_QUERY_DEL:
+            if ((*p)!=n)
+            {
+                (*b).cnt-=1;
+                //  The new last one is the one whose 'next' is 'p'.
+                //  Note that 'next' is the first member of a node.
+                if ((*b).last==n)
+                {
+                    if (p==&((*b).value.child))
+                        (*b).last=NULL;
+                    else
+                        (*b).last=(JSON_NODE*)p;
+                }
+            }
+            break;
+
+        case JSON_QUERY_UPD:
+            if ((*p)!=n && (*b).last==n)
+                (*b).last=(*p);
+            break;
+    }
+    return;
+}
+
+
 JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON_NODE *n, JSON_NODE **p, u_int8_t type, int cmd, JSON_NODE *new, void (*callback)(JSON_NODE *n, void *user), void *user)
 {
     //  Is this the node that we need to return?  Or are we
@@ -2555,7 +5801,11 @@ JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON
 
             //  Very special case of an empty object or array:
             if (n==NULL && (cmd==JSON_QUERY_ADD||cmd==JSON_QUERY_INS) && d==(*q).top && ((*new).f&JSON_FLG_LBL)!=0)
+            {
                 (*p)=JSON_cloneObject(j, new, j);
+                (*b).last=(*p);
+                (*b).cnt=((*p)!=NULL);
+            }
            
             //  Normal case: for each of the children:
             while (/*match==0 && */n!=NULL)
@@ -2567,6 +5817,8 @@ JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON
                 if (strncmp((*q).labels[d], (*n).label, JSON_MAX_LEN)==0 || 
                     strncmp((*q).labels[d], "*", JSON_MAX_LEN)==0)
                     rc=JSON_queryExecuteRecursive(j, q, d+1, n, p, JSON_FLG_OBJ, cmd, new, callback, user);
+                if (d==(*q).top)
+                    JSON_queryUpdateParent(b, n, p, rc, cmd);
 
                 //  In all cases except delete, we must advance to 'rc->next'
                 //  Only in the delete case might 'rc==NULL'
@@ -2592,22 +5844,67 @@ JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON
             //  If the index value is -1 then ALL items must be returned:
             int i=0;
             JSON_NODE *b=n;
+            JSON_INDEX *x=NULL;
             p=&((*n).value.child);
             n=(*n).value.child;
 
             //  Very special case of an empty object or array:
             if (n==NULL && (cmd==JSON_QUERY_ADD||cmd==JSON_QUERY_INS) && d==(*q).top && ((*new).f&JSON_FLG_LBL)==0)
+            {
                 (*p)=JSON_cloneObject(j, new, j);
-           
-            //  Normal case: for each of the children:
-            while (n!=NULL)
+                (*b).last=(*p);
+                (*b).cnt=((*p)!=NULL);
+            }
+
+            //  A single item in a large array is found through the side index:
+            if ((*q).ranks[d]>=(*b).cnt)
+                n=NULL;
+            else if ((*q).ranks[d]>=0)
+                x=JSON_indexBuild(j, b);
+            if (x)
+            {
+                i=(*q).ranks[d];
+                if (i<(*x).cnt)
+                {
+                    JSON_NODE *rc;
+                    n=(*x).v[i];
+                    if (i>0)
+                        p=&((*(*x).v[i-1]).next);
+                    rc=JSON_queryExecuteRecursive(j, q, d+1, n, p, JSON_FLG_ARR, cmd, new, callback, user);
+
+                    //  If the array itself was changed, follow suit in the index.
+                    //  Note that a failed clone leaves both 'rc' and '*p' at 'n'.
+                    if (d==(*q).top)
+                    {
+                        JSON_queryUpdateParent(b, n, p, rc, cmd);
+                        if (cmd==JSON_QUERY_ADD && rc!=n)
+                            JSON_indexInsert(j, x, i+1, rc);
+                        else if (cmd==JSON_QUERY_INS && (*p)!=n)
+                            JSON_indexInsert(j, x, i, *p);
+                        else if (cmd==JSON_QUERY_DEL && (*p)!=n)
+                            JSON_indexRemove(x, i);
+                        else if (cmd==JSON_QUERY_UPD && (*p)!=n)
+                            (*x).v[i]=(*p);
+                    }
+                }
+                //  Done, skip the walk:
+                n=NULL;
+            }
+            else if (d==(*q).top && cmd!=JSON_QUERY_GET)
+            {
+                //  Changing a wildcard match is simpler to re-index later:
+                JSON_indexDrop(j, b);
+            }
+
+            //  Normal case: for each of the children, up to the rank:
+            while (n!=NULL && ((*q).ranks[d]==-1 || i<=(*q).ranks[d]))
             {
                 JSON_NODE *rc=n;
 
-                //  Also could be optimized.  If (*q).ranks[d]!=-1 should
-                //  bail when the index is found.
                 if ((*q).ranks[d]==-1 || i==(*q).ranks[d])
                     rc=JSON_queryExecuteRecursive(j, q, d+1, n, p, JSON_FLG_ARR, cmd, new, callback, user);
+                if (d==(*q).top)
+                    JSON_queryUpdateParent(b, n, p, rc, cmd);
 
                 //  In all cases except delete, we must advance to 'rc->next'
                 //  Only in the delete case might 'rc==NULL'
@@ -2737,10 +6034,13 @@ JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON
                     {
                         //  In case this is just a value, copy the label
                         //  from the original 'n' over (both are aloocated in 'j'):
+                        //  The label moves, so it is not freed with 'n'.
                         if (((*n).f&JSON_FLG_LBL)!=0 && ((*m).f&JSON_FLG_LBL)==0)
                         {
                             (*m).label=(*n).label;
-                            (*m).f|=JSON_FLG_LBL;
+                            (*m).f|=((*n).f&(JSON_FLG_LBL|JSON_FLG_LTXT));
+                            (*n).label=NULL;
+                            (*n).f&=~(JSON_FLG_LBL|JSON_FLG_LTXT);
                         }
 
                         //  Flush returns 'n->next'
@@ -2761,6 +6061,36 @@ JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON
 
 
 
+//
+//  Appending to a known container does not need a query.
+//  The clone goes after the last child, and into the side index if any.
+//
+JSON_NODE *JSON_appendChild(JSON_STRUCT *j, JSON_NODE *c, JSON_NODE *n)
+{
+    JSON_NODE *m;
+    JSON_INDEX *x;
+
+    if (c==NULL || ((*c).f&(JSON_FLG_ARR|JSON_FLG_OBJ))==0)
+        return(NULL);
+    m=JSON_cloneObject(j, n, j);
+    if (m==NULL)
+        return(NULL);
+
+    if ((*c).last)
+        (*(*c).last).next=m;
+    else
+        (*c).value.child=m;
+    (*c).last=m;
+    (*c).cnt+=1;
+
+    x=JSON_indexGet(j, c);
+    if (x)
+        JSON_indexInsert(j, x, (*x).cnt, m);
+    return(m);
+}
+
+
+
 //
 //  Primitives derived from the base recursive function
 //
@@ -2800,51 +6130,49 @@ void JSON_delete(JSON_STRUCT *j, JSON_QUERY *q)
 }
 
 
-//  This is actually derived from 'retrieve'
+//  This is actually derived from 'retrieve':  the containers one step
+//  up from the query location are retrieved, and their children counted.
 struct JSON_GETOBJECTSIZE_STRUCT
 {
     JSON_NODE *lastNode;
+    JSON_NODE *parent;
+    u_int8_t type;      //  Only count in containers of this type
     int count;
 };
 
 void JSON_getObjectSizeCallback(JSON_NODE *n, void *user)
 {
     struct JSON_GETOBJECTSIZE_STRUCT *s=(struct JSON_GETOBJECTSIZE_STRUCT*) user;
-    (*s).lastNode=n;
-    (*s).count+=1;
+
+    if (n==NULL)
+        return;
+    (*s).parent=n;
+
+    //  Containers know their size and last child:
+    if (((*n).f&(*s).type) && (*n).cnt>0)
+    {
+        (*s).lastNode=(*n).last;
+        (*s).count+=(*n).cnt;
+    }
     return;
 }
 
 int JSON_getObjectSize(JSON_STRUCT *j, JSON_QUERY *q, JSON_NODE **lastNode)
 {
-    //  Save the last ranking or label
     struct JSON_GETOBJECTSIZE_STRUCT s;
-    char *label=(*q).labels[(*q).top];
-    int rank=(*q).ranks[(*q).top];
-
-    (*q).labels[(*q).top]="*";
-    (*q).ranks[(*q).top]=-1;
 
-    //  Now iterate each of the objects at the query location:
+    //  Iterate each of the containers one level up:
     memset(&s, 0, sizeof(struct JSON_GETOBJECTSIZE_STRUCT));
+    s.type=(*q).types[(*q).top];
+    (*q).top-=1;
     JSON_retrieve(j, q, JSON_getObjectSizeCallback, (void*) &s);
-
-    //  Restore the last ranking/label
-    (*q).labels[(*q).top]=label;
-    (*q).ranks[(*q).top]=rank;
+    (*q).top+=1;    //  Restore
 
     //  If the object/array was empty, instead return the parent:
     if (s.count==0)
-    {
-        (*q).top-=1;
-        JSON_retrieve(j, q, JSON_getObjectSizeCallback, (void*) &s);
-        //(*lastNode)=s.lastNode;
-        s.count=0;      //  Reset
-        (*q).top+=1;    //  Restore
-    }
-
-    //  And the rest:
-    (*lastNode)=s.lastNode;
+        (*lastNode)=s.parent;
+    else
+        (*lastNode)=s.lastNode;
     return(s.count);
 }
 
@@ -2890,13 +6218,16 @@ void JSON_getValueCallback(JSON_NODE *n, void *user)
     if ((*u).rc<0)
     {
         //  Singular values are copied:
-        if ((*n).f&JSON_FLG_NUM)
+        if ((*n).f&JSON_FLG_RAW)
         {
-            //  Cheap integer test:
-            if ((double)((long long int)(*n).value.num)==(*n).value.num)
-                snprintf((*u).val, (*u).len, "%lli", (long long int)(*n).value.num);
-            else
-                snprintf((*u).val, (*u).len, "%f", (*n).value.num);
+            strncpy((*u).val, (*n).value.string, (*u).len);
+            (*u).rc=JSON_RC_NUM;
+        }
+        else if ((*n).f&JSON_FLG_NUM)
+        {
+            char b[JSON_NUM_LEN];
+            JSON_nodetoa(b, n);
+            snprintf((*u).val, (*u).len, "%s", b);
             (*u).rc=JSON_RC_NUM;
         }
         else if ((*n).f&JSON_FLG_STR)
@@ -2953,7 +6284,7 @@ void JSON_setvalSearchCallback(JSON_NODE *n, void *user)
 
 //
 //  Determine if this is a number, a truth value or a string:
-//  Strings are allocated against struct 'j'
+//  Strings are NOT copied, 'n' is only used as a template to clone into 'j'
 //
 int JSON_setvalMakeNode(JSON_STRUCT *j, JSON_NODE *n, char *val)
 {
@@ -2970,20 +6301,24 @@ int JSON_setvalMakeNode(JSON_STRUCT *j, JSON_NODE *n, char *val)
     }
     else
     {
-        //  Try to parse a number:
+        //  Try to parse a number, an integer is kept exact:
         char *endptr;
-        (*n).value.num=strtod(val, &endptr);
-        if (endptr==val+strlen(val))
-            (*n).f|=JSON_FLG_NUM;
+        int cmd=JSON_atoi(val, &(*n).value.u);
+        if (cmd==JSON_CMD_VAL_INT)
+            (*n).f|=JSON_FLG_NUM|JSON_FLG_INT;
+        else if (cmd==JSON_CMD_VAL_UINT)
+            (*n).f|=JSON_FLG_NUM|JSON_FLG_UINT;
         else
         {
-            int len=strlen(val);
-            (*n).value.string=JSON_newString(j, len+1);
-            if ((*n).value.string)
-                strncpy((*n).value.string, val, len+1);
+            (*n).value.num=strtod(val, &endptr);
+            if (endptr==val+strlen(val))
+                (*n).f|=JSON_FLG_NUM;
             else
-                return(-1);
-            (*n).f|=JSON_FLG_STR;
+            {
+                //  Plain text, that is escaped when printed:
+                (*n).value.string=val;
+                (*n).f|=JSON_FLG_STR|JSON_FLG_TXT;
+            }
         }
     }
     return(0);
@@ -2999,6 +6334,7 @@ int JSON_setval(JSON_STRUCT *j, char *path, char *val)
     int i, top;
     int rc=JSON_RC_NOTFOUND;
     JSON_QUERY q;
+    JSON_NODE *c=NULL;      //  The container one level up from 'i'
 
     if (JSON_queryParse(path, &q)<0)
         return(JSON_RC_PARSE);
@@ -3026,6 +6362,8 @@ int JSON_setval(JSON_STRUCT *j, char *path, char *val)
             else
                 (*(*j).obj).f|=JSON_FLG_ARR;
         }
+        if (i==0)
+            c=(*j).obj;
 
         //  Search for the query node, if it does not exist, create it:
         q.top=i;
@@ -3042,7 +6380,6 @@ int JSON_setval(JSON_STRUCT *j, char *path, char *val)
             //
             int k;
             JSON_NODE m[JSON_MAX_DEPTH];
-            JSON_NODE *lastNode;
             memset(&m, 0, sizeof(JSON_NODE)*JSON_MAX_DEPTH);
 
             for (k=i; k<=top && k<JSON_MAX_DEPTH; k+=1)
@@ -3068,38 +6405,23 @@ int JSON_setval(JSON_STRUCT *j, char *path, char *val)
                 }
 
                 //  This may need a label itself:
+                //  (The clone copies it into 'j')
                 if (q.types[k]==JSON_FLG_OBJ)
                 {
-                    int len=strlen(q.labels[k]);
-                    m[k-i].label=JSON_newString(j, len+1);
-                    if (m[k-i].label)
-                        strncpy(m[k-i].label, q.labels[k], len+1);
-                    else
-                        return(-1);
+                    m[k-i].label=q.labels[k];
                     m[k-i].f|=JSON_FLG_LBL;
                 }
             }
 
             //
-            //  And add to the array or object at 'i'.
-            //  For an array:  find the last element, add after that.
-            //  For objects, find the last label, add there.
+            //  And add to the array or object at 'i', which is the
+            //  container found one level up, after its last child.
+            //  If that is of the other kind the path cannot be made.
             //
-            q.ranks[i]=JSON_getObjectSize(j, &q, &lastNode)-1;
-            if (lastNode)
-            {
-                if ((*lastNode).label)
-                    q.labels[i]=(*lastNode).label;
-                JSON_append(j, &q, &m[0]);
-            }
-            else if (q.ranks[i]==-1)
-            {
-                //  In this case the object was empty, and 'lastNode' returned
-                //  is the parent, hence must add to the 'child'
-                (*lastNode).value.child=JSON_cloneObject(j, &m[0], j);
-            }
-            else
+            if (((*c).f&q.types[i])==0)
                 rc=JSON_RC_NOTFOUND;
+            else if (JSON_appendChild(j, c, &m[0])==NULL)
+                rc=JSON_RC_ALLOC;
 
             //  Ensure we jump out of the loop now.
             i=top+1;
@@ -3119,74 +6441,416 @@ int JSON_setval(JSON_STRUCT *j, char *path, char *val)
             else
                 return(JSON_RC_COMPOUND);
         }
+        else
+            c=n;
+    }
+
+
+
+    return(rc);
+}
+
+
+
+
+//
+//  Clear the value at the path.  Needs to be a non-compound object.
+//  Object is deleted.
+//
+int JSON_clrval(JSON_STRUCT *j, char *path)
+{
+    int i;
+    JSON_NODE *n=NULL;
+    JSON_QUERY q;
+
+    //
+    //  Check if top-level of path is singular, then delete
+    //
+    if (JSON_queryParse(path, &q)<0)
+        return(JSON_RC_PARSE);
+
+        //  Wildcard check:
+    for (i=0; i<=q.top; i+=1)
+        if ((q.types[i]==JSON_FLG_OBJ && strncmp(q.labels[i], "*", 1)==0) ||
+            (q.types[i]==JSON_FLG_ARR && q.ranks[i]==-1))
+            return(JSON_RC_WILDCARD);
+
+        //  Retrieve, see if it compound:
+    JSON_retrieve(j, &q, JSON_setvalSearchCallback, &n);
+    if (n==NULL)
+        return(JSON_RC_NOTFOUND);
+    if ((*n).f&(JSON_FLG_OBJ|JSON_FLG_ARR))
+        return(JSON_RC_COMPOUND);
+
+        //  Safe to delete:
+    JSON_delete(j, &q);
+
+
+    //
+    //  Now walk the path to determine if the compound
+    //  objects are empty.  Clear them out as well.
+    //
+    //q.top-=1;
+    while(q.top>=0)
+    {
+        if (JSON_getObjectSize(j, &q, &n)==0)
+        {
+            //  Note:  it is acceptable for 'q.top' to become -1 as the index is
+            //  never used directly, and simply indicates there is no query.
+            q.top-=1;
+            JSON_delete(j, &q);
+        }
+        else
+            q.top=-1;
+    }
+
+    return(0);
+}
+
+
+
+
+
+
+
+
+
+/************************************************************************
+ *                                                                      *
+ *    Pipelined parsing                                                 *
+ *                                                                      *
+ ************************************************************************/
+
+
+//  Waits for the next item of a ring:
+void *JSON_pipelineTake(BEDROCK_MPMC *r)
+{
+    void *v;
+    int spins=0;
+    while (BEDROCK_mpmcPop(r, &v)<0)
+        BEDROCK_backoff(&spins);
+    return(v);
+}
+
+
+//  The rings are big enough for every item there is, so this never waits:
+void JSON_pipelinePut(BEDROCK_MPMC *r, void *v)
+{
+    int spins=0;
+    while (BEDROCK_mpmcPush(r, v)<0)
+        BEDROCK_backoff(&spins);
+    return;
+}
+
+
+void *JSON_pipelineParser(void *arg)
+{
+    JSON_PIPELINE *p=(JSON_PIPELINE*)arg;
+    JSON_BATCH *t=NULL;
+    JSON_BLOCK *b;
+    JSON_PARSER d;
+
+    while ((b=(JSON_BLOCK*)JSON_pipelineTake(&(*p).blocks))!=NULL)
+    {
+        int64_t pos=0;
+        int64_t n=(*b).first;
+        while (pos<(*b).len && !BEDROCK_atomicLoad(&(*p).stop))
+        {
+            char *line=(*b).buf+pos;
+            char *end=(char*)memchr(line, '\n', (*b).len-pos);
+            int len=(end)?end-line:(*b).len-pos;
+
+            //  Skip empty lines:
+            JSON_parserMem(&d, line, len);
+            JSON_ws(&d);
+            if (d.pos<len)
+            {
+                JSON_STRUCT *j;
+                if (t==NULL)
+                {
+                    t=(JSON_BATCH*)JSON_pipelineTake(&(*p).freeBatches);
+                    (*t).cnt=0;
+                }
+                j=(*t).j[(*t).cnt];
+                if (JSON_parseInt(&d, JSON_read, j)<0)
+                {
+                    BEDROCK_atomicAdd(&(*p).errors, 1);
+                    JSON_flush(j);
+                }
+                else
+                {
+                    (*t).n[(*t).cnt]=n;
+                    (*t).cnt+=1;
+                    if ((*t).cnt==(*p).batch)
+                    {
+                        JSON_pipelinePut(&(*p).batches, t);
+                        t=NULL;
+                    }
+                }
+            }
+            pos+=len+1;
+            n+=1;
+        }
+        JSON_pipelinePut(&(*p).freeBlocks, b);
     }
 
-
-
-    return(rc);
+    //  What is left:
+    if (t && (*t).cnt>0)
+        JSON_pipelinePut(&(*p).batches, t);
+    else if (t)
+        JSON_pipelinePut(&(*p).freeBatches, t);
+    return(NULL);
 }
 
 
-
-
-//
-//  Clear the value at the path.  Needs to be a non-compound object.
-//  Object is deleted.
-//
-int JSON_clrval(JSON_STRUCT *j, char *path)
+void *JSON_pipelineConsumer(void *arg)
 {
+    JSON_PIPELINE *p=(JSON_PIPELINE*)arg;
+    JSON_BATCH *t;
     int i;
-    JSON_NODE *n=NULL;
-    JSON_QUERY q;
 
-    //
-    //  Check if top-level of path is singular, then delete
-    //
-    if (JSON_queryParse(path, &q)<0)
-        return(JSON_RC_PARSE);
+    while ((t=(JSON_BATCH*)JSON_pipelineTake(&(*p).batches))!=NULL)
+    {
+        for (i=0; i<(*t).cnt; i+=1)
+        {
+            if (!BEDROCK_atomicLoad(&(*p).stop))
+            {
+                if ((*(*p).consume)((*t).j[i], (*t).n[i], (*p).user)<0)
+                    BEDROCK_atomicStore(&(*p).stop, 1);
+                else
+                    BEDROCK_atomicAdd(&(*p).records, 1);
+            }
+            JSON_flush((*t).j[i]);
+        }
+        JSON_pipelinePut(&(*p).freeBatches, t);
+    }
+    return(NULL);
+}
 
-        //  Wildcard check:
-    for (i=0; i<=q.top; i+=1)
-        if ((q.types[i]==JSON_FLG_OBJ && strncmp(q.labels[i], "*", 1)==0) ||
-            (q.types[i]==JSON_FLG_ARR && q.ranks[i]==-1))
-            return(JSON_RC_WILDCARD);
 
-        //  Retrieve, see if it compound:
-    JSON_retrieve(j, &q, JSON_setvalSearchCallback, &n);
-    if (n==NULL)
-        return(JSON_RC_NOTFOUND);
-    if ((*n).f&(JSON_FLG_OBJ|JSON_FLG_ARR))
-        return(JSON_RC_COMPOUND);
+//  Reads into 'b' after what is already there, and returns what was read:
+int64_t JSON_pipelineRead(FILE *str, BEDROCK_READER *rd, JSON_BLOCK *b)
+{
+    int64_t n;
+    if ((*b).len==(*b).cap)
+    {
+        //  A line longer than the block:
+        char *buf=(char*)realloc((*b).buf, 2*(*b).cap);
+        if (buf==NULL)
+            return(JSON_ERR_MEM);
+        (*b).buf=buf;
+        (*b).cap*=2;
+    }
+    if (rd)
+    {
+        n=BEDROCK_readerRead(rd, (*b).buf+(*b).len, (*b).cap-(*b).len);
+        if (n<0)
+            return(JSON_ERR_MEM);
+    }
+    else
+        n=fread((*b).buf+(*b).len, 1, (*b).cap-(*b).len, str);
+    (*b).len+=n;
+    return(n);
+}
 
-        //  Safe to delete:
-    JSON_delete(j, &q);
 
+int JSON_pipelineRun(FILE *str, BEDROCK_READER *rd, JSON_PIPELINE *p)
+{
+    int nBlocks, nBatches, i, k;
+    int rc=0;
+    int started[2]={0, 0};
+    JSON_BLOCK *blocks;
+    JSON_BATCH *batches;
+    pthread_t *th;
+    JSON_BLOCK *b;
+    void *v;
+
+    if ((*p).parsers<=0)
+        (*p).parsers=BEDROCK_cpus();
+    if ((*p).consumers<=0)
+        (*p).consumers=1;
+    if ((*p).batch<=0)
+        (*p).batch=JSON_PIPELINE_BATCH;
+    (*p).records=0;
+    (*p).errors=0;
+    (*p).stop=0;
 
-    //
-    //  Now walk the path to determine if the compound
-    //  objects are empty.  Clear them out as well.
-    //
-    //q.top-=1;
-    while(q.top>=0)
+        //
+        //  Enough blocks and batches to keep every thread busy, and
+        //  rings that can hold all of them, plus the end markers.
+        //
+    nBlocks=2*(*p).parsers+2;
+    nBatches=2*((*p).parsers+(*p).consumers);
+    blocks=(JSON_BLOCK*)calloc(nBlocks, sizeof(JSON_BLOCK));
+    batches=(JSON_BATCH*)calloc(nBatches, sizeof(JSON_BATCH));
+    th=(pthread_t*)calloc((*p).parsers+(*p).consumers, sizeof(pthread_t));
+    memset(&(*p).blocks, 0, sizeof(BEDROCK_MPMC));
+    memset(&(*p).freeBlocks, 0, sizeof(BEDROCK_MPMC));
+    memset(&(*p).batches, 0, sizeof(BEDROCK_MPMC));
+    memset(&(*p).freeBatches, 0, sizeof(BEDROCK_MPMC));
+    if (blocks==NULL || batches==NULL || th==NULL ||
+        BEDROCK_mpmcInit(&(*p).blocks, nBlocks+(*p).parsers)<0 ||
+        BEDROCK_mpmcInit(&(*p).freeBlocks, nBlocks)<0 ||
+        BEDROCK_mpmcInit(&(*p).batches, nBatches+(*p).consumers)<0 ||
+        BEDROCK_mpmcInit(&(*p).freeBatches, nBatches)<0)
+        rc=JSON_ERR_MEM;
+    for (i=0; rc==0 && i<nBlocks; i+=1)
     {
-        if (JSON_getObjectSize(j, &q, &n)==0)
+        blocks[i].cap=JSON_PIPELINE_BLOCK;
+        blocks[i].buf=(char*)malloc(blocks[i].cap);
+        if (blocks[i].buf==NULL)
+            rc=JSON_ERR_MEM;
+        else
+            BEDROCK_mpmcPush(&(*p).freeBlocks, &(blocks[i]));
+    }
+    for (i=0; rc==0 && i<nBatches; i+=1)
+    {
+        batches[i].j=(JSON_STRUCT**)calloc((*p).batch, sizeof(JSON_STRUCT*));
+        batches[i].n=(int64_t*)calloc((*p).batch, sizeof(int64_t));
+        if (batches[i].j==NULL || batches[i].n==NULL)
+            rc=JSON_ERR_MEM;
+        for (k=0; rc==0 && k<(*p).batch; k+=1)
+            if ((batches[i].j[k]=JSON_new())==NULL)
+                rc=JSON_ERR_MEM;
+        if (rc==0)
+            BEDROCK_mpmcPush(&(*p).freeBatches, &(batches[i]));
+    }
+
+        //
+        //  Start the threads, consumers first so a parser never waits
+        //  on a batch nobody will take:
+        //
+    for (i=0; rc==0 && i<(*p).consumers; i+=1)
+    {
+        if (pthread_create(&(th[(*p).parsers+i]), NULL, JSON_pipelineConsumer, p)!=0)
+            rc=JSON_ERR_MEM;
+        else
+            started[1]+=1;
+    }
+    for (i=0; rc==0 && i<(*p).parsers; i+=1)
+    {
+        if (pthread_create(&(th[i]), NULL, JSON_pipelineParser, p)!=0)
+            rc=JSON_ERR_MEM;
+        else
+            started[0]+=1;
+    }
+
+        //
+        //  Read blocks of whole lines.  What is after the last newline
+        //  moves to the next block.
+        //
+    b=NULL;
+    while (rc==0 && !BEDROCK_atomicLoad(&(*p).stop))
+    {
+        int64_t n, cut;
+        JSON_BLOCK *next;
+        char *c;
+
+        if (b==NULL)
         {
-            //  Note:  it is acceptable for 'q.top' to become -1 as the index is
-            //  never used directly, and simply indicates there is no query.
-            q.top-=1;
-            JSON_delete(j, &q);
+            b=(JSON_BLOCK*)JSON_pipelineTake(&(*p).freeBlocks);
+            (*b).len=0;
+            (*b).first=0;
         }
-        else
-            q.top=-1;
+        n=JSON_pipelineRead(str, rd, b);
+        if (n<0)
+        {
+            rc=(int)n;
+            break;
+        }
+        if (n==0)
+            break;      //  End of the stream
+
+        //  The last newline:
+        cut=(*b).len;
+        while (cut>0 && (*b).buf[cut-1]!='\n')
+            cut-=1;
+        if (cut==0)
+            continue;   //  No whole line yet
+
+        next=(JSON_BLOCK*)JSON_pipelineTake(&(*p).freeBlocks);
+        (*next).len=(*b).len-cut;
+        if ((*next).cap<(*next).len)
+        {
+            //  The tail is a line longer than this block, grow it too:
+            int64_t cap=(*next).cap;
+            char *buf;
+            while (cap<(*next).len)
+                cap*=2;
+            buf=(char*)realloc((*next).buf, cap);
+            if (buf==NULL)
+            {
+                rc=JSON_ERR_MEM;
+                break;
+            }
+            (*next).buf=buf;
+            (*next).cap=cap;
+        }
+        memcpy((*next).buf, (*b).buf+cut, (*next).len);
+        (*next).first=(*b).first;
+        for (c=(*b).buf; (c=(char*)memchr(c, '\n', (*b).buf+cut-c))!=NULL; c+=1)
+            (*next).first+=1;
+        (*b).len=cut;
+        JSON_pipelinePut(&(*p).blocks, b);
+        b=next;
     }
+    if (b && (*b).len>0 && rc==0 && !BEDROCK_atomicLoad(&(*p).stop))
+        JSON_pipelinePut(&(*p).blocks, b);
 
-    return(0);
+        //
+        //  Wind down:  parsers first, then the consumers.
+        //
+    for (i=0; i<started[0]; i+=1)
+        JSON_pipelinePut(&(*p).blocks, NULL);
+    for (i=0; i<started[0]; i+=1)
+        pthread_join(th[i], &v);
+    for (i=0; i<started[1]; i+=1)
+        JSON_pipelinePut(&(*p).batches, NULL);
+    for (i=0; i<started[1]; i+=1)
+        pthread_join(th[(*p).parsers+i], &v);
+
+    for (i=0; blocks && i<nBlocks; i+=1)
+        free(blocks[i].buf);
+    for (i=0; batches && i<nBatches; i+=1)
+    {
+        for (k=0; batches[i].j && k<(*p).batch; k+=1)
+            if (batches[i].j[k])
+                JSON_destroy(batches[i].j[k]);
+        free(batches[i].j);
+        free(batches[i].n);
+    }
+    free(blocks);
+    free(batches);
+    free(th);
+    BEDROCK_mpmcFree(&(*p).blocks);
+    BEDROCK_mpmcFree(&(*p).freeBlocks);
+    BEDROCK_mpmcFree(&(*p).batches);
+    BEDROCK_mpmcFree(&(*p).freeBatches);
+
+    if (rc<0)
+        return(rc);
+    return((int)(*p).records);
 }
 
 
 
 
+int JSON_pipeline(FILE *str, JSON_PIPELINE *p)
+{
+    return(JSON_pipelineRun(str, NULL, p));
+}
+
 
+int JSON_pipelineFd(int fd, JSON_PIPELINE *p)
+{
+    BEDROCK_READER rd;
+    int rc;
+    if (BEDROCK_readerOpen(&rd, fd, 0, 0, 0)<0)
+        return(JSON_ERR_MEM);
+    rc=JSON_pipelineRun(NULL, &rd, p);
+    BEDROCK_readerClose(&rd);
+    return(rc);
+}
 
 
 
@@ -3221,7 +6885,7 @@ int JSON_newStringBenchCheckPools(JSON_STRUCT *j)
         //  Only test if there was a prior one.
         if (p)
         {
-            if ((*p).pos<(*c).pos)
+            if ((*p).len-(*p).pos>(*c).len-(*c).pos)
             {
                 //fprintf(stderr, "Sorted order error:  p->pos=%i c->pos=%i\n", (int) (*p).pos, (int) (*c).pos);
                 return(1);
@@ -3241,9 +6905,9 @@ int JSON_newStringBenchCheckPools(JSON_STRUCT *j)
     {
         //  Print debug:
         //fprintf(stderr, " %i", (int) (*c).pos);
-        if ((*c).pos<=JSON_ALLOC_CNT_CHAR-JSON_STRING_RETIREMENT)
+        if ((*c).pos<=(*c).len-JSON_STRING_RETIREMENT)
         {
-            //fprintf(stderr, "Retired object had %i bytes left: c->pos=%i\n", (int) JSON_ALLOC_CNT_CHAR-(int) (*c).pos, (int) (*c).pos);
+            //fprintf(stderr, "Retired object had %i bytes left: c->pos=%i\n", (int) (*c).len-(int) (*c).pos, (int) (*c).pos);
             return(1);
         }
         c=(*c).next;
@@ -3294,8 +6958,465 @@ int JSON_newStringBench(JSON_STRUCT *j)
 
 
 
+//
+//  Small regression test for 'JSON_read' on a stream of root values:
+//  each is read with its own 'JSON_parserNext', and lands as a sibling
+//  of the one before, which has no parent on the stack.  The same for
+//  the flattened form, where the first line is an empty label.
+//
+int JSON_readCheck(void)
+{
+    char *doc[2]={"1 2", "{} {}"};
+    char flat[]="\"\":0\n\"b\":true\n";
+    int i;
+
+    for (i=0; i<2; i+=1)
+    {
+        JSON_STRUCT *j=JSON_new();
+        JSON_PARSER d;
+        int k, rc=0;
+
+        if (j==NULL)
+            return(1);
+        JSON_parserMem(&d, doc[i], strlen(doc[i]));
+        for (k=0; k<2 && rc>=0; k+=1)
+            rc=JSON_parserNext(&d, JSON_read, j);
+        JSON_parserFree(&d);
+        if (rc<0 || (*j).obj==NULL || (*(*j).obj).next==NULL)
+        {
+            fprintf(stderr, "Root values not read as siblings: %s\n", doc[i]);
+            JSON_destroy(j);
+            return(1);
+        }
+        JSON_destroy(j);
+    }
+
+    {
+        JSON_STRUCT *j=JSON_new();
+
+        if (j==NULL)
+            return(1);
+        if (JSON_flattenParseMem(flat, strlen(flat), JSON_read, j)<0 || (*j).obj==NULL)
+        {
+            fprintf(stderr, "Flattened document not read\n");
+            JSON_destroy(j);
+            return(1);
+        }
+        JSON_destroy(j);
+    }
+    return(0);
+}
+
+
+
+
+//
+//  Load time of a big document with the different chunk strategies:
+//  1) fixed size chunks (as it was), 2) chunks that grow up to
+//  JSON_CHUNK_MAX, and 4) the same on huge pages.  'mode' is any
+//  combination of these bits.  Each is parsed 'rounds' times into a
+//  fresh struct, walked, and destroyed, and the best time is printed
+//  with the number of chunks used.  For the TLB misses, run one mode
+//  at a time under 'perf stat -e dTLB-load-misses,dTLB-store-misses'.
+//
+int JSON_loadBenchCount(int cmd, int r, int d, char *s, double n, void *user)
+{
+    (*(int64_t*)user)+=1;
+    return(0);
+}
+
+
+int JSON_loadBench(char *buf, int len, int rounds, int mode)
+{
+    char *name[3]={"fixed", "growing", "huge pages"};
+    int m, r;
+
+    for (m=0; m<3; m+=1)
+    {
+        double best=-1;
+        int64_t events=0;
+        int64_t chunks=0;
+        if ((mode&(1<<m))==0)
+            continue;
+
+        for (r=0; r<rounds; r+=1)
+        {
+            JSON_ALLOCATOR a;
+            JSON_STRUCT *j;
+            JSON_NODES *n;
+            JSON_STRING *s;
+            struct timeval t0, t1;
+            double t;
+            int rc;
+
+            memset(&a, 0, sizeof(JSON_ALLOCATOR));
+            if (m==2)
+            {
+                a.alloc=JSON_hugeAlloc;
+                a.free=JSON_hugeFree;
+            }
+            j=JSON_newWithAllocator(&a);
+            if (j==NULL)
+                return(JSON_ERR_MEM);
+            if (m==0)
+                (*j).chunkMax=1;    //  Never grows past the first size
+
+            gettimeofday(&t0, NULL);
+            rc=JSON_parseMem(buf, len, JSON_read, j);
+            events=0;
+            JSON_walk(j, JSON_loadBenchCount, &events);
+            gettimeofday(&t1, NULL);
+
+            chunks=0;
+            for (n=(*j).nodes; n; n=(*n).next)
+                chunks+=1;
+            for (s=(*j).stringPool; s; s=(*s).next)
+                chunks+=1;
+            for (s=(*j).usedStrings; s; s=(*s).next)
+                chunks+=1;
+            JSON_destroy(j);
+            if (rc<0)
+                return(rc);
+
+            t=(t1.tv_sec-t0.tv_sec)+(t1.tv_usec-t0.tv_usec)/1e6;
+            if (best<0 || t<best)
+                best=t;
+        }
+        fprintf(stderr, "%-10s  %.3f s  %lld events  %lld chunks\n", name[m], best, (long long) events, (long long) chunks);
+    }
+    return(0);
+}
+
+
+
+
+//
+//  The parser with the callback as a pointer, against the one generated
+//  by JSON_DEFINE_PARSER where it is called directly:  building the DOM
+//  with 'JSON_read', and printing without whitespace with 'JSON_print'
+//  (to /dev/null).  The best of 'rounds' is printed.
+//
+JSON_DEFINE_PARSER(JSON_readDirect, JSON_read)
+JSON_DEFINE_PARSER(JSON_printDirect, JSON_print)
+
+int JSON_inlineBench(char *buf, int len, int rounds)
+{
+    char *name[4]={"read", "read direct", "print", "print direct"};
+    FILE *null;
+    int i, r;
+
+    null=fopen("/dev/null", "w");
+    if (null==NULL)
+        return(-1);
+    for (i=0; i<4; i+=1)
+    {
+        double best=-1;
+        for (r=0; r<rounds; r+=1)
+        {
+            JSON_STRUCT *j=NULL;
+            struct timeval t0, t1;
+            double t;
+            int rc;
+
+            if (i<2 && (j=JSON_new())==NULL)
+                return(JSON_ERR_MEM);
+            gettimeofday(&t0, NULL);
+            if (i==0)
+                rc=JSON_parseMem(buf, len, JSON_read, j);
+            else if (i==1)
+                rc=JSON_readDirectMem(buf, len, j);
+            else if (i==2)
+                rc=JSON_parseMem(buf, len, JSON_print, null);
+            else
+                rc=JSON_printDirectMem(buf, len, null);
+            gettimeofday(&t1, NULL);
+            if (j)
+                JSON_destroy(j);
+            if (rc<0)
+            {
+                fclose(null);
+                return(rc);
+            }
+
+            t=(t1.tv_sec-t0.tv_sec)+(t1.tv_usec-t0.tv_usec)/1e6;
+            if (best<0 || t<best)
+                best=t;
+        }
+        fprintf(stderr, "%-12s  %.3f s\n", name[i], best);
+    }
+    fclose(null);
+    return(0);
+}
+
+
+
+//
+//  'zcat file | json', without a shell:  the tool that fits the magic at
+//  the start of 'path' runs in a child, with its output on a pipe.  The
+//  path goes to it as an argument, as is.  NULL if that fails, otherwise
+//  the end to read from, and the child to wait for in '*pid'.
+//
+#ifndef _WIN32
+FILE *JSON_zipBenchPipe(char *path, pid_t *pid)
+{
+    u_int8_t m[4];
+    char *tool;
+    FILE *f;
+    int fd[2];
+
+    f=fopen(path, "rb");
+    if (f==NULL)
+        return(NULL);
+    memset(m, 0, 4);
+    fread(m, 1, 4, f);
+    fclose(f);
+    if (m[0]==0x1f && m[1]==0x8b)
+        tool="gzip";
+    else if (m[0]==0x28 && m[1]==0xb5 && m[2]==0x2f && m[3]==0xfd)
+        tool="zstd";
+    else
+        tool=NULL;
+
+    if (pipe(fd)<0)
+        return(NULL);
+    (*pid)=fork();
+    if ((*pid)<0)
+    {
+        close(fd[0]);
+        close(fd[1]);
+        return(NULL);
+    }
+    if ((*pid)==0)
+    {
+        dup2(fd[1], 1);
+        close(fd[0]);
+        close(fd[1]);
+        if (tool)
+            execlp(tool, tool, "-dc", path, (char*)NULL);
+        else
+            execlp("cat", "cat", path, (char*)NULL);
+        _exit(127);
+    }
+    close(fd[1]);
+    f=fdopen(fd[0], "rb");
+    if (f==NULL)
+    {
+        close(fd[0]);
+        waitpid((*pid), NULL, 0);
+    }
+    return(f);
+}
+#endif
+
+
+//
+//  Throughput of a compressed file, five ways:  piped through the
+//  external tool, as 'zcat file | json' would;  the decoder on its own;
+//  a plain parse of the whole file decompressed up front, in memory;
+//  then decompressed and parsed in line;  and with the decoder on a
+//  thread of its own.  In line costs about decode plus parse.  Threaded
+//  can at best come down to the slower of the two, and only with a
+//  processor to spare:  on one it runs in line.  The best of 'rounds' is
+//  printed, in MB/s of the compressed file.  (There is no pipe on
+//  Windows.)
+//
+int JSON_zipBench(char *path, int rounds)
+{
+    char *name[5]={"pipe", "decode", "parse", "in line", "threaded"};
+    char *all=NULL;
+    int64_t size, len=0;
+    FILE *f;
+    int i, r;
+
+    f=fopen(path, "rb");
+    if (f==NULL)
+        return(-1);
+    fseek(f, 0, SEEK_END);
+    size=ftell(f);
+    fclose(f);
+
+    for (i=0; i<5; i+=1)
+    {
+        double best=-1;
+        int64_t events=0;
+        int rc=0;
+
+#ifdef _WIN32
+        if (i==0)
+            continue;
+#endif
+        if (i==2)
+        {
+            //  Decompressed up front, not timed:
+            JSON_PARSER d;
+            f=fopen(path, "rb");
+            if (f==NULL)
+                return(-1);
+            rc=JSON_parserZip(&d, f, 0);
+            while (rc==0 && JSON_fill(&d)!=EOF)
+            {
+                char *a=(char*)realloc(all, len+d.len);
+                if (a==NULL)
+                    rc=JSON_ERR_MEM;
+                else
+                {
+                    all=a;
+                    memcpy(all+len, d.buf, d.len);
+                    len+=d.len;
+                }
+            }
+            if (rc==0)
+                rc=JSON_zipError(&d);
+            JSON_parserFree(&d);
+            fclose(f);
+            if (rc<0 || len>0x7fffffff)
+            {
+                free(all);
+                return((rc<0)?rc:JSON_ERR_MEM);
+            }
+        }
+        for (r=0; r<rounds; r+=1)
+        {
+            JSON_PARSER d;
+            struct timeval t0, t1;
+            double t;
+#ifndef _WIN32
+            pid_t pid=0;
+#endif
+
+            gettimeofday(&t0, NULL);
+            events=0;
+            if (i==0)
+            {
+#ifndef _WIN32
+                f=JSON_zipBenchPipe(path, &pid);
+#endif
+                if (f==NULL)
+                    return(-1);
+                rc=JSON_parserFile(&d, f);
+            }
+            else if (i==2)
+            {
+                JSON_parserMem(&d, all, (int)len);
+                f=NULL;
+            }
+            else
+            {
+                f=fopen(path, "rb");
+                if (f==NULL)
+                    return(-1);
+                rc=JSON_parserZip(&d, f, i==4);
+            }
+
+            if (i==1)
+            {
+                //  Only the decoder, block by block, counting bytes:
+                while (rc==0 && JSON_fill(&d)!=EOF)
+                    events+=d.len;
+                if (rc==0)
+                    rc=JSON_zipError(&d);
+            }
+            else
+            {
+                while (rc==0 && (rc=JSON_parserNext(&d, JSON_loadBenchCount, &events))>0)
+                    rc=0;
+            }
+            JSON_parserFree(&d);
+            if (f)
+                fclose(f);
+#ifndef _WIN32
+            if (i==0)
+                waitpid(pid, NULL, 0);
+#endif
+            gettimeofday(&t1, NULL);
+            if (rc<0)
+            {
+                free(all);
+                return(rc);
+            }
+
+            t=(t1.tv_sec-t0.tv_sec)+(t1.tv_usec-t0.tv_usec)/1e6;
+            if (best<0 || t<best)
+                best=t;
+        }
+        fprintf(stderr, "%-10s  %.3f s  %lld %s  %.1f MB/s\n", name[i], best, (long long) events, (i==1)?"bytes":"events", size/best/1e6);
+    }
+    free(all);
+    return(0);
+}
 
 
 
+//
+//  Number formatting on an array of 'count' doubles:  'snprintf' with
+//  "%f" as the printers used to (which is not exact), with "%.17g" (which
+//  is, but long), against 'JSON_dtoa'.  Half the array are prices with
+//  two decimals, half are random over the whole range.  The best of
+//  'rounds' is printed, with the size of the output.
+//
+int JSON_numBench(int count, int rounds)
+{
+    char *name[3]={"%f", "%.17g", "JSON_dtoa"};
+    u_int64_t x=88172645463325252ULL;
+    double *v;
+    int i, m, r;
+
+    v=(double*)malloc(count*sizeof(double));
+    if (v==NULL)
+        return(JSON_ERR_MEM);
+    for (i=0; i<count; i+=1)
+    {
+        //  xorshift:
+        x^=x<<13;
+        x^=x>>7;
+        x^=x<<17;
+        if (i&1)
+            v[i]=(double)(x%1000000)/100;
+        else
+        {
+            int e=(int)(x%600)-300;
+            v[i]=(double)(x>>11)/9007199254740992.0;
+            while (e>0)
+            {
+                v[i]*=10;
+                e-=1;
+            }
+            while (e<0)
+            {
+                v[i]/=10;
+                e+=1;
+            }
+        }
+    }
+    for (m=0; m<3; m+=1)
+    {
+        double best=-1;
+        int64_t size=0;
+        for (r=0; r<rounds; r+=1)
+        {
+            char b[400];
+            struct timeval t0, t1;
+            double t;
 
+            size=0;
+            gettimeofday(&t0, NULL);
+            for (i=0; i<count; i+=1)
+            {
+                if (m==0)
+                    size+=snprintf(b, sizeof(b), "%f", v[i]);
+                else if (m==1)
+                    size+=snprintf(b, sizeof(b), "%.17g", v[i]);
+                else
+                    size+=JSON_dtoa(b, v[i]);
+            }
+            gettimeofday(&t1, NULL);
 
+            t=(t1.tv_sec-t0.tv_sec)+(t1.tv_usec-t0.tv_usec)/1e6;
+            if (best<0 || t<best)
+                best=t;
+        }
+        fprintf(stderr, "%-10s  %.3f s  %.1f ns/number  %lld bytes\n", name[m], best, best*1e9/count, (long long) size);
+    }
+    free(v);
+    return(0);
+}
@@ -42,9 +42,12 @@
  *  upon in an application.
  *
  *  All reading/parsing is done from a stream, which might be 'stdin',
- *  or could be any opened file.  Methods are not re-entrant on a single
- *  stream because *  of the use of 'getc' and 'ungetc'.  The parser calls
- *  a callback for new objects, and items found.
+ *  or could be any opened file, or from memory.  All state of a parse
+ *  lives in its JSON_PARSER context, so parsers on different contexts
+ *  can run side by side on as many threads.  One context is used by one
+ *  thread at a time, and a stream read byte by byte is locked once, for
+ *  as long as its context holds it.  The parser calls a callback for new
+ *  objects, and items found.
  *
  *  Flatten and unflatten can be used directly in the parser stream, or using
  *  the 'walk' method for stored objects.  Manipulation, such as adding,
@@ -84,6 +87,11 @@
 #define JSON_ERR_SEP    -9         //  Missing a ':'
 #define JSON_ERR_MEM   -10         //  Out of memory
 #define JSON_ERR_DEPTH -11         //  Too many levels of nesting
+#define JSON_ERR_ZIP   -12         //  Compressed input that is corrupt, or of a format not built in
+#define JSON_ERR_ESC   -13         //  A bad escape sequence, or a control character, in a string (when decoding, or validating)
+#define JSON_ERR_UTF8  -14         //  A string is not valid UTF-8 (when decoding, or validating)
+#define JSON_ERR_NUM   -15         //  A number that does not follow the JSON grammar (when validating)
+#define JSON_ERR_MORE  -16         //  More than whitespace after the value (when validating)
 
 //  The predefined symbols:
 #define JSON_SYM_TRUE    1
@@ -105,6 +113,17 @@
 #define JSON_CMD_VAL_STR    0x40      //  String value:  'str' is valid (but now as value, not as label)
 #define JSON_CMD_VAL_SYM    0x80      //  Symbol value:  'sym' is one of JSON_SYM_*
 
+//  Integers come as VAL_NUM with one of these set as well, 'num' is then
+//  the nearest double, and 's' points to the exact value:
+#define JSON_CMD_VAL_INT    0x100     //  's' points to an int64_t
+#define JSON_CMD_VAL_UINT   0x200     //  's' points to a u_int64_t, above INT64_MAX
+#define JSON_CMD_VAL_RAW    0x400     //  's' is the text of the number, 'num' is not set (see 'raw' below)
+
+//  Strings (OLBL and STR) are as they were in the input, escape sequences
+//  and all.  Plain text, like a value given to JSON_setval, comes with this
+//  flag as well, and the printers escape it:
+#define JSON_CMD_VAL_TXT    0x800     //  's' is plain text, not JSON escaped
+
 
 
 /************************************************************************
@@ -121,7 +140,8 @@
 //  exist in the stream.  Additional calls will be needed.
 //
 //  Callback methods are provided with the follwing:
-//    cmd:  one of JSON_CMD_* -- although provided as flags, only one will ever be set
+//    cmd:  one of JSON_CMD_* -- although provided as flags, only one will ever be set,
+//          except for VAL_INT, VAL_UINT or VAL_RAW, which come with VAL_NUM
 //    r:    rank of value, starting from 0, in array or object
 //          Note:  rank is set for the value ietself in an array, but for an
 //          object, rank is only set for the OLBL, while the value is of rank 0
@@ -130,12 +150,431 @@
 //    n:    numerical value VAL_NUM or symbol VAL_SYM
 //    user: the user pointer provided as void* user
 //
+//  's' is only valid for the duration of the call:  it points into the
+//  scratch space of the parser context, which the next string or number
+//  overwrites.  A callback that needs a label later on, until its object
+//  closes say, copies it (as 'JSON_read' and 'JSON_flattenPrint' do).
+//
+//  A callback returns 0 to go on.  A negative return (JSON_ERR_MEM from
+//  'JSON_read' when it runs out of memory, say) stops the parse, which
+//  then returns that same value.  The same goes for a batch callback.
+//
 //  See below for an example 'callback' method: 'JSON_print'
 //  To parse from a memory region, simply use: 'fmemopen(buf, len, "r")'
 //
 int JSON_parse(FILE *str, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
 int JSON_parseMem(char *buf, int len, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
 
+//  Same, but from a chain of 'cnt' buffers, as they come off the network.
+//  Tokens may straddle buffers, nothing is concatenated first.
+int JSON_parseIov(const struct iovec *iov, int cnt, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
+
+
+//
+//  Instead of one call per event, the parser can also fill a tape of
+//  compact events, and hand over JSON_TAPE_EVENTS of them at a time to a
+//  'batch' callback.  Strings are copied to the tape, and last as long
+//  as the batch.  For a label or a string 's' is set, with its length in
+//  'len', for a number or a symbol 'n'.  The '*Batch' versions of the
+//  callbacks below take the events in a loop, without an indirect call
+//  for each.
+//
+#define JSON_TAPE_EVENTS 256
+#define JSON_TAPE_CHARS  (4*JSON_MAX_LEN)
+typedef struct
+{
+    u_int16_t cmd;
+    int32_t r;
+    int32_t d;
+    int32_t len;
+    union
+    {
+        char *s;
+        double n;
+        int64_t i;          //  VAL_INT
+        u_int64_t u;        //  VAL_UINT
+    }
+    v;
+}
+JSON_EVENT;
+
+//  The 's' and 'n' a callback would have been called with for 'e':
+#define JSON_EVENT_S(e) (((e).cmd&(JSON_CMD_VAL_OLBL|JSON_CMD_VAL_STR|JSON_CMD_VAL_RAW))?(e).v.s:((e).cmd&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT))?(char*)&(e).v.i:NULL)
+#define JSON_EVENT_N(e) (((e).cmd&(JSON_CMD_VAL_OLBL|JSON_CMD_VAL_STR|JSON_CMD_VAL_RAW))?0.0:((e).cmd&JSON_CMD_VAL_INT)?(double)(e).v.i:((e).cmd&JSON_CMD_VAL_UINT)?(double)(e).v.u:(e).v.n)
+
+typedef struct
+{
+    int cnt;
+    int len;
+    int (*batch)(JSON_EVENT *e, int cnt, void *user);
+    void *user;
+    int rc;                 //  What the batch callback returned, if <0
+    JSON_EVENT e[JSON_TAPE_EVENTS];
+    char s[JSON_TAPE_CHARS];
+}
+JSON_TAPE;
+
+int JSON_parseBatch(FILE *str, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user);
+int JSON_parseMemBatch(char *buf, int len, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user);
+
+
+//
+//  A parser context holds all state of a parse:  the input, a read-ahead
+//  buffer, and scratch space for strings and numbers.  Nothing is shared
+//  between contexts, so every thread can run its own.  The parse itself
+//  recurses once per level of nesting, but only with small frames.
+//
+//  'JSON_parserFile' reads the stream in blocks of JSON_PARSER_BUF, so
+//  the stream lock is taken once per block, not once per byte.  As it
+//  reads ahead, the stream belongs to the context until it is freed,
+//  and each 'JSON_parserNext' continues where the previous value ended.
+//  'JSON_parse' itself does not read past the value:  it reads byte by
+//  byte, but with 'getc_unlocked', and locks the stream once per value.
+//
+//  'JSON_parserFd' keeps several large reads of a file in flight, ahead
+//  of the parse, so that disk latency overlaps with parsing (see
+//  BEDROCK_READER).  The file must be seekable, otherwise it returns
+//  JSON_ERR_MEM as well, and 'JSON_parserFile' is the way to go.
+//
+//  'JSON_parserZip' decompresses a gzip or zstd stream straight into the
+//  read-ahead buffer, whichever it finds by the magic at the start, and
+//  anything else it reads as is.  This needs a build with -DJSON_ZLIB
+//  (and -lz) and/or -DJSON_ZSTD (and -lzstd), without it, compressed
+//  input fails with JSON_ERR_ZIP.  When 'threaded', a thread of its own
+//  decompresses a few blocks ahead, so that it overlaps with the parse.
+//  That only helps with a processor to spare, and then at best saves the
+//  time of the decoder, which is small next to the parse for gzip (see
+//  'JSON_zipBench').  With one processor it runs in line.
+//  Corrupt or cut short input makes 'JSON_parserNext' fail with
+//  JSON_ERR_ZIP.
+//
+//  'JSON_parserIov' goes through a chain of buffers one after the other.
+//  As all tokens are gathered in the scratch space anyway, one that
+//  straddles two buffers needs no special care.  Like 'JSON_parserMem'
+//  it allocates nothing.
+//
+//  'JSON_parserNext' returns 0 at the end of the input, and otherwise
+//  the same as 'JSON_parse'.  'JSON_parserMem' allocates nothing.
+//
+//  With 'raw' set on a context, numbers are not converted at all:  they
+//  come as JSON_CMD_VAL_NUM|JSON_CMD_VAL_RAW with the text as it was in
+//  the input, which the printers write out as is, and 'JSON_read' keeps.
+//  Whoever needs the value decodes it, see 'JSON_numValue'.
+//
+//  With 'decode' set, strings are decoded as they are read:  escape
+//  sequences become the characters they stand for, '\uXXXX' and surrogate
+//  pairs in UTF-8, and the UTF-8 of the input is checked.  Labels and
+//  string values then come with JSON_CMD_VAL_TXT, so the printers escape
+//  them again.  A string that does not decode fails the parse with
+//  JSON_ERR_ESC or JSON_ERR_UTF8, and 'err' is the offset in the input of
+//  the byte where it went wrong.  ('\u0000' is refused, as the strings
+//  are null-terminated.)
+//
+#define JSON_PARSER_BUF 65536
+typedef struct
+{
+    //  If the input is a stream:
+    FILE *str;
+    int lock;           //  Byte by byte, with the stream locked
+    int back;           //  The character pushed back in that case, or EOF
+
+    //  If the input is in memory, or the read-ahead of the stream:
+    char *buf;
+    int len;
+    int pos;
+    char *own;          //  The read-ahead buffer, if allocated
+    BEDROCK_READER *rd; //  Or the asynchronous read-ahead of a file
+    const struct iovec *iov;    //  Or the buffers still to come of a chain
+    int iovCnt;
+    void *zip;          //  Or the decompression of a stream
+
+    //  Events go to this tape, when set, instead of to the callback:
+    JSON_TAPE *tape;
+    int raw;            //  Numbers are passed on as text, set after init
+    int decode;         //  Strings are decoded to plain text, set after init
+    int64_t off;        //  Bytes of the input before 'buf'
+    int64_t err;        //  Where a string was found invalid, or -1
+
+    //  Scratch space for the current string or number:
+    char s[JSON_MAX_LEN];
+}
+JSON_PARSER;
+
+void JSON_parserMem(JSON_PARSER *p, char *buf, int len);
+int JSON_parserFile(JSON_PARSER *p, FILE *str);
+int JSON_parserFd(JSON_PARSER *p, int fd);
+void JSON_parserIov(JSON_PARSER *p, const struct iovec *iov, int cnt);
+int JSON_parserZip(JSON_PARSER *p, FILE *str, int threaded);
+int JSON_parserNext(JSON_PARSER *p, int (*callback)(int cmd, int r, int d, char *s, double n, void *user), void *user);
+void JSON_parserFree(JSON_PARSER *p);
+int JSON_parserNextBatch(JSON_PARSER *p, int (*batch)(JSON_EVENT *e, int cnt, void *user), void *user);
+
+
+
+//
+//  Only checks that 'buf' is one JSON value, with nothing but whitespace
+//  around it:  the grammar, the escapes in strings, the number syntax,
+//  and with 'utf8' set also that strings are valid UTF-8 (and surrogate
+//  escapes come in pairs).  No callbacks, no copies, no conversions.
+//  Returns 0 if valid, or the JSON_ERR_* code, which also goes in 'rc'
+//  with the offset in 'buf' and the depth where it went wrong.  'v' may
+//  be NULL.  Nesting deeper than JSON_VALID_DEPTH fails with JSON_ERR_DEPTH.
+//
+#define JSON_VALID_DEPTH 1024
+typedef struct
+{
+    int utf8;           //  Check the UTF-8 of strings as well, set before
+    int rc;
+    int64_t off;
+    int depth;
+}
+JSON_VALID;
+
+int JSON_validate(const char *buf, int64_t len, JSON_VALID *v);
+
+
+
+//
+//  When the callback is known when compiling, this generates a parser
+//  that calls it directly, so the compiler can inline it into the parse:
+//
+//      JSON_DEFINE_PARSER(myParse, myCallback)
+//
+//  defines 'int myParse(JSON_PARSER *d, void *user)', which parses one
+//  value like 'JSON_parserNext' (without the check for the end), and
+//  'int myParseMem(char *buf, int len, void *user)'.  Expand it in the
+//  file where the callback is defined, after it.  The parse is the same
+//  as that of 'JSON_parse', events go to the callback, never to a tape.
+//
+#define JSON_GETC(d) (((*(d)).pos<(*(d)).len)?(u_int8_t)(*(d)).buf[(*(d)).pos++]:JSON_fill(d))
+#define JSON_TXT(d) ((*(d)).decode?JSON_CMD_VAL_TXT:0)     //  What strings come with
+#define JSON_CALL(x) do { int rc=(x); if (rc<0) return(rc); } while (0)   //  A callback error stops the parse
+
+#define JSON_DEFINE_PARSER(name, callback) \
+int name##Array(JSON_PARSER *d, int rank, int depth, void *user); \
+int name##Object(JSON_PARSER *d, int rank, int depth, void *user); \
+\
+int name##Value(JSON_PARSER *d, int rank, int depth, void *user) \
+{ \
+    int n=JSON_ws(d); \
+    int m; \
+    double num; \
+    u_int64_t i; \
+    int cmd; \
+    int sym; \
+    char *ns; \
+    m=JSON_string(d, (*d).s, JSON_MAX_LEN); \
+    if (m>0) \
+        JSON_CALL(callback(JSON_CMD_VAL_STR|JSON_TXT(d), rank, depth, (*d).s, 0.0, user)); \
+    if (m==0) \
+    { \
+        m=JSON_num(d, (*d).s, &num, &cmd, &i); \
+        ns=(cmd&JSON_CMD_VAL_RAW)?(*d).s:(cmd&(JSON_CMD_VAL_INT|JSON_CMD_VAL_UINT))?(char*)&i:NULL; \
+        if (m>0) \
+            JSON_CALL(callback(cmd, rank, depth, ns, num, user)); \
+    } \
+    if (m==0) \
+    { \
+        m=JSON_symbol(d, &sym); \
+        if (m>0) \
+            JSON_CALL(callback(JSON_CMD_VAL_SYM, rank, depth, NULL, sym, user)); \
+    } \
+    if (m==0) \
+        m=name##Object(d, rank, depth, user); \
+    if (m==0) \
+        m=name##Array(d, rank, depth, user); \
+    if (m>0) \
+        return(n+m+JSON_ws(d)); \
+    if (m<0) \
+        return(m); \
+    return(JSON_ERR_VALUE); \
+} \
+\
+int name##Array(JSON_PARSER *d, int rank, int depth, void *user) \
+{ \
+    int c, m; \
+    int n=1; \
+    int v=0; \
+    c=JSON_GETC(d); \
+    if (!(c=='[' || c==EOF)) \
+    { \
+        JSON_ungetc(c, d); \
+        return(0); \
+    } \
+    JSON_CALL(callback(JSON_CMD_NEW_ARRAY, rank, depth, NULL, 0.0, user)); \
+    n+=JSON_ws(d); \
+    c=JSON_GETC(d); \
+    if (c==']') \
+    { \
+        JSON_CALL(callback(JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, user)); \
+        return(n+1); \
+    } \
+    else if (c!=EOF) \
+        JSON_ungetc(c, d); \
+    do \
+    { \
+        m=name##Value(d, v, depth+1, user); \
+        if (m<=0) \
+            return(m); \
+        n+=m+1; \
+        v+=1; \
+        c=JSON_GETC(d); \
+        if (!(c==',' || c==']' || c==EOF)) \
+            return(JSON_ERR_ARRAY); \
+    } \
+    while (c==','); \
+    if (c!=']') \
+        return(JSON_ERR_END_A); \
+    JSON_CALL(callback(JSON_CMD_END_ARRAY, rank, depth, NULL, 0.0, user)); \
+    return(n); \
+} \
+\
+int name##Object(JSON_PARSER *d, int rank, int depth, void *user) \
+{ \
+    int c, m; \
+    int n=1; \
+    int v=0; \
+    c=JSON_GETC(d); \
+    if (!(c=='{' || c==EOF)) \
+    { \
+        JSON_ungetc(c, d); \
+        return(0); \
+    } \
+    JSON_CALL(callback(JSON_CMD_NEW_OBJ, rank, depth, NULL, 0.0, user)); \
+    n+=JSON_ws(d); \
+    c=JSON_GETC(d); \
+    if (c=='}') \
+    { \
+        JSON_CALL(callback(JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, user)); \
+        return(n+1); \
+    } \
+    else if (c!=EOF) \
+        JSON_ungetc(c, d); \
+    do \
+    { \
+        n+=JSON_ws(d); \
+        m=JSON_string(d, (*d).s, JSON_MAX_LEN); \
+        if (m<2) \
+            return(m); \
+        n+=m+JSON_ws(d); \
+        c=JSON_GETC(d); \
+        if (c!=':') \
+            return(JSON_ERR_SEP); \
+        JSON_CALL(callback(JSON_CMD_VAL_OLBL|JSON_TXT(d), v, depth+1, (*d).s, 0.0, user)); \
+        m=name##Value(d, 0, depth+1, user); \
+        if (m<=0) \
+            return(m); \
+        n+=m+2; \
+        v+=1; \
+        c=JSON_GETC(d); \
+        if (!(c==',' || c=='}' || c==EOF)) \
+            return(JSON_ERR_OBJ); \
+    } \
+    while (c==','); \
+    if (c!='}') \
+        return(JSON_ERR_END_O); \
+    JSON_CALL(callback(JSON_CMD_END_OBJ, rank, depth, NULL, 0.0, user)); \
+    return(n); \
+} \
+\
+int name(JSON_PARSER *d, void *user) \
+{ \
+    int rc=name##Value(d, 0, 0, user); \
+    if (rc<0) \
+        JSON_parseError(rc); \
+    return(rc); \
+} \
+\
+int name##Mem(char *buf, int len, void *user) \
+{ \
+    JSON_PARSER d; \
+    JSON_parserMem(&d, buf, len); \
+    return(name(&d, user)); \
+}
+
+
+//
+//  Numbers are printed in the shortest form that reads back to the same
+//  double:  integral values as integers, everything else as Grisu2 digits,
+//  in exponent notation outside 1e-6..1e21.  Where Grisu2 cannot tell if
+//  fewer digits would do (1e23, say), the shorter lengths are tried with
+//  'snprintf' and 'strtod'.  Infinity and NaN, which JSON has no form for,
+//  are printed as null.  'buf' takes JSON_NUM_LEN chars; the length of the
+//  terminated string is returned.
+//
+#define JSON_NUM_LEN 32
+int JSON_dtoa(char *buf, double n);
+int JSON_itoa(char *buf, int64_t i);
+int JSON_utoa(char *buf, u_int64_t u);
+
+//  A number as the callbacks get it, exact if it came as an integer:
+int JSON_numtoa(char *buf, int cmd, char *s, double n);
+
+//  The value of a number event, decoded here if it came raw:
+double JSON_numValue(int cmd, char *s, double n);
+
+
+//
+//  Plain text is escaped for output.  'JSON_escSpan' is the length of the
+//  run at the start of 's' that needs no escape (all but '"', '\\' and the
+//  control characters), found 32 bytes at a time.  'JSON_escChar' writes
+//  the escape of one character to 'buf' (at most 6), and returns its
+//  length.  'JSON_escLen' is the escaped length of 's', and 'JSON_escCopy'
+//  writes it to 'buf', which must have the room.
+//
+int64_t JSON_escSpan(const char *s, int64_t len);
+int JSON_escChar(char *buf, int c);
+int64_t JSON_escLen(const char *s, int64_t len);
+int64_t JSON_escCopy(char *buf, const char *s, int64_t len);
+
+
+//
+//  All printers write through an output sink:  a large buffer that goes
+//  out in one write per flush, to a stream, a file descriptor, or that
+//  grows in memory (the output is then in 'buf', 'len' long).  Literals
+//  and strings are copied in, without format strings.  'JSON_outFree'
+//  flushes first.  On a failed write or allocation 'err' is set, and
+//  the rest is dropped.
+//
+#define JSON_OUT_BUF 65536
+typedef struct
+{
+    FILE *str;
+    int fd;                 //  -1 if not to a file descriptor
+    int grow;               //  To memory
+    int own;                //  'buf' was allocated here
+    int err;
+    char *buf;
+    int64_t len;
+    int64_t cap;
+}
+JSON_OUT;
+
+int JSON_outFile(JSON_OUT *o, FILE *str);
+int JSON_outFd(JSON_OUT *o, int fd);
+int JSON_outMem(JSON_OUT *o);
+void JSON_outWrite(JSON_OUT *o, const char *s, int64_t len);
+void JSON_outStr(JSON_OUT *o, const char *s);
+void JSON_outNum(JSON_OUT *o, double n);
+void JSON_outNumber(JSON_OUT *o, int cmd, char *s, double n);
+void JSON_outEsc(JSON_OUT *o, const char *s);
+void JSON_outString(JSON_OUT *o, int cmd, const char *s);
+int JSON_outFlush(JSON_OUT *o);
+void JSON_outFree(JSON_OUT *o);
+
+#define JSON_OUTC(o, c) \
+    do \
+    { \
+        if ((*(o)).len<(*(o)).cap) \
+            (*(o)).buf[(*(o)).len++]=(c); \
+        else \
+        { \
+            char JSON_c=(c); \
+            JSON_outWrite((o), &JSON_c, 1); \
+        } \
+    } \
+    while (0)
+
 
 //
 //  This example callback just prints the JSON that is parsed without
@@ -152,6 +591,11 @@ int JSON_parseMem(char *buf, int len, int (*callback)(int cmd, int r, int d, cha
 //  Return code:  0 contines parsing <>0 stops parsing
 //  Incidently an excellent method for printing JSON:
 int JSON_print(int cmd, int r, int d, char *s, double n, void *user);
+int JSON_printBatch(JSON_EVENT *e, int cnt, void *user);
+
+//  The same, to a sink as the 'user' pointer, which is faster still:
+int JSON_printOut(int cmd, int r, int d, char *s, double n, void *user);
+int JSON_printOutBatch(JSON_EVENT *e, int cnt, void *user);
 
 
 
@@ -164,16 +608,21 @@ typedef struct
     FILE *str;
     int prev;
     int color;
+    JSON_OUT *out;          //  If set, printed here instead of to 'str'
 }
 JSON_PRETTYPRINT_CONF;
 
 //  Init the prettyprint callback::
 void JSON_prettyPrintInit(JSON_PRETTYPRINT_CONF *c, FILE *str);
+void JSON_prettyPrintInitOut(JSON_PRETTYPRINT_CONF *c, JSON_OUT *out);
 int JSON_prettyPrint(int cmd, int r, int d, char *s, double n, void *user);
 
 
 //
 //  And once more the same, but this time printing to a character buffer:
+//  Like 'snprintf' the output is cut off at 'len' (and terminated), but
+//  'pos' counts all of it, so after the parse or walk 'pos>=len' means
+//  it did not fit, and 'pos+1' is what it takes.
 //
 typedef struct
 {
@@ -186,6 +635,9 @@ JSON_SNPRINT_CONF;
 void JSON_snprintInit(JSON_SNPRINT_CONF *c, char *buf, int len);
 int JSON_snprint(int cmd, int r, int d, char *s, double n, void *user);
 
+//  Only adds up what 'JSON_print' would print, in the int64_t at 'user':
+int JSON_printSize(int cmd, int r, int d, char *s, double n, void *user);
+
 
 
 
@@ -200,8 +652,15 @@ int JSON_snprint(int cmd, int r, int d, char *s, double n, void *user);
 //
 //  Memset to zero, and set:
 //  EITHER:  'str'
-//  OR:      'buf' an 'len'
+//  OR:      'buf' an 'len' (cut off and counted in 'pos' like JSON_snprint)
+//  OR:      'out', a sink
 //
+//  The path is kept as a string, with the end of each level, so that a
+//  value only takes the level it is on to be put in place:  a label is
+//  copied in (and does not need to outlive its event), an index printed.
+//  A path longer than JSON_FLATTEN_PATH stops with JSON_ERR_LEN in 'rc'.
+//
+#define JSON_FLATTEN_PATH (4*JSON_MAX_LEN)
 typedef struct
 {
     //  What we are outputting to:
@@ -209,15 +668,18 @@ typedef struct
     char *buf;                       //  Or a char buf
     int len;
     int pos;
+    JSON_OUT *out;                   //  Or a sink
     //  Bookkeeping:
-    char *strStack[JSON_MAX_DEPTH];  //  Pointers to the field names
-    int index[JSON_MAX_DEPTH];       //  Array index
+    char path[JSON_FLATTEN_PATH];    //  The path down to the current value
+    int end[JSON_MAX_DEPTH+1];       //  Where the path to each depth ends
+    int8_t lbl[JSON_MAX_DEPTH];      //  The level is an object label, or an array index
     int rc;                          //  If there was any error
 }
 JSON_FLATTEN_CONF;
 
 //  Use this to quickly initialize:
 int JSON_flattenPrintInit(JSON_FLATTEN_CONF *c, FILE *str, char *buf, int len);
+int JSON_flattenPrintInitOut(JSON_FLATTEN_CONF *c, JSON_OUT *out);
 
 
 //  
@@ -226,6 +688,7 @@ int JSON_flattenPrintInit(JSON_FLATTEN_CONF *c, FILE *str, char *buf, int len);
 //  'Print' needs a JSON_FLATTEN_CONF as the 'user' pointer:
 //
 int JSON_flattenPrint(int cmd, int r, int d, char *s, double n, void *user);
+int JSON_flattenPrintBatch(JSON_EVENT *e, int cnt, void *user);
 int JSON_flattenParse(FILE *str, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user);
 int JSON_flattenParseMem(char *buf, int len, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user);
 
@@ -254,16 +717,33 @@ int JSON_flattenParseMem(char *buf, int len, int (*callback)(int cmd, int c, int
 //  or a singular value.  There is NEVER a 'next' pointer for the
 //  toplevel node.
 //
+//  Arrays and objects keep a count of their children in 'cnt', and a
+//  pointer to the last one in 'last'.  All methods below maintain these.
+//  Code that stitches nodes together by hand must keep them up to date
+//  as well, or use 'JSON_appendChild'.
+//
 //  Memory is allocated in chunks of 'JSON_NODE's and also
 //  in swatchs of 'char'.  All memory is freed upon the call
 //  to the destructor.  Strings are stored linearly in chunks,
 //  but duplicates strings are not tracked and simply stored twice.
+//  Every string in the tree is owned by the tree:  when a node is
+//  flushed its label and string are returned to the pool for re-use.
 //
 
-#define JSON_ALLOC_CNT_NODE 128     //  A node is 32 byte, so this allocated at 4kb each
+//  The first chunks are small.  Each next chunk is twice as big, up to
+//  (*j).chunkMax bytes (JSON_CHUNK_MAX if 0), so that big documents do
+//  not take millions of allocations.  The longest string is always
+//  JSON_ALLOC_CNT_CHAR, the size of the first string chunk.
+#define JSON_ALLOC_CNT_NODE 128     //  A node is 40 byte, so the first chunk is 5kb
 #define JSON_ALLOC_CNT_CHAR 2*JSON_MAX_LEN-16 //  The struct is 16 bytes, so allocate n*MAX_LEN-16
-
-#define JSON_FLG_1ST   0x40     //  The first node in an allocation sequence.
+#define JSON_CHUNK_MAX (2<<20)      //  Default largest chunk, one huge page
+
+#define JSON_FLG_LTXT 0x800     //  The 'label' is plain text (JSON_CMD_VAL_TXT)
+#define JSON_FLG_TXT  0x400     //  The string in 'value.string' is plain text (JSON_CMD_VAL_TXT)
+#define JSON_FLG_RAW  0x200     //  Number is the text in 'value.string', as it was parsed
+#define JSON_FLG_UINT 0x100     //  Number is a u_int64_t in 'value.u', above INT64_MAX
+#define JSON_FLG_IDX   0x80     //  Array has a side index (see JSON_INDEX below).
+#define JSON_FLG_INT   0x40     //  Number is an int64_t in 'value.i'
 #define JSON_FLG_LBL   0x20     //  The 'label' is valid, this is an object item.
 #define JSON_FLG_NUM   0x10     //  Value is a number.
 #define JSON_FLG_STR   0x08     //  String.
@@ -277,19 +757,48 @@ typedef struct JSON_NODE_S
 
     //  A label, if this is an item in an object:
     char *label;
-    int8_t f;   //  General flags.
+    u_int16_t f; //  General flags.
+
+    //  For arrays and objects, the number of children:
+    int32_t cnt;
 
     //  The value, only 1 is used:
     union
     {
         double num;
+        int64_t i;                  //  JSON_FLG_INT
+        u_int64_t u;                //  JSON_FLG_UINT
         char *string;
         struct JSON_NODE_S *child;   //  A value that is an array or an object:
     }
     value;
+
+    //  For arrays and objects, the last child (so appends are O(1)):
+    struct JSON_NODE_S *last;
 }
 JSON_NODE;
 
+//  The value of a number node, whichever way it is stored.  'JSON_nodeInt'
+//  returns JSON_CMD_VAL_INT or JSON_CMD_VAL_UINT with the exact value in
+//  'i' (as with 'JSON_atoi'), or 0 if it is not a 64-bit integer:
+double JSON_nodeNum(JSON_NODE *n);
+int JSON_nodeInt(JSON_NODE *n, u_int64_t *i);
+
+//  Nodes are allocated in chunks of 'cnt' nodes, and handed out
+//  in order.  The chunks are kept on a list, so that flushing only has to
+//  rewind to the first chunk, and destroying only has to free the chunks.
+//  Nodes freed individually (delete, update) go onto the 'freeStack' of
+//  the JSON_STRUCT, and are re-used first.
+typedef struct JSON_NODES_S
+{
+    struct JSON_NODES_S *next;
+    int32_t pos;        //  Nodes handed out from 'n'
+    int32_t cnt;        //  Size of 'n'
+    JSON_NODE n[];
+}
+JSON_NODES;
+#define JSON_NODES_SIZE(c) (sizeof(JSON_NODES)+(c)*sizeof(JSON_NODE))
+
 //  Memory allocation for character strings.  These objects hold
 //  the pointers to each allocated characer string region.  Each time
 //  a string is written, the block with the least free space is used
@@ -301,12 +810,110 @@ JSON_NODE;
 typedef struct JSON_STRING_S
 {
     struct JSON_STRING_S *next;
-    int64_t pos;        //  Left is:  JSON_ALLOC_CNT_CHAR-pos
-    char m[JSON_ALLOC_CNT_CHAR];
+    int32_t pos;        //  Left is:  len-pos
+    int32_t len;        //  Size of 'm'
+    char m[];
 }
 JSON_STRING;
+#define JSON_STRING_SIZE(c) (sizeof(JSON_STRING)+(c))
+
+//  Strings are allocated in spans rounded up to a size class:  steps of
+//  8 bytes up to 256, then steps of about 1.4x.  Freed spans are kept in
+//  a free list per class, for re-use by 'JSON_newString'.  Spans are not
+//  split or merged, so a steady state of updates does not grow the pool.
+//  The free list pointer is stored in the span itself.
+#define JSON_STRING_ALIGN    8      //  Smallest span, and the step size
+#define JSON_STRING_CLASSES 44      //  Up to JSON_ALLOC_CNT_CHAR
+typedef struct JSON_SPAN_S
+{
+    struct JSON_SPAN_S *next;
+}
+JSON_SPAN;
+
+
+//  Large arrays get a side index:  a contiguous vector of pointers to
+//  the children, in order, with the length cached.  This makes the '[n]'
+//  query step, the size of the array, and finding its last element O(1).
+//  The index is built lazily on the first indexed access of an array with
+//  at least JSON_INDEX_MIN children, kept up to date by the query primitives,
+//  and freed when the array is flushed.  The array node has JSON_FLG_IDX set
+//  while an index exists.  Code that stitches array children by hand must
+//  call 'JSON_indexDrop' on the array first.
+#define JSON_INDEX_MIN  64          //  Shorter arrays are simply walked
+#define JSON_INDEX_HASH 64          //  Buckets in the index table
+typedef struct JSON_INDEX_S
+{
+    struct JSON_INDEX_S *next;      //  Hash chain
+    JSON_NODE *arr;                 //  The array node that is indexed
+    int cnt;                        //  Number of children
+    int cap;                        //  Allocated slots in 'v'
+    JSON_NODE **v;                  //  The children
+}
+JSON_INDEX;
 
 
+//  State of an incremental compaction, see 'JSON_compact' below.
+//  Memset to zero before the first call.
+#define JSON_COMPACT_SPARSE  50     //  Evacuate chunks less than this % in use
+typedef struct
+{
+    int phase;                      //  Where we are, 0 is the start of a pass
+    u_int64_t gen;                  //  Generation of the JSON_STRUCT the walk is valid for
+
+    //  Walk through the tree:
+    JSON_NODE *stack[JSON_MAX_DEPTH];
+    JSON_NODE *c;
+    int top;
+    int8_t s;
+
+    //  The string chunks that existed at the start of the pass:
+    JSON_STRING **chunks;           //  Sorted by address
+    int64_t *live;                  //  Bytes in use in each
+    u_int8_t *evac;                 //  Set if the chunk is being emptied
+    int cnt;
+
+    //  The same for the node chunks that were full at the start:
+    JSON_NODES **nodeChunks;
+    int64_t *nodeLive;              //  Nodes in use in each
+    u_int8_t *nodeEvac;
+    int nodeCnt;
+    int deep;                       //  The walk met nodes below JSON_MAX_DEPTH
+
+    //  Statistics:
+    int64_t moved;                  //  Bytes of strings moved
+    int64_t nodesMoved;             //  Nodes moved
+    int64_t reclaimed;              //  Bytes of chunks freed
+}
+JSON_COMPACT;
+
+
+//  All memory of a JSON_STRUCT (the struct itself, the node and string
+//  chunks, side indexes, and compaction state) comes from its allocator.
+//  'free' is passed the same size as the 'alloc' was, and may be NULL if
+//  the memory is released some other way.  Without callbacks (all zero)
+//  it is malloc and free.
+typedef struct
+{
+    void *(*alloc)(size_t size, void *user);
+    void (*free)(void *p, size_t size, void *user);
+    void *user;
+}
+JSON_ALLOCATOR;
+
+
+//  A caller supplied region of memory, see 'JSON_newArena' below.  It
+//  hands out memory front to back, and only takes back the last piece.
+#define JSON_ARENA_FAIL    0        //  When full, allocations fail (JSON_ERR_MEM)
+#define JSON_ARENA_MALLOC  1        //  When full, allocations go to malloc
+typedef struct
+{
+    char *m;
+    size_t len;
+    size_t pos;
+    int overflow;                   //  JSON_ARENA_FAIL or JSON_ARENA_MALLOC
+}
+JSON_ARENA;
+
 
 typedef struct
 {
@@ -316,9 +923,26 @@ typedef struct
     int prev;   //  Previous command
 
     //  The allocated nodes, and string pools
+    JSON_NODES *nodes;              //  All node chunks
+    JSON_NODES *nodeChunk;          //  The one nodes are handed out from
     JSON_NODE *freeStack;           //  Just a list of free ones
     JSON_STRING *stringPool;        //  Sorted list of pools, with still some space.
     JSON_STRING *usedStrings;       //  Not enough space left in these.
+    JSON_SPAN *freeStrings[JSON_STRING_CLASSES];    //  Freed spans, by class
+
+    //  Side indexes of large arrays, hashed by array node:
+    JSON_INDEX *index[JSON_INDEX_HASH];
+
+    //  Counts flushes, and deletes through the path of a compaction in
+    //  progress, so that it can tell if its walk was cut in between steps:
+    u_int64_t gen;
+    JSON_COMPACT *compact;          //  The compaction in progress, if any
+
+    //  Where the memory comes from:
+    JSON_ALLOCATOR mem;
+    int64_t chunkMax;               //  Largest chunk in bytes, may be set after JSON_new
+    int64_t nodeBytes;              //  Size of the last node chunk allocated
+    int64_t stringBytes;            //  Same, for strings
 
     //  The actual parsed object:
     JSON_NODE *obj;                 //  Either singular, or compound, but cannot have '->next'
@@ -338,17 +962,56 @@ JSON_STRUCT *JSON_new();
 void JSON_flush(JSON_STRUCT *j);
 void JSON_destroy(JSON_STRUCT *j);
 
+//  Same, but all memory comes from the callbacks in 'a' (which is copied).
+//  Useful for per-thread pools, or special memory.
+JSON_STRUCT *JSON_newWithAllocator(JSON_ALLOCATOR *a);
+
+//  Same, but all memory comes from 'buf', including the JSON_STRUCT
+//  and the JSON_ARENA itself.  With JSON_ARENA_FAIL, parsing a message
+//  that fits does no malloc at all.  When the arena runs low the node and
+//  string chunks get smaller, down to what the next one needs, so a small
+//  message fits in little more than the struct and its own size.  When it
+//  runs out, 'JSON_read' returns JSON_ERR_MEM, and so does the parse.
+//  Returns NULL if 'len' is too small to even hold the struct.  'buf'
+//  must outlive the struct, and
+//  JSON_destroy does not free it.  Clones of an arena based struct use
+//  malloc.
+JSON_STRUCT *JSON_newArena(void *buf, size_t len, int overflow);
+
+//  An allocator for big documents:  chunks over half a huge page are
+//  mapped straight from the OS, and backed by huge pages where the OS
+//  allows (see BEDROCK_pageAlloc).  Smaller ones use malloc.  Use as:
+//      JSON_ALLOCATOR a={JSON_hugeAlloc, JSON_hugeFree, NULL};
+void *JSON_hugeAlloc(size_t size, void *user);
+void JSON_hugeFree(void *p, size_t size, void *user);
+
 
 //  Cloning can be helpful after a slew of operations has left
-//  strings unreferenced, and unused, but allocated, nodes.
+//  free, but allocated, nodes and string space.
 //  Returns a full struct with the same configu as 'j'.
 JSON_STRUCT *JSON_clone(JSON_STRUCT *j);
 
 
+//  Compaction does the same in place, and in small steps.  Each call
+//  visits at most 'budget' nodes, and returns 0 while there is more to do,
+//  1 when the pass is complete, or JSON_ERR_MEM.  A pass first measures the
+//  use of each string chunk and each full node chunk, and then moves the
+//  strings and nodes out of the sparse ones, which are freed at the end.
+//  The tree may be used and changed in between calls.  Only a delete of
+//  a node on the path down to where the walk is restarts the current phase
+//  of the walk, other changes do not hold it up.  Pointers to nodes and strings
+//  held from before a call may be stale after it.  Call 'JSON_compactAbort'
+//  to give up on a pass before it completes.  The number of bytes returned
+//  to the system is in (*c).reclaimed.
+int JSON_compact(JSON_STRUCT *j, JSON_COMPACT *c, int budget);
+void JSON_compactAbort(JSON_STRUCT *j, JSON_COMPACT *c);
+
+
 //  Method to read to memory. 
 //  Pass this method to 'JSON_parse', where
 //  the 'user' pointer must be a JSON_STRUCT*.
 int JSON_read(int cmd, int r, int d, char *s, double n, void *user);
+int JSON_readBatch(JSON_EVENT *e, int cnt, void *user);
 
 //  Walks the memory structure, given a callback, such
 //  as the 'JSON_prettyPrint' method to print the memory
@@ -356,6 +1019,73 @@ int JSON_read(int cmd, int r, int d, char *s, double n, void *user);
 //      JSON_walk(j, JSON_prettyPrint, (void*) &c);
 void JSON_walk(JSON_STRUCT *j, int (*callback)(int cmd, int c, int d, char *s, double n, void *user), void *user);
 
+//  The structure printed without whitespace, to a new buffer that holds
+//  exactly that (and a terminating 0), to be released with 'free'.  One
+//  walk adds up the size, a second one prints.  The length goes to 'len'
+//  if set.  NULL if out of memory.  (Printing with 'JSON_printOut' to a
+//  sink from 'JSON_outMem' does it in one walk, but grows as it goes.)
+char *JSON_sprint(JSON_STRUCT *j, int64_t *len);
+
+
+
+//
+//  Pipelined parsing of one JSON value per line (NDJSON).  The calling
+//  thread reads the stream in blocks of whole lines, 'parsers' threads
+//  parse each line into a JSON_STRUCT, and 'consumers' threads call
+//  'consume' on each.  The stages are connected by lock-free rings, and
+//  records travel in batches of 'batch' to keep the traffic on the rings
+//  low.  Blocks and structs are recycled, so once warmed up, nothing is
+//  allocated.  The struct is flushed after 'consume' returns, so keep
+//  nothing of it.
+//
+//  Records arrive at the consumers out of order, 'n' is the line number
+//  (from 0).  If 'consume' returns <0 the pipeline winds down.  Lines
+//  that do not parse are counted in 'errors'.  Set the first part of the
+//  struct, zero is the default for each, and call 'JSON_pipeline'.  It
+//  returns the number of records consumed, or JSON_ERR_MEM.
+//
+#define JSON_PIPELINE_BLOCK  (1<<20)    //  Bytes per block, grows for longer lines
+#define JSON_PIPELINE_BATCH  64         //  Records per batch
+typedef struct
+{
+    char *buf;
+    int64_t len;
+    int64_t cap;
+    int64_t first;          //  Line number of the first line
+}
+JSON_BLOCK;
+
+typedef struct
+{
+    int cnt;
+    JSON_STRUCT **j;
+    int64_t *n;
+}
+JSON_BATCH;
+
+typedef struct
+{
+    //  Set by the caller:
+    int parsers;            //  Parser threads (one per processor)
+    int consumers;          //  Consumer threads (1)
+    int batch;              //  Records per batch (JSON_PIPELINE_BATCH)
+    int (*consume)(JSON_STRUCT *j, int64_t n, void *user);
+    void *user;
+
+    //  Results:
+    int64_t records;
+    int64_t errors;
+
+    //  Internal:
+    int64_t stop;
+    BEDROCK_MPMC blocks, freeBlocks;
+    BEDROCK_MPMC batches, freeBatches;
+}
+JSON_PIPELINE;
+
+int JSON_pipeline(FILE *str, JSON_PIPELINE *p);
+int JSON_pipelineFd(int fd, JSON_PIPELINE *p);      //  With read-ahead, see 'JSON_parserFd'
+
 
 
 
@@ -417,12 +1147,12 @@ int JSON_queryParse(char *qStr, JSON_QUERY *q);
 void JSON_retrieve(JSON_STRUCT *j, JSON_QUERY *q, void (*callback)(JSON_NODE *n, void *user), void *user);
 
 //
-//  IMPORTANT:  when adding/inserting/updating the new node(s) 'n' must have either:
-//  1)  Their strings allocated in 'j' (use 'JSON_newString'), OR:
-//  2)  Their strings may be external but MUST persist byond the lifetime of 'j'
+//  When adding/inserting/updating, the new node(s) 'n' may have their strings
+//  allocated anywhere, as long as they exist for the duration of the call.
 //
-//  The new nodes 'n' are cloned upon adding into the object under 'j', therefore
-//  they themselves may be flushed or deallocated after the operation completes.
+//  The new nodes 'n' are cloned upon adding into the object under 'j', strings
+//  included, therefore they themselves may be flushed or deallocated after the
+//  operation completes.
 //
 //  Updating and adding of 'n' to an array then 'n' must NOT have a label set.
 //  When manipulating an object that 'n' does need a label set, unless:
@@ -439,8 +1169,7 @@ void JSON_update(JSON_STRUCT *j, JSON_QUERY *q, JSON_NODE *n);
 
 
 //  Flushes ALL nodes, including objects and arrays, that match the query 'q'
-//  Note that strings remain allocated in 'j'.  When a lot of string space
-//  is lost this way then simply clone 'j'.
+//  Their strings are returned to the pool in 'j' for re-use.
 void JSON_delete(JSON_STRUCT *j, JSON_QUERY *q);
 
 
@@ -481,6 +1210,9 @@ int JSON_getObjectSize(JSON_STRUCT *j, JSON_QUERY *q, JSON_NODE **lastNode);
 //  Singular value.  Values are always returned as strings.
 //  Upon 'set' if a value is 'true/false' or a number it will
 //  be stored as such properly (ie. not as a string)
+//  If a missing part of the path would go below an existing value of
+//  the other kind (an index into an object, or a label into an array)
+//  nothing is added, and 'JSON_setval' returns JSON_RC_NOTFOUND.
 int JSON_getval(JSON_STRUCT *j, char *path, char *val, int len);
 int JSON_setval(JSON_STRUCT *j, char *path, char *val);
 int JSON_clrval(JSON_STRUCT *j, char *path);
@@ -496,10 +1228,41 @@ int JSON_clrval(JSON_STRUCT *j, char *path);
 
 
 
+//  The primitives of the parser, for JSON_DEFINE_PARSER:
+int JSON_fill(JSON_PARSER *d);
+int JSON_fgetc(JSON_PARSER *d);
+int JSON_ungetc(int c, JSON_PARSER *d);
+int JSON_ws(JSON_PARSER *d);
+int JSON_num(JSON_PARSER *d, char *ns, double *num, int *cmd, u_int64_t *i);
+int JSON_atoi(const char *s, u_int64_t *i);
+int JSON_string(JSON_PARSER *d, char *s, int l);
+int JSON_stringDecode(JSON_PARSER *d, char *s, int l);
+int JSON_symbol(JSON_PARSER *d, int *sym);
+void JSON_parseError(int rc);
+
 //  Some internal methods:
+void *JSON_alloc(JSON_STRUCT *j, size_t size);
+void JSON_free(JSON_STRUCT *j, void *p, size_t size);
+void *JSON_arenaAlloc(size_t size, void *user);
+void JSON_arenaFree(void *p, size_t size, void *user);
 JSON_NODE *JSON_newNode(JSON_STRUCT *j);
+int JSON_nodetoa(char *buf, JSON_NODE *n);
+int64_t JSON_span(const char *s, int64_t len, int high);
+int JSON_utf8(const u_int8_t *p, int n);
+int JSON_utf8Put(char *s, int u);
+int JSON_hex4(JSON_PARSER *d);
+int JSON_validHex(const char *p);
+int JSON_validString(const char *buf, int64_t len, int64_t *pos, int utf8);
+int JSON_validNumber(const char *buf, int64_t len, int64_t *pos);
 char *JSON_newString(JSON_STRUCT *j, int len);
 
+//  Returns string 's', which MUST have come from 'JSON_newString' on 'j',
+//  to the free lists.  The span size is taken from 'strlen(s)'.
+void JSON_freeString(JSON_STRUCT *j, char *s);
+
+//  The same for node 'n', on its own (its strings and children stay):
+void JSON_freeNode(JSON_STRUCT *j, JSON_NODE *n);
+
 //  Note for these two methods:  as given node 'n' can be part of a compound
 //  object or array 'n->next' MIGHT be valid and pointing to another node.
 //  This node is NOT flushed or copied, instead:
@@ -508,6 +1271,17 @@ char *JSON_newString(JSON_STRUCT *j, int len);
 JSON_NODE *JSON_flushObject(JSON_STRUCT *j, JSON_NODE *n);
 JSON_NODE *JSON_cloneObject(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k);
 
+//  Appends a clone of 'n' as the last child of array or object 'c',
+//  which is in 'j'.  Returns the clone, or NULL on allocation failure.
+JSON_NODE *JSON_appendChild(JSON_STRUCT *j, JSON_NODE *c, JSON_NODE *n);
+
+//  Side index of array 'a'.  'Get' returns NULL if there is no index, 'build'
+//  returns NULL if the array is too short to be worth indexing (or on
+//  allocation failure).  'Drop' frees the index, if any.
+JSON_INDEX *JSON_indexGet(JSON_STRUCT *j, JSON_NODE *a);
+JSON_INDEX *JSON_indexBuild(JSON_STRUCT *j, JSON_NODE *a);
+void JSON_indexDrop(JSON_STRUCT *j, JSON_NODE *a);
+
 //  The actual execution of the query that performs the work:
 #define JSON_QUERY_GET  0   //  Retrieve the match
 #define JSON_QUERY_ADD  1   //  Append after match
@@ -517,6 +1291,15 @@ JSON_NODE *JSON_cloneObject(JSON_STRUCT *j, JSON_NODE *n, JSON_STRUCT *k);
 JSON_NODE *JSON_queryExecuteRecursive(JSON_STRUCT *j, JSON_QUERY *q, int d, JSON_NODE *n, JSON_NODE **p, u_int8_t type, int cmd, JSON_NODE *new, void (*callback)(JSON_NODE *n, void *user), void *user);
 
 
+//  Benchmarks, see the bottom of json.c:
+int JSON_newStringBench(JSON_STRUCT *j);
+int JSON_readCheck(void);
+int JSON_loadBench(char *buf, int len, int rounds, int mode);
+int JSON_inlineBench(char *buf, int len, int rounds);
+int JSON_zipBench(char *path, int rounds);
+int JSON_numBench(int count, int rounds);
+
+
 
 #endif
 
@@ -389,8 +389,11 @@ int main(int argc, char **argv)
             f=fopen(outfile, "wb");
             if (f)
             {
-                JSON_walk(k, JSON_print, (void*)f);
-                fprintf(f, "\n");
+                JSON_OUT o;
+                JSON_outFile(&o, f);
+                JSON_walk(k, JSON_printOut, (void*)&o);
+                JSON_OUTC(&o, '\n');
+                JSON_outFree(&o);
                 fclose(f);
             }
             else
@@ -301,5 +301,955 @@ int sigaction(int signum, struct sigaction *act, struct sigaction *oldact)
 
 
 
+/**************************************************************/
+/*   Memory pages                                             */
+/**************************************************************/
+
+#ifdef WIN32
+
+//  Large pages need a privilege on Windows, so these are regular pages:
+void *BEDROCK_pageAlloc(size_t size)
+{
+    size=(size+BEDROCK_HUGE_PAGE-1)&~((size_t)BEDROCK_HUGE_PAGE-1);
+    return(VirtualAlloc(NULL, size, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE));
+}
+
+void BEDROCK_pageFree(void *p, size_t size)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+    return;
+}
+
+#else
+
+void *BEDROCK_pageAlloc(size_t size)
+{
+    char *p;
+    size_t skew;
+    size=(size+BEDROCK_HUGE_PAGE-1)&~((size_t)BEDROCK_HUGE_PAGE-1);
+
+#ifdef MAP_HUGETLB
+    //  Reserved huge pages, if the system has any:
+    p=(char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (p!=MAP_FAILED)
+        return(p);
+#endif
+
+    //  Otherwise map a huge page more, and trim to alignment, so that
+    //  transparent huge pages can back it:
+    p=(char*)mmap(NULL, size+BEDROCK_HUGE_PAGE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p==MAP_FAILED)
+        return(NULL);
+    skew=(-(size_t)p)&(BEDROCK_HUGE_PAGE-1);
+    if (skew)
+        munmap(p, skew);
+    munmap(p+skew+size, BEDROCK_HUGE_PAGE-skew);
+    p+=skew;
+#ifdef MADV_HUGEPAGE
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+    return(p);
+}
+
+void BEDROCK_pageFree(void *p, size_t size)
+{
+    size=(size+BEDROCK_HUGE_PAGE-1)&~((size_t)BEDROCK_HUGE_PAGE-1);
+    munmap(p, size);
+    return;
+}
+
+#endif
+
+
+
+
+/**************************************************************/
+/*   Thread pool                                              */
+/**************************************************************/
+
+int BEDROCK_cpus(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return((int)si.dwNumberOfProcessors);
+#else
+    long n=sysconf(_SC_NPROCESSORS_ONLN);
+    return((n>0)?(int)n:1);
+#endif
+}
+
+
+//  The pool, and worker, the current thread is part of:
+BEDROCK_TLS BEDROCK_POOL *BEDROCK_poolSelf=NULL;
+BEDROCK_TLS int BEDROCK_poolId=-1;
+
+
+//  Absolute time 'ms' from now, for the timed waits:
+void BEDROCK_timeout(struct timespec *ts, int ms)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    (*ts).tv_sec=tv.tv_sec+ms/1000;
+    (*ts).tv_nsec=(tv.tv_usec+(ms%1000)*1000)*1000;
+    if ((*ts).tv_nsec>=1000000000)
+    {
+        (*ts).tv_sec+=1;
+        (*ts).tv_nsec-=1000000000;
+    }
+    return;
+}
+
+
+//
+//  The deques.  Each has its own lock, which is only ever contended
+//  when a thief and the owner meet.
+//
+int BEDROCK_dequePush(BEDROCK_DEQUE *q, BEDROCK_TASK *t)
+{
+    pthread_mutex_lock(&(*q).m);
+    if ((*q).bottom-(*q).top==(*q).cap)
+    {
+        //  Full, double it:
+        int64_t i;
+        BEDROCK_TASK *v=(BEDROCK_TASK*)malloc(2*(*q).cap*sizeof(BEDROCK_TASK));
+        if (v==NULL)
+        {
+            pthread_mutex_unlock(&(*q).m);
+            return(-1);
+        }
+        for (i=(*q).top; i<(*q).bottom; i+=1)
+            v[i%(2*(*q).cap)]=(*q).v[i%(*q).cap];
+        free((*q).v);
+        (*q).v=v;
+        (*q).cap*=2;
+    }
+    (*q).v[(*q).bottom%(*q).cap]=(*t);
+    (*q).bottom+=1;
+    pthread_mutex_unlock(&(*q).m);
+    return(0);
+}
+
+
+//  The newest, for the owner:
+int BEDROCK_dequePop(BEDROCK_DEQUE *q, BEDROCK_TASK *t)
+{
+    int rc=0;
+    pthread_mutex_lock(&(*q).m);
+    if ((*q).bottom>(*q).top)
+    {
+        (*q).bottom-=1;
+        (*t)=(*q).v[(*q).bottom%(*q).cap];
+        rc=1;
+    }
+    pthread_mutex_unlock(&(*q).m);
+    return(rc);
+}
+
+
+//  The oldest, for thieves:
+int BEDROCK_dequeSteal(BEDROCK_DEQUE *q, BEDROCK_TASK *t)
+{
+    int rc=0;
+    pthread_mutex_lock(&(*q).m);
+    if ((*q).bottom>(*q).top)
+    {
+        (*t)=(*q).v[(*q).top%(*q).cap];
+        (*q).top+=1;
+        rc=1;
+    }
+    pthread_mutex_unlock(&(*q).m);
+    return(rc);
+}
+
+
+//  Finds a task for worker 'id' (-1 for other threads):  its own
+//  newest first, then the oldest of the next worker that has any.
+int BEDROCK_poolTake(BEDROCK_POOL *p, int id, BEDROCK_TASK *t)
+{
+    int i;
+    if (BEDROCK_atomicGet(&(*p).queued)==0)
+        return(0);
+    if (id>=0 && BEDROCK_dequePop(&((*p).q[id]), t))
+    {
+        BEDROCK_atomicAdd(&(*p).queued, -1);
+        return(1);
+    }
+    for (i=1; i<=(*p).cnt; i+=1)
+    {
+        int v=(id+i+(*p).cnt)%(*p).cnt;
+        if (v!=id && BEDROCK_dequeSteal(&((*p).q[v]), t))
+        {
+            BEDROCK_atomicAdd(&(*p).queued, -1);
+            return(1);
+        }
+    }
+    return(0);
+}
+
+
+void BEDROCK_poolRun(BEDROCK_TASK *t)
+{
+    (*(*t).fn)((*t).arg);
+    BEDROCK_atomicAdd((*t).group, -1);
+    return;
+}
+
+
+void *BEDROCK_poolWorker(void *arg)
+{
+    BEDROCK_DEQUE *q=(BEDROCK_DEQUE*)arg;
+    BEDROCK_POOL *p=(*q).pool;
+    BEDROCK_TASK t;
+    struct timespec ts;
+
+    BEDROCK_poolSelf=p;
+    BEDROCK_poolId=(*q).id;
+    while (1)
+    {
+        if (BEDROCK_poolTake(p, (*q).id, &t))
+        {
+            BEDROCK_poolRun(&t);
+            continue;
+        }
+
+        //  Nothing to do, so sleep.  A worker counts itself idle before
+        //  it looks at 'queued', and a submitter adds to 'queued' before
+        //  it looks at 'idle', so one always sees the other.
+        pthread_mutex_lock(&(*p).m);
+        if ((*p).stop)
+        {
+            pthread_mutex_unlock(&(*p).m);
+            break;
+        }
+        BEDROCK_atomicAdd(&(*p).idle, 1);
+        if (BEDROCK_atomicGet(&(*p).queued)==0)
+        {
+            BEDROCK_timeout(&ts, 100);
+            pthread_cond_timedwait(&(*p).wake, &(*p).m, &ts);
+        }
+        BEDROCK_atomicAdd(&(*p).idle, -1);
+        pthread_mutex_unlock(&(*p).m);
+    }
+    return(NULL);
+}
+
+
+//  Submits a task that counts down 'group' when done:
+int BEDROCK_poolSubmitGroup(BEDROCK_POOL *p, void (*fn)(void *arg), void *arg, int64_t *group)
+{
+    BEDROCK_TASK t;
+    int id;
+
+    t.fn=fn;
+    t.arg=arg;
+    t.group=group;
+    if (BEDROCK_poolSelf==p)
+        id=BEDROCK_poolId;
+    else
+        id=(int)(BEDROCK_atomicAdd(&(*p).next, 1)%(*p).cnt);
+
+    BEDROCK_atomicAdd(group, 1);
+    if (BEDROCK_dequePush(&((*p).q[id]), &t)<0)
+    {
+        BEDROCK_atomicAdd(group, -1);
+        return(-1);
+    }
+    BEDROCK_atomicAdd(&(*p).queued, 1);
+
+    //  Wake a sleeper:
+    if (BEDROCK_atomicGet(&(*p).idle)>0)
+    {
+        pthread_mutex_lock(&(*p).m);
+        pthread_cond_signal(&(*p).wake);
+        pthread_mutex_unlock(&(*p).m);
+    }
+    return(0);
+}
+
+
+//  Runs tasks until 'group' is done:
+void BEDROCK_poolWaitGroup(BEDROCK_POOL *p, int64_t *group)
+{
+    BEDROCK_TASK t;
+    int id=(BEDROCK_poolSelf==p)?BEDROCK_poolId:-1;
+    while (BEDROCK_atomicGet(group)>0)
+    {
+        if (BEDROCK_poolTake(p, id, &t))
+            BEDROCK_poolRun(&t);
+        else
+        {
+            //  The last ones are running elsewhere:
+            struct timespec ts;
+            ts.tv_sec=0;
+            ts.tv_nsec=20000;
+            nanosleep(&ts, NULL);
+        }
+    }
+    return;
+}
+
+
+int BEDROCK_poolSubmit(BEDROCK_POOL *p, void (*fn)(void *arg), void *arg)
+{
+    return(BEDROCK_poolSubmitGroup(p, fn, arg, &(*p).pending));
+}
+
+
+void BEDROCK_poolWait(BEDROCK_POOL *p)
+{
+    BEDROCK_poolWaitGroup(p, &(*p).pending);
+    return;
+}
+
+
+
+//  Parallel for, every slice is a task:
+typedef struct
+{
+    void (*fn)(int64_t from, int64_t to, void *arg);
+    void *arg;
+    int64_t from;
+    int64_t to;
+}
+BEDROCK_RANGE;
+
+
+void BEDROCK_poolRange(void *arg)
+{
+    BEDROCK_RANGE *r=(BEDROCK_RANGE*)arg;
+    (*(*r).fn)((*r).from, (*r).to, (*r).arg);
+    return;
+}
+
+
+int BEDROCK_poolFor(BEDROCK_POOL *p, int64_t from, int64_t to, int64_t grain, void (*fn)(int64_t from, int64_t to, void *arg), void *arg)
+{
+    BEDROCK_RANGE *r;
+    int64_t group=0;
+    int64_t n, i;
+
+    if (to<=from)
+        return(0);
+
+    //  A few slices per worker, so that stealing can even out:
+    if (grain<=0)
+        grain=(to-from)/((*p).cnt*8);
+    if (grain<=0)
+        grain=1;
+    n=(to-from+grain-1)/grain;
+    r=(BEDROCK_RANGE*)malloc(n*sizeof(BEDROCK_RANGE));
+    if (r==NULL)
+        return(-1);
+
+    for (i=0; i<n; i+=1)
+    {
+        r[i].fn=fn;
+        r[i].arg=arg;
+        r[i].from=from+i*grain;
+        r[i].to=(r[i].from+grain<to)?r[i].from+grain:to;
+        if (BEDROCK_poolSubmitGroup(p, BEDROCK_poolRange, &(r[i]), &group)<0)
+            BEDROCK_poolRange(&(r[i]));     //  Then just do it here
+    }
+    BEDROCK_poolWaitGroup(p, &group);
+    free(r);
+    return(0);
+}
+
+
+void BEDROCK_poolStop(BEDROCK_POOL *p);
+void BEDROCK_poolFree(BEDROCK_POOL *p);
+
+BEDROCK_POOL *BEDROCK_poolNew(int threads)
+{
+    BEDROCK_POOL *p;
+    int i;
+
+    if (threads<=0)
+        threads=BEDROCK_cpus();
+    p=(BEDROCK_POOL*)calloc(1, sizeof(BEDROCK_POOL));
+    if (p==NULL)
+        return(NULL);
+    (*p).th=(pthread_t*)calloc(threads, sizeof(pthread_t));
+    (*p).q=(BEDROCK_DEQUE*)calloc(threads, sizeof(BEDROCK_DEQUE));
+    if ((*p).th==NULL || (*p).q==NULL)
+    {
+        free((*p).th);
+        free((*p).q);
+        free(p);
+        return(NULL);
+    }
+    pthread_mutex_init(&(*p).m, NULL);
+    pthread_cond_init(&(*p).wake, NULL);
+    for (i=0; i<threads; i+=1)
+    {
+        pthread_mutex_init(&((*p).q[i].m), NULL);
+        (*p).q[i].cap=64;
+        (*p).q[i].v=(BEDROCK_TASK*)malloc((*p).q[i].cap*sizeof(BEDROCK_TASK));
+        (*p).q[i].pool=p;
+        (*p).q[i].id=i;
+    }
+    (*p).cnt=threads;
+
+    //  Start the workers.  If that fails part way, stop the ones started:
+    for (i=0; i<threads; i+=1)
+    {
+        if ((*p).q[i].v==NULL || pthread_create(&((*p).th[i]), NULL, BEDROCK_poolWorker, &((*p).q[i]))!=0)
+        {
+            //  Nothing was submitted yet:
+            (*p).cnt=i;
+            BEDROCK_poolStop(p);
+            (*p).cnt=threads;
+            BEDROCK_poolFree(p);
+            return(NULL);
+        }
+    }
+    return(p);
+}
+
+
+void BEDROCK_poolStop(BEDROCK_POOL *p)
+{
+    int i;
+    void *rc;
+    pthread_mutex_lock(&(*p).m);
+    (*p).stop=1;
+    pthread_cond_broadcast(&(*p).wake);
+    pthread_mutex_unlock(&(*p).m);
+    for (i=0; i<(*p).cnt; i+=1)
+        pthread_join((*p).th[i], &rc);
+    return;
+}
+
+
+void BEDROCK_poolFree(BEDROCK_POOL *p)
+{
+    int i;
+    for (i=0; i<(*p).cnt; i+=1)
+    {
+        pthread_mutex_destroy(&((*p).q[i].m));
+        free((*p).q[i].v);
+    }
+    pthread_mutex_destroy(&(*p).m);
+    pthread_cond_destroy(&(*p).wake);
+    free((*p).th);
+    free((*p).q);
+    free(p);
+    return;
+}
+
+
+//  Waits for all tasks, then stops the workers.
+void BEDROCK_poolDestroy(BEDROCK_POOL *p)
+{
+    BEDROCK_poolWait(p);
+    BEDROCK_poolStop(p);
+    BEDROCK_poolFree(p);
+    return;
+}
+
 
 
+
+/**************************************************************/
+/*   Lock-free rings                                          */
+/**************************************************************/
+
+int64_t BEDROCK_ringSize(int64_t cap)
+{
+    int64_t n=2;
+    while (n<cap)
+        n<<=1;
+    return(n);
+}
+
+
+int BEDROCK_spscInit(BEDROCK_SPSC *r, int64_t cap)
+{
+    cap=BEDROCK_ringSize(cap);
+    memset(r, 0, sizeof(BEDROCK_SPSC));
+    (*r).v=(void**)malloc(cap*sizeof(void*));
+    if ((*r).v==NULL)
+        return(-1);
+    (*r).mask=cap-1;
+    return(0);
+}
+
+
+//  Only the producer writes 'tail', and only the consumer 'head':
+int BEDROCK_spscPush(BEDROCK_SPSC *r, void *v)
+{
+    int64_t t=(*r).tail;
+    if (t-BEDROCK_atomicLoad(&(*r).head)>(*r).mask)
+        return(-1);
+    (*r).v[t&(*r).mask]=v;
+    BEDROCK_atomicStore(&(*r).tail, t+1);
+    return(0);
+}
+
+
+int BEDROCK_spscPop(BEDROCK_SPSC *r, void **v)
+{
+    int64_t h=(*r).head;
+    if (BEDROCK_atomicLoad(&(*r).tail)==h)
+        return(-1);
+    (*v)=(*r).v[h&(*r).mask];
+    BEDROCK_atomicStore(&(*r).head, h+1);
+    return(0);
+}
+
+
+void BEDROCK_spscFree(BEDROCK_SPSC *r)
+{
+    free((*r).v);
+    (*r).v=NULL;
+    return;
+}
+
+
+//
+//  The MPMC ring keeps a sequence number per cell:  a cell at position
+//  'pos' can be written when its sequence is 'pos', and read when it is
+//  'pos+1'.  Producers and consumers claim positions with a CAS.
+//
+int BEDROCK_mpmcInit(BEDROCK_MPMC *r, int64_t cap)
+{
+    int64_t i;
+    cap=BEDROCK_ringSize(cap);
+    memset(r, 0, sizeof(BEDROCK_MPMC));
+    (*r).c=(BEDROCK_CELL*)malloc(cap*sizeof(BEDROCK_CELL));
+    if ((*r).c==NULL)
+        return(-1);
+    for (i=0; i<cap; i+=1)
+        (*r).c[i].seq=i;
+    (*r).mask=cap-1;
+    return(0);
+}
+
+
+int BEDROCK_mpmcPush(BEDROCK_MPMC *r, void *v)
+{
+    BEDROCK_CELL *c;
+    int64_t pos=BEDROCK_atomicLoad(&(*r).tail);
+    while (1)
+    {
+        int64_t seq;
+        c=&((*r).c[pos&(*r).mask]);
+        seq=BEDROCK_atomicLoad(&(*c).seq);
+        if (seq==pos)
+        {
+            if (BEDROCK_atomicCas(&(*r).tail, pos, pos+1))
+                break;
+        }
+        else if (seq<pos)
+            return(-1);     //  Full
+        pos=BEDROCK_atomicLoad(&(*r).tail);
+    }
+    (*c).v=v;
+    BEDROCK_atomicStore(&(*c).seq, pos+1);
+    return(0);
+}
+
+
+int BEDROCK_mpmcPop(BEDROCK_MPMC *r, void **v)
+{
+    BEDROCK_CELL *c;
+    int64_t pos=BEDROCK_atomicLoad(&(*r).head);
+    while (1)
+    {
+        int64_t seq;
+        c=&((*r).c[pos&(*r).mask]);
+        seq=BEDROCK_atomicLoad(&(*c).seq);
+        if (seq==pos+1)
+        {
+            if (BEDROCK_atomicCas(&(*r).head, pos, pos+1))
+                break;
+        }
+        else if (seq<pos+1)
+            return(-1);     //  Empty
+        pos=BEDROCK_atomicLoad(&(*r).head);
+    }
+    (*v)=(*c).v;
+    BEDROCK_atomicStore(&(*c).seq, pos+(*r).mask+1);
+    return(0);
+}
+
+
+void BEDROCK_mpmcFree(BEDROCK_MPMC *r)
+{
+    free((*r).c);
+    (*r).c=NULL;
+    return;
+}
+
+
+void BEDROCK_backoff(int *spins)
+{
+    (*spins)+=1;
+    if ((*spins)>100)
+    {
+        struct timespec ts;
+        ts.tv_sec=0;
+        ts.tv_nsec=50000;
+        nanosleep(&ts, NULL);
+    }
+    return;
+}
+
+
+
+
+
+/**************************************************************/
+/*   Read-ahead                                               */
+/**************************************************************/
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BEDROCK_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+
+int64_t BEDROCK_pread(int fd, char *buf, int64_t len, int64_t off)
+{
+#ifdef WIN32
+    OVERLAPPED o;
+    DWORD n;
+    memset(&o, 0, sizeof(OVERLAPPED));
+    o.Offset=(DWORD)off;
+    o.OffsetHigh=(DWORD)(off>>32);
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)len, &n, &o))
+        return((GetLastError()==ERROR_HANDLE_EOF)?0:-1);
+    return((int64_t)n);
+#else
+    int64_t n;
+    do
+        n=pread(fd, buf, len, off);
+    while (n<0 && errno==EINTR);
+    return(n);
+#endif
+}
+
+
+//  Reads are only short at the end of the file, or on an interrupt.
+//  In the latter case the rest is read here:
+void BEDROCK_readerFinish(BEDROCK_READ_SLOT *s, int64_t size)
+{
+    while ((*s).len>0 && (*s).len<size)
+    {
+        int64_t n=BEDROCK_pread((*s).fd, (*s).buf+(*s).len, size-(*s).len, (*s).off+(*s).len);
+        if (n<0)
+            (*s).len=-1;
+        if (n<=0)
+            break;
+        (*s).len+=n;
+    }
+    return;
+}
+
+
+//  A read as a task on the pool:
+void BEDROCK_readerTask(void *arg)
+{
+    BEDROCK_READ_SLOT *s=(BEDROCK_READ_SLOT*)arg;
+    (*s).len=BEDROCK_pread((*s).fd, (*s).buf, (*s).len, (*s).off);
+    return;
+}
+
+
+#ifdef BEDROCK_URING
+
+int BEDROCK_uringSetup(BEDROCK_READER *r)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(struct io_uring_params));
+    (*r).ring=syscall(__NR_io_uring_setup, (*r).depth, &p);
+    if ((*r).ring<0)
+        return(-1);
+
+    (*r).sqSize=p.sq_off.array+p.sq_entries*sizeof(u_int32_t);
+    (*r).cqSize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    (*r).sqesSize=p.sq_entries*sizeof(struct io_uring_sqe);
+    (*r).sq=mmap(NULL, (*r).sqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, (*r).ring, IORING_OFF_SQ_RING);
+    (*r).cq=mmap(NULL, (*r).cqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, (*r).ring, IORING_OFF_CQ_RING);
+    (*r).sqes=mmap(NULL, (*r).sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, (*r).ring, IORING_OFF_SQES);
+    (*r).iov=calloc((*r).depth, sizeof(struct iovec));
+    if ((*r).sq==MAP_FAILED || (*r).cq==MAP_FAILED || (*r).sqes==MAP_FAILED || (*r).iov==NULL)
+        return(-1);
+
+    sq=(char*)(*r).sq;
+    cq=(char*)(*r).cq;
+    (*r).sqTail=(u_int32_t*)(sq+p.sq_off.tail);
+    (*r).sqMask=(u_int32_t*)(sq+p.sq_off.ring_mask);
+    (*r).sqArray=(u_int32_t*)(sq+p.sq_off.array);
+    (*r).cqHead=(u_int32_t*)(cq+p.cq_off.head);
+    (*r).cqTail=(u_int32_t*)(cq+p.cq_off.tail);
+    (*r).cqMask=(u_int32_t*)(cq+p.cq_off.ring_mask);
+    (*r).cqes=cq+p.cq_off.cqes;
+    return(0);
+}
+
+
+void BEDROCK_uringFree(BEDROCK_READER *r)
+{
+    if ((*r).sq && (*r).sq!=MAP_FAILED)
+        munmap((*r).sq, (*r).sqSize);
+    if ((*r).cq && (*r).cq!=MAP_FAILED)
+        munmap((*r).cq, (*r).cqSize);
+    if ((*r).sqes && (*r).sqes!=MAP_FAILED)
+        munmap((*r).sqes, (*r).sqesSize);
+    free((*r).iov);
+    if ((*r).ring>=0)
+        close((*r).ring);
+    (*r).sq=(*r).cq=(*r).sqes=(*r).iov=NULL;
+    (*r).ring=-1;
+    return;
+}
+
+
+int BEDROCK_uringSubmit(BEDROCK_READER *r, int i)
+{
+    struct iovec *iov=&(((struct iovec*)(*r).iov)[i]);
+    struct io_uring_sqe *sqe;
+    u_int32_t tail=(*(*r).sqTail);
+    u_int32_t idx=tail&(*(*r).sqMask);
+    int rc;
+
+    (*iov).iov_base=(*r).slot[i].buf;
+    (*iov).iov_len=(*r).size;
+    sqe=&(((struct io_uring_sqe*)(*r).sqes)[idx]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    (*sqe).opcode=IORING_OP_READV;
+    (*sqe).fd=(*r).fd;
+    (*sqe).addr=(u_int64_t)(size_t)iov;
+    (*sqe).len=1;
+    (*sqe).off=(*r).slot[i].off;
+    (*sqe).user_data=i;
+    (*r).sqArray[idx]=idx;
+    BEDROCK_atomicStore((*r).sqTail, tail+1);
+
+    do
+        rc=syscall(__NR_io_uring_enter, (*r).ring, 1, 0, 0, NULL, 0);
+    while (rc<0 && errno==EINTR);
+    return((rc==1)?0:-1);
+}
+
+
+//  Reaps completions until slot 'i' is done:
+int BEDROCK_uringWait(BEDROCK_READER *r, int i)
+{
+    while (BEDROCK_atomicGet(&(*r).slot[i].busy))
+    {
+        u_int32_t head=(*(*r).cqHead);
+        if (head!=BEDROCK_atomicLoad((*r).cqTail))
+        {
+            struct io_uring_cqe *cqe=&(((struct io_uring_cqe*)(*r).cqes)[head&(*(*r).cqMask)]);
+            BEDROCK_READ_SLOT *s=&((*r).slot[(*cqe).user_data]);
+            (*s).len=((*cqe).res<0)?-1:(*cqe).res;
+            (*s).busy=0;
+            BEDROCK_atomicStore((*r).cqHead, head+1);
+        }
+        else if (syscall(__NR_io_uring_enter, (*r).ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0)<0 && errno!=EINTR)
+            return(-1);
+    }
+    return(0);
+}
+
+#endif
+
+
+//  Starts the read for slot 'i' at the next offset:
+int BEDROCK_readerSubmit(BEDROCK_READER *r, int i)
+{
+    BEDROCK_READ_SLOT *s=&((*r).slot[i]);
+    (*s).off=(*r).off;
+    (*r).off+=(*r).size;
+#ifdef BEDROCK_URING
+    if ((*r).ring>=0)
+    {
+        (*s).busy=1;
+        if (BEDROCK_uringSubmit(r, i)==0)
+            return(0);
+        (*s).busy=0;
+        (*s).len=-1;
+        return(-1);
+    }
+#endif
+    (*s).len=(*r).size;
+    if (BEDROCK_poolSubmitGroup((*r).pool, BEDROCK_readerTask, s, &(*s).busy)<0)
+    {
+        (*s).len=-1;
+        return(-1);
+    }
+    return(0);
+}
+
+
+void BEDROCK_readerWait(BEDROCK_READER *r, int i)
+{
+#ifdef BEDROCK_URING
+    if ((*r).ring>=0)
+    {
+        if (BEDROCK_uringWait(r, i)<0)
+        {
+            (*r).slot[i].len=-1;
+            (*r).slot[i].busy=0;
+        }
+        return;
+    }
+#endif
+    BEDROCK_poolWaitGroup((*r).pool, &((*r).slot[i].busy));
+    return;
+}
+
+
+int BEDROCK_readerOpen(BEDROCK_READER *r, int fd, int depth, int64_t size, int flags)
+{
+    int i;
+    int64_t off;
+
+    memset(r, 0, sizeof(BEDROCK_READER));
+    (*r).ring=-1;
+#ifdef WIN32
+    off=_lseeki64(fd, 0, SEEK_CUR);
+#else
+    off=lseek(fd, 0, SEEK_CUR);
+#endif
+    if (off<0)
+        return(-1);     //  Not seekable
+
+    (*r).fd=fd;
+    (*r).depth=(depth>0)?depth:BEDROCK_READ_DEPTH;
+    (*r).size=(size>0)?size:BEDROCK_READ_SIZE;
+    (*r).off=off;
+    (*r).start=off;
+    (*r).slot=(BEDROCK_READ_SLOT*)calloc((*r).depth, sizeof(BEDROCK_READ_SLOT));
+    if ((*r).slot==NULL)
+        return(-1);
+    for (i=0; i<(*r).depth; i+=1)
+    {
+        (*r).slot[i].fd=fd;
+        (*r).slot[i].buf=(char*)malloc((*r).size);
+        if ((*r).slot[i].buf==NULL)
+        {
+            BEDROCK_readerClose(r);
+            return(-1);
+        }
+    }
+
+#ifdef BEDROCK_URING
+    if (!(flags&BEDROCK_READ_POOL) && BEDROCK_uringSetup(r)<0)
+        BEDROCK_uringFree(r);
+#endif
+    if ((*r).ring<0)
+    {
+        //  Blocking reads, so not more threads than reads:
+        (*r).pool=BEDROCK_poolNew(((*r).depth<4)?(*r).depth:4);
+        if ((*r).pool==NULL)
+        {
+            BEDROCK_readerClose(r);
+            return(-1);
+        }
+    }
+
+    for (i=0; i<(*r).depth; i+=1)
+        BEDROCK_readerSubmit(r, i);
+    (*r).pos=-1;
+    return(0);
+}
+
+
+int64_t BEDROCK_readerNext(BEDROCK_READER *r, char **buf)
+{
+    BEDROCK_READ_SLOT *s;
+    int i;
+
+    if ((*r).eof)
+        return(0);
+
+    //  The previous buffer is done with, so it can read ahead again:
+    if ((*r).pos>=0)
+    {
+        i=(int)(((*r).next-1)%(*r).depth);
+        (*r).start+=(*r).slot[i].len;
+        BEDROCK_readerSubmit(r, i);
+    }
+
+    i=(int)((*r).next%(*r).depth);
+    s=&((*r).slot[i]);
+    BEDROCK_readerWait(r, i);
+    BEDROCK_readerFinish(s, (*r).size);
+    (*r).next+=1;
+    (*r).pos=(*s).len;      //  All of it, unless 'BEDROCK_readerRead' says otherwise
+    if ((*s).len<=0)
+    {
+        (*r).eof=((*s).len==0)?1:-1;
+        (*r).pos=-1;
+        return(((*s).len==0)?0:-1);
+    }
+    (*buf)=(*s).buf;
+    return((*s).len);
+}
+
+
+int64_t BEDROCK_readerRead(BEDROCK_READER *r, char *buf, int64_t len)
+{
+    BEDROCK_READ_SLOT *s;
+    int64_t n;
+    char *b;
+
+    if ((*r).pos<0 || (*r).pos==(*r).slot[((*r).next-1)%(*r).depth].len)
+    {
+        n=BEDROCK_readerNext(r, &b);
+        if (n<=0)
+            return(n);
+        (*r).pos=0;
+    }
+    s=&((*r).slot[((*r).next-1)%(*r).depth]);
+    n=(*s).len-(*r).pos;
+    if (n>len)
+        n=len;
+    memcpy(buf, (*s).buf+(*r).pos, n);
+    (*r).pos+=n;
+    return(n);
+}
+
+
+void BEDROCK_readerClose(BEDROCK_READER *r)
+{
+    int i;
+    int64_t end=(*r).start;
+
+    if ((*r).slot==NULL)
+        return;
+
+    //  Where the caller got to:
+    if ((*r).pos>0)
+        end+=(*r).pos;
+
+    //  Nothing may still be reading into the buffers:
+    for (i=0; i<(*r).depth; i+=1)
+        if ((*r).ring>=0 || (*r).pool)
+            BEDROCK_readerWait(r, i);
+#ifdef BEDROCK_URING
+    BEDROCK_uringFree(r);
+#endif
+    if ((*r).pool)
+        BEDROCK_poolDestroy((*r).pool);
+    for (i=0; i<(*r).depth; i+=1)
+        free((*r).slot[i].buf);
+    free((*r).slot);
+    (*r).slot=NULL;
+#ifdef WIN32
+    _lseeki64((*r).fd, end, SEEK_SET);
+#else
+    lseek((*r).fd, end, SEEK_SET);
+#endif
+    return;
+}
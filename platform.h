@@ -86,6 +86,12 @@ typedef unsigned short u_int16_t;
 typedef unsigned int u_int32_t;
 typedef unsigned long long u_int64_t;
 
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+
 /*
 struct timeval
 {
@@ -109,6 +115,9 @@ int nanosleep(const struct timespec *req, struct timespec *rem);    //  Millisec
 long random(void);
 void srandom(unsigned int seed);
 int rand_r(unsigned int *seedp);
+#define getc_unlocked _getc_nolock
+#define flockfile _lock_file
+#define funlockfile _unlock_file
 
     //  
     //  Posix threads are missing on windows:
@@ -202,6 +211,8 @@ int sigaction(int signum, struct sigaction *act, struct sigaction *oldact);
 #include <stdlib.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/errno.h>
 #include <netinet/in.h>
@@ -212,6 +223,208 @@ int sigaction(int signum, struct sigaction *act, struct sigaction *oldact);
 
 
 
+    //
+    //  Memory straight from the OS, in multiples of a huge page, and
+    //  backed by huge pages where possible.  'size' must be passed again
+    //  when freeing.
+    //
+#define BEDROCK_HUGE_PAGE (2<<20)
+void *BEDROCK_pageAlloc(size_t size);
+void BEDROCK_pageFree(void *p, size_t size);
+
+
+
+    //
+    //  Atomic counters, sequentially consistent:
+    //
+//  Plus acquire loads, release stores, and compare-and-swap of 'p' from
+//  'e' (a variable) to 'd', which is non-zero if it swapped:
+#ifdef _WIN32
+#define BEDROCK_atomicAdd(p, v) (InterlockedExchangeAdd64((volatile LONG64*)(p), (v))+(v))
+#define BEDROCK_atomicGet(p) InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+#define BEDROCK_atomicLoad(p) InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0)
+#define BEDROCK_atomicStore(p, v) InterlockedExchange64((volatile LONG64*)(p), (v))
+#define BEDROCK_atomicCas(p, e, d) (InterlockedCompareExchange64((volatile LONG64*)(p), (d), (e))==(e))
+#define BEDROCK_TLS __declspec(thread)
+#else
+#define BEDROCK_atomicAdd(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define BEDROCK_atomicGet(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define BEDROCK_atomicLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define BEDROCK_atomicStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define BEDROCK_atomicCas(p, e, d) __atomic_compare_exchange_n((p), &(e), (d), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define BEDROCK_TLS __thread
+#endif
+
+//  Number of processors online:
+int BEDROCK_cpus(void);
+
+
+
+    //
+    //  Work-stealing thread pool.  Every worker has its own deque of
+    //  tasks:  it runs the newest of its own first, and when it has none
+    //  left it steals the oldest from another worker.  Tasks submitted
+    //  from a worker go onto that worker's deque, others are spread
+    //  round-robin.  Tasks may submit more tasks, and may use
+    //  'BEDROCK_poolFor' themselves.
+    //
+    //  'BEDROCK_poolWait' returns when every task submitted so far (and
+    //  the tasks they submitted) is done.  It must not be called from a
+    //  task.  Waiting threads run tasks in the meantime.
+    //
+    //  'BEDROCK_poolFor' calls 'fn' on the range [from, to) in slices of
+    //  about 'grain' (0 picks one), in parallel, and returns when all
+    //  slices are done.
+    //
+typedef struct BEDROCK_TASK_S
+{
+    void (*fn)(void *arg);
+    void *arg;
+    int64_t *group;         //  Counts down when done
+}
+BEDROCK_TASK;
+
+typedef struct
+{
+    pthread_mutex_t m;
+    BEDROCK_TASK *v;
+    int64_t top;            //  Stolen from here
+    int64_t bottom;         //  Owner pushes and pops here
+    int64_t cap;
+    struct BEDROCK_POOL_S *pool;
+    int id;                 //  The worker that owns it
+}
+BEDROCK_DEQUE;
+
+typedef struct BEDROCK_POOL_S
+{
+    int cnt;                //  Workers
+    pthread_t *th;
+    BEDROCK_DEQUE *q;       //  One per worker
+
+    int64_t queued;         //  Tasks in all deques
+    int64_t pending;        //  Tasks submitted, and not yet done
+    int64_t next;           //  Round-robin for outside submissions
+    int64_t idle;           //  Workers asleep
+    int stop;
+    pthread_mutex_t m;
+    pthread_cond_t wake;
+}
+BEDROCK_POOL;
+
+BEDROCK_POOL *BEDROCK_poolNew(int threads);     //  0 is one per processor
+int BEDROCK_poolSubmit(BEDROCK_POOL *p, void (*fn)(void *arg), void *arg);
+void BEDROCK_poolWait(BEDROCK_POOL *p);
+int BEDROCK_poolFor(BEDROCK_POOL *p, int64_t from, int64_t to, int64_t grain, void (*fn)(int64_t from, int64_t to, void *arg), void *arg);
+void BEDROCK_poolDestroy(BEDROCK_POOL *p);
+
+
+
+    //
+    //  Lock-free bounded rings of pointers.  SPSC is for exactly one
+    //  producer and one consumer thread, MPMC for any number of each.
+    //  The capacity is rounded up to a power of 2.  Push returns -1 when
+    //  the ring is full, pop returns -1 when it is empty;  neither ever
+    //  blocks.  Callers that need to wait use 'BEDROCK_backoff', which
+    //  spins a little first, then sleeps a little.
+    //
+#define BEDROCK_CACHE_LINE 64
+typedef struct
+{
+    int64_t head;           //  Consumer
+    char pad0[BEDROCK_CACHE_LINE-sizeof(int64_t)];
+    int64_t tail;           //  Producer
+    char pad1[BEDROCK_CACHE_LINE-sizeof(int64_t)];
+    int64_t mask;
+    void **v;
+}
+BEDROCK_SPSC;
+
+typedef struct
+{
+    int64_t seq;            //  Which lap of the ring this cell is ready for
+    void *v;
+}
+BEDROCK_CELL;
+
+typedef struct
+{
+    int64_t head;
+    char pad0[BEDROCK_CACHE_LINE-sizeof(int64_t)];
+    int64_t tail;
+    char pad1[BEDROCK_CACHE_LINE-sizeof(int64_t)];
+    int64_t mask;
+    BEDROCK_CELL *c;
+}
+BEDROCK_MPMC;
+
+int BEDROCK_spscInit(BEDROCK_SPSC *r, int64_t cap);
+int BEDROCK_spscPush(BEDROCK_SPSC *r, void *v);
+int BEDROCK_spscPop(BEDROCK_SPSC *r, void **v);
+void BEDROCK_spscFree(BEDROCK_SPSC *r);
+
+int BEDROCK_mpmcInit(BEDROCK_MPMC *r, int64_t cap);
+int BEDROCK_mpmcPush(BEDROCK_MPMC *r, void *v);
+int BEDROCK_mpmcPop(BEDROCK_MPMC *r, void **v);
+void BEDROCK_mpmcFree(BEDROCK_MPMC *r);
+
+//  Start 'spins' at 0, and call this each time the ring was not ready:
+void BEDROCK_backoff(int *spins);
+
+
+
+
+    //
+    //  Sequential read-ahead of a file.  'depth' reads of 'size' bytes
+    //  each are kept in flight, ahead of where the caller is.  On Linux
+    //  these go through io_uring, elsewhere (or when io_uring is not
+    //  allowed) 'pread' calls run on a small thread pool.  The file must
+    //  be seekable, reading starts at its current offset, and on close
+    //  the offset is left at the end of what was consumed.
+    //
+    //  'BEDROCK_readerNext' hands out the next buffer, which stays valid
+    //  until the next call.  'BEDROCK_readerRead' copies instead, like
+    //  'read'.  Both return the bytes, 0 at the end, or -1 on an error.
+    //
+#define BEDROCK_READ_DEPTH  8
+#define BEDROCK_READ_SIZE   (1<<20)
+#define BEDROCK_READ_POOL   0x01        //  Never use io_uring
+typedef struct
+{
+    char *buf;
+    int64_t off;
+    int64_t len;            //  What was read, or -1
+    int64_t busy;           //  In flight
+    int fd;
+}
+BEDROCK_READ_SLOT;
+
+typedef struct
+{
+    int fd;
+    int depth;
+    int64_t size;
+    int64_t off;            //  Of the next read to submit
+    int64_t next;           //  Slot handed out next
+    int64_t pos;            //  Consumed of the current slot, by 'BEDROCK_readerRead'
+    int64_t start;          //  Offset of the current slot
+    int eof;
+    BEDROCK_READ_SLOT *slot;
+
+    //  One or the other:
+    BEDROCK_POOL *pool;
+    int ring;               //  io_uring, or -1
+    void *sq, *cq, *sqes, *cqes, *iov;
+    size_t sqSize, cqSize, sqesSize;
+    u_int32_t *sqTail, *sqMask, *sqArray;
+    u_int32_t *cqHead, *cqTail, *cqMask;
+}
+BEDROCK_READER;
+
+int BEDROCK_readerOpen(BEDROCK_READER *r, int fd, int depth, int64_t size, int flags);
+int64_t BEDROCK_readerNext(BEDROCK_READER *r, char **buf);
+int64_t BEDROCK_readerRead(BEDROCK_READER *r, char *buf, int64_t len);
+void BEDROCK_readerClose(BEDROCK_READER *r);
 
 
 